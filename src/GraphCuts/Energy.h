@@ -4,16 +4,25 @@
 #include <assert.h>
 #include "Graph.h"
 
-class Energy : Graph<short, short, int> {
+/// Binary energy minimized by graph cut.
+///
+/// \a captype is the type of a value in a single term (and of the arc
+/// capacities), \a idtype the index type of variables and arcs, \a statstype
+/// that of the statistics of minimize() (see Graph).
+template <typename captype, typename idtype,
+          typename statstype = NoGraphStats>
+class Energy : Graph<captype, captype, long long, idtype, statstype> {
+    typedef Graph<captype, captype, long long, idtype, statstype> GraphT;
 public:
-    typedef node_id Var;
-    typedef short Value; ///< Type of a value in a single term
-    typedef int TotalValue; ///< Type of a value of the total energy
+    typedef typename GraphT::node_id Var;
+    typedef captype Value; ///< Type of a value in a single term
+    typedef long long TotalValue; ///< Type of a value of the total energy
 
-    Energy(int hintNbNodes = 0, int hintNbArcs = 0);
+    Energy(idtype hintNbNodes = 0, idtype hintNbArcs = 0);
     ~Energy();
 
     Var add_variable(Value E0 = 0, Value E1 = 0);
+    Var var_num() const;
     void add_constant(Value E);
     void add_term1(Var x, Value E0, Value E1);
     void add_term2(Var x, Var y, Value E00, Value E01, Value E10, Value E11);
@@ -21,64 +30,108 @@ public:
 
     TotalValue minimize();
     int get_var(Var x) const;
+    /// Statistics of the last minimize()
+    const statstype &get_stats() const {
+        return GraphT::get_stats();
+    }
+
+    /// Append the graph to binary file \a f, before minimize (Graph::write)
+    bool write_graph(FILE *f) const {
+        return this->write(f);
+    }
 
 private:
     TotalValue Econst; ///< Constant added to the energy
 };
 
+/// Compact layout: 16-bit values, 32-bit indices.
+typedef Energy<short, int> EnergyS32;
+/// 32-bit values for large smoothness/occlusion costs, 32-bit indices.
+typedef Energy<int, int> EnergyI32;
+/// 16-bit values, 64-bit indices for graphs beyond 2^31 arcs.
+typedef Energy<short, long long> EnergyS64;
+/// 32-bit values, 64-bit indices.
+typedef Energy<int, long long> EnergyI64;
+/// Same layouts, with statistics of minimize().
+typedef Energy<short, int, GraphStats> EnergyS32Stats;
+typedef Energy<int, int, GraphStats> EnergyI32Stats;
+typedef Energy<short, long long, GraphStats> EnergyS64Stats;
+typedef Energy<int, long long, GraphStats> EnergyI64Stats;
+
 /// Constructor.
 /// For efficiency, it is advised to give appropriate hint sizes.
-inline Energy::Energy(int hintNbNodes, int hintNbArcs)
-    : Graph<short, short, int>(hintNbNodes, hintNbArcs), Econst(0)
+template <typename captype, typename idtype, typename statstype>
+inline Energy<captype, idtype, statstype>::Energy(idtype hintNbNodes,
+        idtype hintNbArcs)
+    : GraphT(hintNbNodes, hintNbArcs), Econst(0)
 {}
 
 /// Destructor
-inline Energy::~Energy() {}
+template <typename captype, typename idtype, typename statstype>
+inline Energy<captype, idtype, statstype>::~Energy() {}
 
 /// Add a new binary variable
-inline Energy::Var Energy::add_variable(Value E0, Value E1) {
-    Energy::Var var = add_node();
+template <typename captype, typename idtype, typename statstype>
+inline typename Energy<captype, idtype, statstype>::Var
+Energy<captype, idtype, statstype>::add_variable(Value E0, Value E1) {
+    Var var = this->add_node();
     add_term1(var, E0, E1);
     return var;
 }
 
+/// Number of variables added so far. The next variable gets this id.
+template <typename captype, typename idtype, typename statstype>
+inline typename Energy<captype, idtype, statstype>::Var
+Energy<captype, idtype, statstype>::var_num() const {
+    return this->get_node_num();
+}
+
 /// Add a constant to the energy function
-inline void Energy::add_constant(Value A) {
+template <typename captype, typename idtype, typename statstype>
+inline void Energy<captype, idtype, statstype>::add_constant(Value A) {
     Econst += A;
 }
 
 /// Add a term E(x) of one binary variable to the energy function, where
 /// E(0)=E0, E(1)=E1. E0 and E1 can be arbitrary.
-inline void Energy::add_term1(Var x, Value E0, Value E1) {
-    add_tweights(x, E1, E0);
+template <typename captype, typename idtype, typename statstype>
+inline void Energy<captype, idtype, statstype>::add_term1(Var x,
+        Value E0, Value E1) {
+    this->add_tweights(x, E1, E0);
 }
 
 /// Add a term E(x,y) of two binary variables to the energy function, where
 /// E(0,0)=A, E(0,1)=B, E(1,0)=C, E(1,1)=D.
 /// The term must be regular, i.e. E00+E11 <= E01+E10
-inline void Energy::add_term2(Var x, Var y, Value A, Value B, Value C, Value D) {
+template <typename captype, typename idtype, typename statstype>
+inline void Energy<captype, idtype, statstype>::add_term2(Var x, Var y,
+        Value A, Value B, Value C, Value D) {
     // E = A B = B B + A-B 0 +    0    0
     //     C D   D D   A-B 0   B+C-A-D 0
-    add_tweights(x, D, B);
-    add_tweights(y, 0, A - B);
-    add_edge(x, y, 0, B + C - A - D);
+    this->add_tweights(x, D, B);
+    this->add_tweights(y, 0, A - B);
+    this->add_edge(x, y, 0, B + C - A - D);
 }
 
 /// Forbid (x,y)=(0,1) by putting infinite value to the arc from x to y.
-inline void Energy::forbid01(Var x, Var y) {
-    add_edge_infty(x, y);
+template <typename captype, typename idtype, typename statstype>
+inline void Energy<captype, idtype, statstype>::forbid01(Var x, Var y) {
+    this->add_edge_infty(x, y);
 }
 
 /// After construction of the energy function, call this to minimize it.
 /// Return the minimum of the function
-inline Energy::TotalValue Energy::minimize() {
-    return Econst + maxflow();
+template <typename captype, typename idtype, typename statstype>
+inline typename Energy<captype, idtype, statstype>::TotalValue
+Energy<captype, idtype, statstype>::minimize() {
+    return Econst + this->maxflow();
 }
 
 /// After 'minimize' has been called, determine the value of variable 'x'
 /// in the optimal solution. Can be 0 or 1.
-inline int Energy::get_var(Var x) const {
-    return (int)what_segment(x, SINK);
+template <typename captype, typename idtype, typename statstype>
+inline int Energy<captype, idtype, statstype>::get_var(Var x) const {
+    return (int)this->what_segment(x, GraphT::SINK);
 }
 
 #endif
@@ -2,22 +2,124 @@
 #define GRAPH_H
 
 #include <string.h>
+#include <stdio.h>
 #include <assert.h>
+#include <algorithm>
+#include <chrono>
 #include <vector>
 #include <queue>
 #include <limits>
 
 
-template <typename captype, typename tcaptype, typename flowtype> class Graph {
+/// Phases of a max-flow computation
+enum GraphPhase { GRAPH_NONE, GRAPH_INIT, GRAPH_GROW, GRAPH_AUGMENT,
+                  GRAPH_ADOPT, GRAPH_NB_PHASES };
+
+/// No statistics of max-flow: calls compile to nothing.
+struct NoGraphStats {
+    void reset() {}
+    void graph(long long, long long) {}
+    void phase(GraphPhase) {}
+    void grow() {}
+    void augment() {}
+    void path(int) {}
+    void orphan() {}
+    void walk(int) {}
+};
+
+/// Counters and time per phase of the last max-flow computation. Reading the
+/// clock at each phase change slows the computation down a little.
+struct GraphStats {
+    long long nodes, arcs;   ///< size of the graph
+    long long growths;       ///< active nodes whose neighbors were explored
+    long long augmentations; ///< augmenting paths
+    long long pathArcs;      ///< arcs between nodes of augmenting paths
+    long long longestPath;   ///< arcs of the longest augmenting path
+    long long orphans;       ///< orphans processed
+    long long walks;         ///< searches of the root of a node (dist_to_root)
+    long long walkSteps;     ///< arcs followed by these searches
+    double seconds[GRAPH_NB_PHASES]; ///< time spent in each phase
+
+    GraphStats() {
+        reset();
+    }
+    void reset() {
+        nodes = arcs = growths = augmentations = pathArcs = longestPath = 0;
+        orphans = walks = walkSteps = 0;
+        for (int p = 0; p < GRAPH_NB_PHASES; p++) {
+            seconds[p] = 0;
+        }
+        current = GRAPH_NONE;
+        start = std::chrono::steady_clock::now();
+    }
+    /// Add the counters and times of \a s, as for a graph of both.
+    void add(const GraphStats &s) {
+        nodes += s.nodes;
+        arcs += s.arcs;
+        growths += s.growths;
+        augmentations += s.augmentations;
+        pathArcs += s.pathArcs;
+        longestPath = std::max(longestPath, s.longestPath);
+        orphans += s.orphans;
+        walks += s.walks;
+        walkSteps += s.walkSteps;
+        for (int p = 0; p < GRAPH_NB_PHASES; p++) {
+            seconds[p] += s.seconds[p];
+        }
+    }
+    void graph(long long n, long long a) {
+        nodes = n;
+        arcs = a;
+    }
+    /// Enter phase \a p, the time since the last call going to the previous
+    void phase(GraphPhase p) {
+        std::chrono::steady_clock::time_point now =
+            std::chrono::steady_clock::now();
+        seconds[current] += std::chrono::duration<double>(now - start).count();
+        current = p;
+        start = now;
+    }
+    void grow() {
+        ++growths;
+    }
+    void augment() {
+        ++augmentations;
+    }
+    void path(int length) {
+        pathArcs += length;
+        longestPath = std::max(longestPath, (long long)length);
+    }
+    void orphan() {
+        ++orphans;
+    }
+    void walk(int steps) {
+        ++walks;
+        walkSteps += steps;
+    }
+private:
+    GraphPhase current;
+    std::chrono::steady_clock::time_point start;
+};
+
+/// Graph for max-flow computation (Boykov-Kolmogorov algorithm).
+///
+/// \a idtype is the signed integer type indexing nodes and arcs. Use \c int for
+/// compact storage, a 64-bit type when the number of arcs may exceed 2^31.
+/// \a statstype is NoGraphStats, or GraphStats to measure max-flow.
+template <typename captype, typename tcaptype, typename flowtype,
+          typename idtype = int, typename statstype = NoGraphStats>
+class Graph {
 public:
     typedef enum { SOURCE = 0, SINK = 1} termtype; ///< terminals
-    typedef int node_id;
-    typedef int arc_id;
+    typedef idtype node_id;
+    typedef idtype arc_id;
 
-    Graph(int hintNbNodes = 0, int hintNbArcs = 0);
+    Graph(idtype hintNbNodes = 0, idtype hintNbArcs = 0);
     virtual ~Graph();
 
     node_id add_node();
+    node_id get_node_num() const;
+    arc_id get_arc_num() const;
     void add_edge(node_id i, node_id j, captype capij, captype capji);
     void add_edge_infty(node_id i, node_id j);
     void add_tweights(node_id i, tcaptype capS, tcaptype capT);
@@ -25,6 +127,15 @@ public:
     flowtype maxflow();
     termtype what_segment(node_id i, termtype defaultSegm = SOURCE) const;
 
+    /// Statistics of the last maxflow()
+    const statstype &get_stats() const {
+        return stats;
+    }
+
+    bool write(FILE *f) const;
+    bool read(FILE *f);
+    static int read_cap_size(FILE *f);
+
 private:
     struct node;
     struct arc;
@@ -54,6 +165,7 @@ private:
     node *activeBegin, *activeEnd; ///< list of active nodes
     std::queue<node *> orphans; ///< list of pointers to orphans
     int time; ///< monotonically increasing global counter
+    statstype stats;
 
     // special constants for node.parent
     arc *TERMINAL; ///< arc to terminal
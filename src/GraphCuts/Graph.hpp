@@ -2,8 +2,9 @@
 
 /// Constructor.
 /// For efficiency, it is advised to give appropriate hint sizes.
-template <typename captype, typename tcaptype, typename flowtype>
-Graph<captype, tcaptype, flowtype>::Graph(int hintNbNodes, int hintNbArcs)
+template <typename captype, typename tcaptype, typename flowtype, typename idtype,
+          typename statstype>
+Graph<captype, tcaptype, flowtype, idtype, statstype>::Graph(idtype hintNbNodes, idtype hintNbArcs)
     : nodes(), arcs(), flow(0), activeBegin(0), activeEnd(0), orphans(), time(0),
       TERMINAL(0), ORPHAN(0) {
     nodes.reserve(hintNbNodes);
@@ -11,26 +12,45 @@ Graph<captype, tcaptype, flowtype>::Graph(int hintNbNodes, int hintNbArcs)
 }
 
 /// Destructor
-template <typename captype, typename tcaptype, typename flowtype>
-Graph<captype, tcaptype, flowtype>::~Graph()
+template <typename captype, typename tcaptype, typename flowtype, typename idtype,
+          typename statstype>
+Graph<captype, tcaptype, flowtype, idtype, statstype>::~Graph()
 {}
 
 /// Add node to the graph. First call returns 0, second 1, and so on.
-template <typename captype, typename tcaptype, typename flowtype>
-typename Graph<captype, tcaptype, flowtype>::node_id
-Graph<captype, tcaptype, flowtype>::add_node() {
+template <typename captype, typename tcaptype, typename flowtype, typename idtype,
+          typename statstype>
+typename Graph<captype, tcaptype, flowtype, idtype, statstype>::node_id
+Graph<captype, tcaptype, flowtype, idtype, statstype>::add_node() {
     node n = {-1, 0, 0, 0, 0, SOURCE, 0};
     node_id i = static_cast<node_id>(nodes.size());
     nodes.push_back(n);
     return i;
 }
 
+/// Number of nodes added so far
+template <typename captype, typename tcaptype, typename flowtype, typename idtype,
+          typename statstype>
+typename Graph<captype, tcaptype, flowtype, idtype, statstype>::node_id
+Graph<captype, tcaptype, flowtype, idtype, statstype>::get_node_num() const {
+    return static_cast<node_id>(nodes.size());
+}
+
+/// Number of arcs added so far, two per edge
+template <typename captype, typename tcaptype, typename flowtype, typename idtype,
+          typename statstype>
+typename Graph<captype, tcaptype, flowtype, idtype, statstype>::arc_id
+Graph<captype, tcaptype, flowtype, idtype, statstype>::get_arc_num() const {
+    return static_cast<arc_id>(arcs.size());
+}
+
 /// Add two edges between 'i' and 'j' with the weights 'capij' and 'capji'
-template <typename captype, typename tcaptype, typename flowtype>
-void Graph<captype, tcaptype, flowtype>::add_edge(node_id i, node_id j,
+template <typename captype, typename tcaptype, typename flowtype, typename idtype,
+          typename statstype>
+void Graph<captype, tcaptype, flowtype, idtype, statstype>::add_edge(node_id i, node_id j,
         captype capij, captype capji) {
-    assert(0 <= i && i < (int)nodes.size());
-    assert(0 <= j && j < (int)nodes.size());
+    assert(0 <= i && i < (node_id)nodes.size());
+    assert(0 <= j && j < (node_id)nodes.size());
     assert(i != j);
     assert(capij >= 0);
     assert(capji >= 0);
@@ -47,8 +67,9 @@ void Graph<captype, tcaptype, flowtype>::add_edge(node_id i, node_id j,
 }
 
 /// Add edge with infinite capacity from node 'i' to 'j'
-template <typename captype, typename tcaptype, typename flowtype>
-void Graph<captype, tcaptype, flowtype>::add_edge_infty(node_id i, node_id j) {
+template <typename captype, typename tcaptype, typename flowtype, typename idtype,
+          typename statstype>
+void Graph<captype, tcaptype, flowtype, idtype, statstype>::add_edge_infty(node_id i, node_id j) {
     add_edge(i, j, std::numeric_limits<captype>::max(), 0);
 }
 
@@ -56,11 +77,12 @@ void Graph<captype, tcaptype, flowtype>::add_edge_infty(node_id i, node_id j) {
 /// Can be called multiple times for each node.
 /// Weights can be negative.
 /// No internal memory is allocated by this call.
-template <typename captype, typename tcaptype, typename flowtype>
-void Graph<captype, tcaptype, flowtype>::add_tweights(node_id i,
+template <typename captype, typename tcaptype, typename flowtype, typename idtype,
+          typename statstype>
+void Graph<captype, tcaptype, flowtype, idtype, statstype>::add_tweights(node_id i,
         tcaptype capS,
         tcaptype capT) {
-    assert(0 <= i && i < (int)nodes.size());
+    assert(0 <= i && i < (node_id)nodes.size());
     tcaptype delta = nodes[i].cap;
     if (delta > 0) {
         capS += delta;
@@ -75,10 +97,143 @@ void Graph<captype, tcaptype, flowtype>::add_tweights(node_id i,
 /// node 'i' belongs (SOURCE or SINK).
 /// Occasionally there may be several minimum cuts. If a node can be assigned
 /// to both the source and the sink, then default def is returned.
-template <typename captype, typename tcaptype, typename flowtype>
-typename Graph<captype, tcaptype, flowtype>::termtype
-Graph<captype, tcaptype, flowtype>::what_segment(node_id i, termtype def) const {
+template <typename captype, typename tcaptype, typename flowtype, typename idtype,
+          typename statstype>
+typename Graph<captype, tcaptype, flowtype, idtype, statstype>::termtype
+Graph<captype, tcaptype, flowtype, idtype, statstype>::what_segment(node_id i, termtype def) const {
     return (nodes[i].parent ? nodes[i].term : def);
 }
 
+/// Whether capacity \a v is stored as is in a graph file: as a 32-bit value
+/// whose opposite is also one.
+template <typename T>
+static bool graph_file_fits(T v) {
+    return v >= -std::numeric_limits<int>::max() &&
+           v <= std::numeric_limits<int>::max();
+}
+
+/// Append the graph to binary file \a f, before maxflow() is called, in
+/// native byte order: tag "BKGRAPH2", numbers of nodes and arc pairs, initial
+/// flow and size in bytes of captype (64-bit), terminal capacity of each node
+/// (32-bit), then each pair of arcs as its nodes and capacities (32-bit) in
+/// order of addition.
+/// Return false if the file cannot be written or the graph does not fit.
+template <typename captype, typename tcaptype, typename flowtype, typename idtype,
+          typename statstype>
+bool Graph<captype, tcaptype, flowtype, idtype, statstype>::write(FILE *f) const {
+    const long long nbNodes = (long long)nodes.size();
+    if (nbNodes > (long long)std::numeric_limits<int>::max()) {
+        return false;
+    }
+    for (size_t i = 0; i < nodes.size(); i++) {
+        if (!graph_file_fits(nodes[i].cap)) {
+            return false;
+        }
+    }
+    for (size_t a = 0; a < arcs.size(); a++) {
+        if (!graph_file_fits(arcs[a].cap)) {
+            return false;
+        }
+    }
+    const long long header[4] = { nbNodes, (long long)arcs.size() / 2,
+                                  (long long)flow, (long long)sizeof(captype)
+                                };
+    if (fwrite("BKGRAPH2", 1, 8, f) != 8 ||
+            fwrite(header, sizeof(header[0]), 4, f) != 4) {
+        return false;
+    }
+    std::vector<int> buf;
+    buf.reserve(nodes.size());
+    for (size_t i = 0; i < nodes.size(); i++) {
+        buf.push_back((int)nodes[i].cap);
+    }
+    if (fwrite(buf.data(), sizeof(int), buf.size(), f) != buf.size()) {
+        return false;
+    }
+    buf.clear();
+    for (size_t a = 0; a + 1 < arcs.size(); a += 2) {
+        const int pair[4] = { (int)arcs[a + 1].head, (int)arcs[a].head,
+                              (int)arcs[a].cap, (int)arcs[a + 1].cap
+                            };
+        buf.insert(buf.end(), pair, pair + 4);
+        if (buf.size() >= (1 << 16) || a + 3 >= arcs.size()) {
+            if (fwrite(buf.data(), sizeof(int), buf.size(), f) != buf.size()) {
+                return false;
+            }
+            buf.clear();
+        }
+    }
+    return true;
+}
+
+/// Add the nodes and arcs of the next graph of binary file \a f written by
+/// write() to this empty graph. Arcs are added in the same order, so that
+/// maxflow() follows the same steps. Return false at end of file, if the
+/// file is not a graph or if a capacity does not fit in captype.
+template <typename captype, typename tcaptype, typename flowtype, typename idtype,
+          typename statstype>
+bool Graph<captype, tcaptype, flowtype, idtype, statstype>::read(FILE *f) {
+    char tag[8];
+    long long header[4];
+    if (fread(tag, 1, 8, f) != 8 || memcmp(tag, "BKGRAPH2", 8) != 0 ||
+            fread(header, sizeof(header[0]), 4, f) != 4 ||
+            header[0] < 0 || header[1] < 0) {
+        return false;
+    }
+    nodes.reserve(nodes.size() + (size_t)header[0]);
+    arcs.reserve(arcs.size() + 2 * (size_t)header[1] + 2);
+    std::vector<int> buf(1 << 16);
+    for (long long i = 0; i < header[0];) {
+        const size_t n = (size_t)std::min<long long>(buf.size(), header[0] - i);
+        if (fread(buf.data(), sizeof(int), n, f) != n) {
+            return false;
+        }
+        for (size_t k = 0; k < n; k++, i++) {
+            if (buf[k] < -(long long)std::numeric_limits<tcaptype>::max() ||
+                    buf[k] > (long long)std::numeric_limits<tcaptype>::max()) {
+                return false;
+            }
+            node_id id = add_node();
+            add_tweights(id, buf[k] > 0 ? (tcaptype)buf[k] : 0,
+                         buf[k] < 0 ? (tcaptype)(-buf[k]) : 0);
+        }
+    }
+    flow += (flowtype)header[2];
+    for (long long a = 0; a < header[1];) {
+        const size_t n = (size_t)std::min<long long>(buf.size() / 4,
+                         header[1] - a);
+        if (fread(buf.data(), 4 * sizeof(int), n, f) != n) {
+            return false;
+        }
+        for (size_t k = 0; k < n; k++, a++) {
+            const int *pair = &buf[4 * k];
+            if (pair[0] < 0 || pair[0] >= (int)nodes.size() ||
+                    pair[1] < 0 || pair[1] >= (int)nodes.size() ||
+                    pair[2] < 0 || pair[3] < 0 ||
+                    pair[2] > (long long)std::numeric_limits<captype>::max() ||
+                    pair[3] > (long long)std::numeric_limits<captype>::max()) {
+                return false;
+            }
+            add_edge((node_id)pair[0], (node_id)pair[1],
+                     (captype)pair[2], (captype)pair[3]);
+        }
+    }
+    return true;
+}
+
+/// Size in bytes of the capacity type of the graph recorded next in binary
+/// file \a f, which is left at the same position; 0 if there is none.
+template <typename captype, typename tcaptype, typename flowtype, typename idtype,
+          typename statstype>
+int Graph<captype, tcaptype, flowtype, idtype, statstype>::read_cap_size(FILE *f) {
+    const long pos = ftell(f);
+    char tag[8];
+    long long header[4];
+    const bool ok = fread(tag, 1, 8, f) == 8 &&
+                    memcmp(tag, "BKGRAPH2", 8) == 0 &&
+                    fread(header, sizeof(header[0]), 4, f) == 4;
+    fseek(f, pos, SEEK_SET);
+    return ok ? (int)header[3] : 0;
+}
+
 #endif
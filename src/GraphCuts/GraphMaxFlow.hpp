@@ -5,8 +5,9 @@
 /// Mark node as active.
 /// i->next points to the next active node (or itself, if last).
 /// i->next is 0 iff i should not be considered in the queue.
-template <typename captype, typename tcaptype, typename flowtype>
-void Graph<captype, tcaptype, flowtype>::set_active(node *i) {
+template <typename captype, typename tcaptype, typename flowtype, typename idtype,
+          typename statstype>
+void Graph<captype, tcaptype, flowtype, idtype, statstype>::set_active(node *i) {
     if (!i->next) { // not yet in the list
         i->next = i;
         if (activeEnd) {
@@ -23,9 +24,10 @@ void Graph<captype, tcaptype, flowtype>::set_active(node *i) {
 /// later appear to be orphan too. To avoid having to remove them explicitly
 /// we just have their parent set to null, so when the front node in the
 /// queue has a null parent, we just ignore it.
-template <typename captype, typename tcaptype, typename flowtype>
-typename Graph<captype, tcaptype, flowtype>::node *
-Graph<captype, tcaptype, flowtype>::next_active() {
+template <typename captype, typename tcaptype, typename flowtype, typename idtype,
+          typename statstype>
+typename Graph<captype, tcaptype, flowtype, idtype, statstype>::node *
+Graph<captype, tcaptype, flowtype, idtype, statstype>::next_active() {
     node *i;
     while ((i = activeBegin) != 0) {
         activeBegin = i->next;
@@ -41,15 +43,17 @@ Graph<captype, tcaptype, flowtype>::next_active() {
 }
 
 /// Set node as orphan.
-template <typename captype, typename tcaptype, typename flowtype>
-void Graph<captype, tcaptype, flowtype>::set_orphan(node *i) {
+template <typename captype, typename tcaptype, typename flowtype, typename idtype,
+          typename statstype>
+void Graph<captype, tcaptype, flowtype, idtype, statstype>::set_orphan(node *i) {
     i->parent = ORPHAN;
     orphans.push(i);
 }
 
 /// Set active nodes at distance 1 from a terminal node.
-template <typename captype, typename tcaptype, typename flowtype>
-void Graph<captype, tcaptype, flowtype>::maxflow_init() {
+template <typename captype, typename tcaptype, typename flowtype, typename idtype,
+          typename statstype>
+void Graph<captype, tcaptype, flowtype, idtype, statstype>::maxflow_init() {
     // Put two fictive arcs
     arc a = {-1, -1, -1, 0};
     arcs.push_back(a);
@@ -77,9 +81,10 @@ void Graph<captype, tcaptype, flowtype>::maxflow_init() {
 
 /// Extend the tree to neighbor nodes of tree leaf i. If doing so reaches the
 /// other tree, return the arc oriented from source tree to sink tree.
-template <typename captype, typename tcaptype, typename flowtype>
-typename Graph<captype, tcaptype, flowtype>::arc *
-Graph<captype, tcaptype, flowtype>::grow_tree(node *i) {
+template <typename captype, typename tcaptype, typename flowtype, typename idtype,
+          typename statstype>
+typename Graph<captype, tcaptype, flowtype, idtype, statstype>::arc *
+Graph<captype, tcaptype, flowtype, idtype, statstype>::grow_tree(node *i) {
     for (arc_id a = i->first; a >= 0; a = arcs[a].next)
         if (i->term == SOURCE ? arcs[a].cap : arcs[arcs[a].sister].cap) {
             node *j = &nodes[arcs[a].head];
@@ -98,9 +103,11 @@ Graph<captype, tcaptype, flowtype>::grow_tree(node *i) {
 
 /// Find max flow that we can push from source to sink through midarc.
 /// midarc must be oriented from source tree to sink tree.
-template <typename captype, typename tcaptype, typename flowtype>
-captype Graph<captype, tcaptype, flowtype>::find_bottleneck(arc *midarc) {
+template <typename captype, typename tcaptype, typename flowtype, typename idtype,
+          typename statstype>
+captype Graph<captype, tcaptype, flowtype, idtype, statstype>::find_bottleneck(arc *midarc) {
     captype cap = midarc->cap;
+    int length = 1; // arcs of the path between nodes
 
     // source tree
     node_id i = arcs[midarc->sister].head;
@@ -110,6 +117,7 @@ captype Graph<captype, tcaptype, flowtype>::find_bottleneck(arc *midarc) {
             cap = arcs[a->sister].cap;
         }
         i = a->head;
+        ++length;
     }
     if (cap > nodes[i].cap) {
         cap = nodes[i].cap;
@@ -122,17 +130,20 @@ captype Graph<captype, tcaptype, flowtype>::find_bottleneck(arc *midarc) {
             cap = a->cap;
         }
         i = a->head;
+        ++length;
     }
     if (cap > -nodes[i].cap) {
         cap = -nodes[i].cap;
     }
+    stats.path(length);
 
     return cap;
 }
 
 /// Push flow f through path from source to sink through midarc.
-template <typename captype, typename tcaptype, typename flowtype>
-void Graph<captype, tcaptype, flowtype>::push_flow(arc *midarc, captype f) {
+template <typename captype, typename tcaptype, typename flowtype, typename idtype,
+          typename statstype>
+void Graph<captype, tcaptype, flowtype, idtype, statstype>::push_flow(arc *midarc, captype f) {
     flow += f;
     arcs[midarc->sister].cap += f;
     midarc->cap -= f;
@@ -170,8 +181,9 @@ void Graph<captype, tcaptype, flowtype>::push_flow(arc *midarc, captype f) {
 }
 
 /// Push flow through path from source to sink passing through midarc.
-template <typename captype, typename tcaptype, typename flowtype>
-void Graph<captype, tcaptype, flowtype>::augment(arc *midarc) {
+template <typename captype, typename tcaptype, typename flowtype, typename idtype,
+          typename statstype>
+void Graph<captype, tcaptype, flowtype, idtype, statstype>::augment(arc *midarc) {
     // Orient arc from source tree to sink tree
     if (nodes[midarc->head].term == SOURCE) {
         midarc = &arcs[midarc->sister];
@@ -183,25 +195,30 @@ void Graph<captype, tcaptype, flowtype>::augment(arc *midarc) {
 
 /// Number of nodes of path from the root of the tree to node j.
 /// Return max integer in case there is no path.
-template <typename captype, typename tcaptype, typename flowtype>
-int Graph<captype, tcaptype, flowtype>::dist_to_root(node *j) {
+template <typename captype, typename tcaptype, typename flowtype, typename idtype,
+          typename statstype>
+int Graph<captype, tcaptype, flowtype, idtype, statstype>::dist_to_root(node *j) {
     int d = 2; // count nodes j and root
     for (arc * a; (a = j->parent) != TERMINAL; d++, j = &nodes[a->head]) {
         if (a == ORPHAN || a == 0) {
+            stats.walk(d - 2);
             return std::numeric_limits<int>::max();
         }
         if (j->ts == time) {
+            stats.walk(d - 2);
             return d + j->dist - 1;    // -1: do not count root twice
         }
     }
+    stats.walk(d - 2);
     j->ts = time;
     j->dist = 1;
     return d;
 }
 
 /// Try to reconnect orphan to its original tree.
-template <typename captype, typename tcaptype, typename flowtype>
-void Graph<captype, tcaptype, flowtype>::process_orphan(node *i) {
+template <typename captype, typename tcaptype, typename flowtype, typename idtype,
+          typename statstype>
+void Graph<captype, tcaptype, flowtype, idtype, statstype>::process_orphan(node *i) {
     int dmin = std::numeric_limits<int>::max();
 
     i->parent = 0;
@@ -242,20 +259,28 @@ void Graph<captype, tcaptype, flowtype>::process_orphan(node *i) {
 }
 
 /// Try reconnecting orphans to their tree
-template <typename captype, typename tcaptype, typename flowtype>
-void Graph<captype, tcaptype, flowtype>::adopt_orphans() {
+template <typename captype, typename tcaptype, typename flowtype, typename idtype,
+          typename statstype>
+void Graph<captype, tcaptype, flowtype, idtype, statstype>::adopt_orphans() {
     while (! orphans.empty()) {
         node *i = orphans.front();
         orphans.pop();
+        stats.orphan();
         process_orphan(i);
     }
 }
 
 /// Compute the maxflow.
-template <typename captype, typename tcaptype, typename flowtype>
-flowtype Graph<captype, tcaptype, flowtype>::maxflow() {
+template <typename captype, typename tcaptype, typename flowtype, typename idtype,
+          typename statstype>
+flowtype Graph<captype, tcaptype, flowtype, idtype, statstype>::maxflow() {
+    stats.reset();
+    stats.graph(get_node_num(), get_arc_num());
+    stats.phase(GRAPH_INIT);
     maxflow_init();
+    stats.phase(GRAPH_GROW);
     for (node *i = 0; i || (i = next_active());) {
+        stats.grow();
         arc *a = grow_tree(i);
         ++time;
         if (!a) {
@@ -263,13 +288,18 @@ flowtype Graph<captype, tcaptype, flowtype>::maxflow() {
             continue;
         }
         i->next = i; // set active: prevent adding again to active list
+        stats.phase(GRAPH_AUGMENT);
+        stats.augment();
         augment(a);
+        stats.phase(GRAPH_ADOPT);
         adopt_orphans();
+        stats.phase(GRAPH_GROW);
         i->next = 0; // remove active flag
         if (!i->parent) { // i could not be adopted
             i = 0;
         }
     }
+    stats.phase(GRAPH_NONE);
     return flow;
 }
 
@@ -1,7 +1,26 @@
 #include "Match.h"
+#include "Trace.h"
 #include <algorithm>
 #include <limits>
 #include <iostream>
+#include <vector>
+#include <thread>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#ifdef HAS_PNG
+#include <zlib.h>
+#include "io_png.h"
+#endif
+#ifdef HAS_TIFF
+#include "io_tiff.h"
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MATCH_SSE2
+#include <emmintrin.h>
+#endif
 
 /// Not a number, only for setting a variable.
 static const float NaN = sqrt(-1.0f);
@@ -11,7 +30,7 @@ inline bool is_number(float x) {
     return (x == x);
 }
 
-const int Match::OCCLUDED = std::numeric_limits<int>::max();
+const int Match::OCCLUDED = std::numeric_limits<short>::max();
 
 /// Constructor
 Match::Match(GeneralImage left, GeneralImage right, bool color) {
@@ -41,13 +60,23 @@ Match::Match(GeneralImage left, GeneralImage right, bool color) {
     }
 
     dispMin = dispMax = 0;
-
-    d_left  = (IntImage)imNew(IMAGE_INT, imSizeL);
-    d_right = (IntImage)imNew(IMAGE_INT, imSizeR);
-
-    vars0 = (IntImage)imNew(IMAGE_INT, imSizeL);
-    varsA = (IntImage)imNew(IMAGE_INT, imSizeL);
-    if (!d_left || !d_right || !vars0 || !varsA) {
+    wideValues = wideIndices = false;
+    E = 0;
+    Eterms.data = Eterms.occlusion = Eterms.smoothness = 0;
+    energyDirty = false;
+    nbAccepted = 0;
+    graphFile = 0;
+    graphsLeft = 0;
+    collectStats = false;
+    nbThreads = 0;
+    rng.seed(1);
+
+    d_left  = (ShortImage)imNew(IMAGE_SHORT, imSizeL);
+    d_right = (ShortImage)imNew(IMAGE_SHORT, imSizeR);
+
+    vars = (IntImage)imNew(IMAGE_INT, imSizeL);
+    varsRowBase = new long long[imSizeL.y];
+    if (!d_left || !d_right || !vars) {
         std::cerr << "Not enough memory!" << std::endl;
         exit(1);
     }
@@ -67,51 +96,155 @@ Match::~Match() {
     imFree(d_left);
     imFree(d_right);
 
-    imFree(vars0);
-    imFree(varsA);
+    imFree(vars);
+    delete [] varsRowBase;
+    if (graphFile) {
+        fclose(graphFile);
+    }
 }
 
-/// Save disparity map as float TIFF image
-void Match::SaveXLeft(const char *fileName) {
-    Coord outSize(imSizeL.x, originalHeightL);
-    FloatImage out = (FloatImage)imNew(IMAGE_FLOAT, outSize);
-
-    RectIterator end = rectEnd(outSize);
-    for (RectIterator p = rectBegin(outSize); p != end; ++p) {
-        IMREF(out, *p) = NaN;
+void Match::RecordGraphs(const char *fileName, int maxGraphs) {
+    if (graphFile) {
+        fclose(graphFile);
     }
-
-    end = rectEnd(imSizeL);
-    for (RectIterator p = rectBegin(imSizeL); p != end; ++p) {
-        int d = IMREF(d_left, *p);
-        IMREF(out, *p) = (d == OCCLUDED ? NaN : static_cast<float>(d));
+    graphFile = fopen(fileName, "ab");
+    graphsLeft = maxGraphs;
+    if (!graphFile) {
+        std::cerr << "Error writing file " << fileName << std::endl;
     }
+}
+
+void Match::CollectSolverStats(bool enable) {
+    collectStats = enable;
+}
+
+const std::vector<Match::ExpansionStats> &Match::GetSolverStats() const {
+    return solverStats;
+}
+
+void Match::SetThreads(int nbThreads) {
+    this->nbThreads = nbThreads;
+}
+
+void Match::SetSeed(unsigned int seed) {
+    rng.seed(seed);
+}
 
+/// Save disparity map as float TIFF image. Occluded pixels are NaN.
+/// A TIFF file is written tiled and compressed, straight from the disparity
+/// map; other formats go through a float image.
+void Match::SaveXLeft(const char *fileName) const {
+    Coord outSize(imSizeL.x, originalHeightL);
+#ifdef HAS_TIFF
+    const char *ext = strrchr(fileName, '.');
+    if (ext && (strcmp(ext, ".tif") == 0 || strcmp(ext, ".tiff") == 0)) {
+        if (io_tiff_write_f32_tiled(fileName, outSize.x, outSize.y, 256,
+                                    FillDisparityTile, (void *)this) != 0) {
+            std::cerr << "Error writing file " << fileName << std::endl;
+        }
+        return;
+    }
+#endif
+    FloatImage out = (FloatImage)imNew(IMAGE_FLOAT, outSize);
+    FillDisparityTile((void *)this, 0, 0, outSize.x, outSize.y, out->data,
+                      imGetStride(out) / sizeof(float));
     imSave(out, fileName);
     imFree(out);
 }
 
+/// Write disparities of the rectangle of \a nx x \a ny pixels at (\a x0,\a y0)
+/// in \a tile, rows being \a stride floats apart. Occluded pixels are NaN.
+void Match::FillDisparityTile(void *match, size_t x0, size_t y0,
+                              size_t nx, size_t ny,
+                              float *tile, size_t stride) {
+    const Match *m = (const Match *)match;
+    for (size_t y = 0; y < ny; y++) {
+        float *row = tile + y * stride;
+        for (size_t x = 0; x < nx; x++) {
+            int d = ((int)(y0 + y) < m->imSizeL.y) ?
+                    imRef(m->d_left, x0 + x, y0 + y) : OCCLUDED;
+            row[x] = (d == OCCLUDED) ? NaN : static_cast<float>(d);
+        }
+    }
+}
+
 /// Save scaled disparity map as 8-bit color image (gray between 64 and 255).
 /// flag: lowest disparity should appear darkest (true) or brightest (false).
 void Match::SaveScaledXLeft(const char *fileName, bool flag) {
     Coord outSize(imSizeL.x, originalHeightL);
     RGBImage im = (RGBImage)imNew(IMAGE_RGB, outSize);
+    GetOutputImage((unsigned char *)im->data, imGetStride(im), flag);
+    imSave(im, fileName);
+    imFree(im);
+}
 
-    RectIterator end = rectEnd(outSize);
-    for (RectIterator p = rectBegin(outSize); p != end; ++p) {
-        IMREF(im, *p).c[0] = 0;
-        IMREF(im, *p).c[1] = IMREF(im, *p).c[2] = 255;
+/// Save disparity map as 16-bit gray PNG, KITTI style: each pixel is \a scale
+/// times the disparity, 0 for occluded pixels. A disparity range of
+/// non-positive values (right x = left x + d, as in KZ2) is negated to fit.
+/// With \a offset, pixels are 1 more so that a null disparity is not read as
+/// occluded; this is not KITTI, readers have to subtract it. The PNG is
+/// written without interlacing and with the fast Z_RLE zlib strategy.
+void Match::SaveDisparity16(const char *fileName, int scale,
+                            bool offset) const {
+#ifdef HAS_PNG
+    const int sign = (dispMax <= 0) ? -1 : 1;
+    const int maxD = std::max(sign * dispMin, sign * dispMax);
+    if (dispMin < 0 && dispMax > 0) {
+        std::cerr << "Error: disparities of both signs do not fit in 16-bit "
+                  << "PNG" << std::endl;
+        exit(1);
+    }
+    if (scale <= 0 ||
+            (long long)maxD * scale + (offset ? 1 : 0) >
+            std::numeric_limits<unsigned short>::max()) {
+        std::cerr << "Error: disparity does not fit in 16 bits with scale "
+                  << scale << std::endl;
+        exit(1);
+    }
+    std::vector<unsigned short> out((size_t)imSizeL.x * originalHeightL, 0);
+    for (int y = 0; y < imSizeL.y; y++) {
+        unsigned short *row = &out[(size_t)y * imSizeL.x];
+        for (int x = 0; x < imSizeL.x; x++) {
+            int d = imRef(d_left, x, y);
+            if (d != OCCLUDED) {
+                row[x] = (unsigned short)(sign * d * scale + (offset ? 1 : 0));
+            }
+        }
+    }
+    io_png_write_opt opt;
+    io_png_write_opt_default(&opt);
+    opt.strategy = Z_RLE;
+    if (io_png_write_u16_gray(fileName, &out[0], imSizeL.x * sizeof(out[0]),
+                              imSizeL.x, originalHeightL, &opt) != 0) {
+        std::cerr << "Error writing file " << fileName << std::endl;
     }
+#else
+    (void)scale;
+    (void)offset;
+    std::cerr << "Unable to save file " << fileName << " as PNG since the "
+              << "program was built without PNG support" << std::endl;
+#endif
+}
 
+/// Write scaled disparity map as 8-bit color image (gray between 64 and 255)
+/// in caller-provided memory, rows being \a stride bytes apart. Occluded
+/// pixels are cyan, in RGB order or BGR order if \a bgr is set.
+/// flag: lowest disparity should appear darkest (true) or brightest (false).
+void Match::GetOutputImage(unsigned char *out, size_t stride,
+                           bool flag, bool bgr) const {
+    TraceSpan span("output image");
     const int dispSize = dispMax - dispMin + 1;
-
-    end = rectEnd(imSizeL);
-    for (RectIterator p = rectBegin(imSizeL); p != end; ++p) {
-        int d = IMREF(d_left, *p), c;
-        if (d == OCCLUDED) {
-            IMREF(im, *p).c[0] = 0;
-            IMREF(im, *p).c[1] = IMREF(im, *p).c[2] = 255;
-        } else {
+    const int r = bgr ? 2 : 0, b = bgr ? 0 : 2;
+
+    for (int y = 0; y < originalHeightL; y++) {
+        unsigned char *row = out + y * stride;
+        for (int x = 0; x < imSizeL.x; x++, row += 3) {
+            int d = (y < imSizeL.y) ? imRef(d_left, x, y) : OCCLUDED, c;
+            if (d == OCCLUDED) {
+                row[r] = 0;
+                row[1] = row[b] = 255;
+                continue;
+            }
             if (dispSize == 0) {
                 c = 255;
             } else if (flag) {
@@ -119,46 +252,27 @@ void Match::SaveScaledXLeft(const char *fileName, bool flag) {
             } else {
                 c = 255 - (255 - 64) * (d - dispMin) / dispSize;
             }
-            IMREF(im, *p).c[0] = IMREF(im, *p).c[1] = IMREF(im, *p).c[2] = c;
+            row[0] = row[1] = row[2] = (unsigned char)c;
         }
     }
-
-    imSave(im, fileName);
-    imFree(im);
 }
 
-/// Save scaled disparity map as 8-bit color image (gray between 64 and 255).
-/// flag: lowest disparity should appear darkest (true) or brightest (false).
-RGBImage  Match::GetOutputImage() {
-    Coord outSize(imSizeL.x, originalHeightL);
-    RGBImage im = (RGBImage)imNew(IMAGE_GRAY, outSize);
-
-    RectIterator end = rectEnd(outSize);
-    for (RectIterator p = rectBegin(outSize); p != end; ++p) {
-        IMREF(im, *p).c[0] = 0;
-        IMREF(im, *p).c[1] = IMREF(im, *p).c[2] = 255;
-    }
-
-    const int dispSize = dispMax - dispMin + 1;
-
-    end = rectEnd(imSizeL);
-    for (RectIterator p = rectBegin(imSizeL); p != end; ++p) {
-        int d = IMREF(d_left, *p), c;
-        if (d == OCCLUDED) {
-            IMREF(im, *p).c[0] = 0;
-            IMREF(im, *p).c[1] = IMREF(im, *p).c[2] = 255;
-        } else {
-            if (dispSize == 0) {
-                c = 255;
-            } else if (false) {
-                c = 255 - (255 - 64) * (dispMax - d) / dispSize;
-            } else {
-                c = 255 - (255 - 64) * (d - dispMin) / dispSize;
+/// Write raw disparity map in caller-provided memory, rows being \a stride
+/// bytes apart. Occluded pixels get disparity 0 and are marked by 255 in
+/// \a occlusion, if not null (0 for other pixels).
+void Match::GetDisparity(short *disparity, size_t stride,
+                         unsigned char *occlusion, size_t occlusionStride) const {
+    for (int y = 0; y < originalHeightL; y++) {
+        short *row = (short *)((char *)disparity + y * stride);
+        unsigned char *occ = occlusion ? occlusion + y * occlusionStride : 0;
+        for (int x = 0; x < imSizeL.x; x++) {
+            int d = (y < imSizeL.y) ? imRef(d_left, x, y) : OCCLUDED;
+            row[x] = (short)(d == OCCLUDED ? 0 : d);
+            if (occ) {
+                occ[x] = (d == OCCLUDED) ? 255 : 0;
             }
-            IMREF(im, *p).c[0] = IMREF(im, *p).c[1] = IMREF(im, *p).c[2] = c;
         }
     }
-    return im;
 }
 
 /// Specify disparity range
@@ -169,51 +283,122 @@ void Match::SetDispRange(int dMin, int dMax) {
         std::cerr << "Error: wrong disparity range!\n" << std::endl;
         exit(1);
     }
+    if (! (-OCCLUDED < dispMin && dispMax < OCCLUDED) ) { // Stored as short
+        std::cerr << "Error: disparity range exceeds 16 bits!\n" << std::endl;
+        exit(1);
+    }
     RectIterator end = rectEnd(imSizeL);
     for (RectIterator p = rectBegin(imSizeL); p != end; ++p) {
         IMREF(d_left, *p) = OCCLUDED;
     }
+    E = 0; // All pixels occluded
+    Eterms.data = Eterms.occlusion = Eterms.smoothness = 0;
+    energyDirty = false;
     end = rectEnd(imSizeR);
     for (RectIterator q = rectBegin(imSizeR); q != end; ++q) {
         IMREF(d_right, *q) = OCCLUDED;
     }
 }
 
+/// Run f(begin, end) on consecutive ranges covering [0,n), one per thread,
+/// \a nbThreads of them (one per core if not positive).
+template <typename F>
+static void parallel_for(int n, int nbThreads, F f) {
+    if (nbThreads <= 0) {
+        nbThreads = std::thread::hardware_concurrency();
+    }
+    nbThreads = std::min(nbThreads, n);
+    if (nbThreads <= 1) {
+        f(0, n);
+        return;
+    }
+    std::vector<std::thread> threads;
+    for (int t = 0; t < nbThreads; t++) {
+        threads.push_back(std::thread(f, (int)((long long)n * t / nbThreads),
+                                      (int)((long long)n * (t + 1) / nbThreads)));
+    }
+    for (size_t t = 0; t < threads.size(); t++) {
+        threads[t].join();
+    }
+}
+
+/// k'th smallest value among data_penalty(p, p+d) for all d.
+/// \a costs must have room for all disparities.
+int Match::kth_data_penalty(Coord p, int k, int *costs) const {
+    const int n = dispMax - dispMin + 1;
+    for (int i = 0, d = dispMin; d <= dispMax; i++, d++) {
+        costs[i] = (imLeft ?
+                    data_penalty_gray(p, p + d) :
+                    data_penalty_color(p, p + d));
+    }
+    if (k > n) {
+        k = n;
+    }
+    std::nth_element(costs, costs + k - 1, costs + n);
+    return costs[k - 1];
+}
+
 /// Heuristic for selecting parameter 'K'
 /// Details are described in Kolmogorov's thesis
-float Match::GetK() {
-    int i = dispMax - dispMin + 1;
-    int k = (i + 2) / 4; // around 0.25 times the number of disparities
+///
+/// With \a nbSamples>0, K is estimated from about that many pixels, one drawn
+/// at random in each cell of a regular grid, and the half-width of the 95%
+/// confidence interval is put in \a confidence (0 when all pixels are used).
+float Match::GetK(int nbSamples, float *confidence) {
+    TraceSpan span("GetK");
+    const int dispSize = dispMax - dispMin + 1;
+    int k = (dispSize + 2) / 4; // around 0.25 times the number of disparities
     if (k < 3) {
         k = 3;
     }
 
-    int *array = new int[k];
-    std::fill_n(array, k, 0);
-    int sum = 0, num = 0;
-
     int xmin = std::max(0, -dispMin); // 0<=x,x+dispMin
     int xmax = std::min(imSizeL.x, imSizeR.x - dispMax); // x<wl,x+dispMax<wr
-    Coord p;
-    for (p.y = 0; p.y < imSizeL.y && p.y < imSizeR.y; p.y++)
-        for (p.x = xmin; p.x < xmax; p.x++) {
-            // compute k'th smallest value among data_penalty(p, p+d) for all d
-            for (int i = 0, d = dispMin; d <= dispMax; d++) {
-                int delta = (imLeft ?
-                             data_penalty_gray(p, p + d) :
-                             data_penalty_color(p, p + d));
-                if (i < k) {
-                    array[i++] = delta;
-                } else for (i = 0; i < k; i++)
-                        if (delta < array[i]) {
-                            std::swap(delta, array[i]);
-                        }
+    int ymax = std::min(imSizeL.y, imSizeR.y);
+
+    std::vector<Coord> samples; // Empty: all pixels in [xmin,xmax)x[0,ymax)
+    if (nbSamples > 0 && xmin < xmax && ymax > 0) {
+        double area = (double)(xmax - xmin) * ymax;
+        int cell = std::max(1, (int)std::sqrt(area / nbSamples));
+        for (int y = 0; y < ymax; y += cell)
+            for (int x = xmin; x < xmax; x += cell) {
+                int w = std::min(cell, xmax - x), h = std::min(cell, ymax - y);
+                samples.push_back(Coord(x + (int)(rng() % w),
+                                        y + (int)(rng() % h)));
             }
-            sum += *std::max_element(array, array + k);
-            num++;
-        }
+    }
 
-    delete[] array;
+    // Sum and sum of squares of k'th smallest penalty, accumulated by range
+    const int n = samples.empty() ? ymax : (int)samples.size();
+    std::vector<long long> sums(n, 0);
+    std::vector<double> sums2(n, 0);
+    std::vector<int> nums(n, 0);
+    parallel_for(n, nbThreads, [&](int begin, int end) {
+        std::vector<int> costs(dispSize);
+        for (int i = begin; i < end; i++) {
+            if (samples.empty()) { // Row i
+                for (Coord p(xmin, i); p.x < xmax; p.x++) {
+                    int c = kth_data_penalty(p, k, &costs[0]);
+                    sums[i] += c;
+                    sums2[i] += (double)c * c;
+                    nums[i]++;
+                }
+            } else {
+                int c = kth_data_penalty(samples[i], k, &costs[0]);
+                sums[i] = c;
+                sums2[i] = (double)c * c;
+                nums[i] = 1;
+            }
+        }
+    });
+
+    long long sum = 0, num = 0;
+    double sum2 = 0;
+    for (int i = 0; i < n; i++) {
+        sum += sums[i];
+        sum2 += sums2[i];
+        num += nums[i];
+    }
     if (num == 0) {
         std::cerr << "GetK: Not enough samples!" << std::endl;
         exit(1);
@@ -224,7 +409,19 @@ float Match::GetK() {
     }
 
     float K = ((float)sum) / num;
-    std::cout << "Computing statistics: K(data_penalty noise) =" << K << std::endl;
+    float ci = 0;
+    if (! samples.empty() && num > 1) {
+        double var = (sum2 - (double)sum * sum / num) / (num - 1);
+        ci = (float)(1.96 * std::sqrt(std::max(var, 0.0) / num));
+    }
+    if (confidence) {
+        *confidence = ci;
+    }
+    std::cout << "Computing statistics: K(data_penalty noise) =" << K;
+    if (! samples.empty()) {
+        std::cout << " +/- " << ci << " (95%, " << num << " samples)";
+    }
+    std::cout << std::endl;
     return K;
 }
 
@@ -261,6 +458,11 @@ int Match::data_penalty_gray(Coord p, Coord q) const {
     return d;
 }
 
+/// Upper bound of data_penalty_gray and data_penalty_color
+int Match::data_penalty_max() const {
+    return (params.dataCost == Parameters::L2) ? CUTOFF * CUTOFF : CUTOFF;
+}
+
 /// Birchfield-Tomasi color distance between pixels p and q
 int Match::data_penalty_color(Coord p, Coord q) const {
     int dSum = 0;
@@ -291,102 +493,124 @@ int Match::data_penalty_color(Coord p, Coord q) const {
 /******************* Preprocessing for Birchfield-Tomasi ****/
 /************************************************************/
 
-static void SubPixel(GrayImage Im, GrayImage ImMin, GrayImage ImMax) {
-    Coord p;
-    int I, I1, I2, I3, I4, IMin, IMax;
-    int xmax = imGetXSize(ImMin), ymax = imGetYSize(ImMin);
-
-    for (p.y = 0; p.y < ymax; p.y++)
-        for (p.x = 0; p.x < xmax; p.x++) {
-            I = IMin = IMax = imRef(Im, p.x, p.y);
-            I1 = (p.x > 0 ? (imRef(Im, p.x - 1, p.y) + I) / 2 : I);
-            I2 = (p.x + 1 < xmax ? (imRef(Im, p.x + 1, p.y) + I) / 2 : I);
-            I3 = (p.y > 0 ? (imRef(Im, p.x, p.y - 1) + I) / 2 : I);
-            I4 = (p.y + 1 < ymax ? (imRef(Im, p.x, p.y + 1) + I) / 2 : I);
-
-            if (IMin > I1) {
-                IMin = I1;
-            }
-            if (IMin > I2) {
-                IMin = I2;
-            }
-            if (IMin > I3) {
-                IMin = I3;
-            }
-            if (IMin > I4) {
-                IMin = I4;
-            }
-            if (IMax < I1) {
-                IMax = I1;
-            }
-            if (IMax < I2) {
-                IMax = I2;
-            }
-            if (IMax < I3) {
-                IMax = I3;
-            }
-            if (IMax < I4) {
-                IMax = I4;
-            }
+/// Birchfield-Tomasi range of bytes [begin,end) of a row: min and max of the
+/// value and of its half-intervals towards its 4 neighbors. Neighbors in the
+/// row are \a step bytes apart, \a n is the number of bytes in the row.
+static void SubPixelBytes(const unsigned char *up, const unsigned char *row,
+                          const unsigned char *down,
+                          unsigned char *rowMin, unsigned char *rowMax,
+                          int begin, int end, int n, int step) {
+    for (int i = begin; i < end; i++) {
+        int I, I1, I2, I3, I4, IMin, IMax;
+        I = IMin = IMax = row[i];
+        I1 = (i - step >= 0 ? (row[i - step] + I) / 2 : I);
+        I2 = (i + step < n ? (row[i + step] + I) / 2 : I);
+        I3 = (up[i] + I) / 2;
+        I4 = (down[i] + I) / 2;
+
+        IMin = std::min(std::min(IMin, I1), std::min(I2, std::min(I3, I4)));
+        IMax = std::max(std::max(IMax, I1), std::max(I2, std::max(I3, I4)));
+
+        rowMin[i] = (unsigned char)IMin;
+        rowMax[i] = (unsigned char)IMax;
+    }
+}
 
-            imRef(ImMin, p.x, p.y) = IMin;
-            imRef(ImMax, p.x, p.y) = IMax;
-        }
+#ifdef MATCH_SSE2
+/// Average of bytes rounded down, like (a+b)/2
+static inline __m128i avg_floor(__m128i a, __m128i b) {
+    const __m128i one = _mm_set1_epi8(1);
+    return _mm_sub_epi8(_mm_avg_epu8(a, b),
+                        _mm_and_si128(_mm_xor_si128(a, b), one));
+}
+#endif
+
+/// SubPixelBytes on a full row of n bytes, vectorized when available.
+void SubPixelRow(const unsigned char *up, const unsigned char *row,
+                 const unsigned char *down,
+                 unsigned char *rowMin, unsigned char *rowMax,
+                 int n, int step) {
+    int i = 0;
+#ifdef MATCH_SSE2
+    // 16 bytes at a time, both horizontal neighbors inside the row
+    i = std::min(step, n);
+    for (; i + 16 + step <= n; i += 16) {
+        __m128i I  = _mm_loadu_si128((const __m128i *)(row + i));
+        __m128i I1 = avg_floor(I, _mm_loadu_si128((const __m128i *)(row + i - step)));
+        __m128i I2 = avg_floor(I, _mm_loadu_si128((const __m128i *)(row + i + step)));
+        __m128i I3 = avg_floor(I, _mm_loadu_si128((const __m128i *)(up + i)));
+        __m128i I4 = avg_floor(I, _mm_loadu_si128((const __m128i *)(down + i)));
+
+        __m128i IMin = _mm_min_epu8(_mm_min_epu8(I, I1),
+                                    _mm_min_epu8(I2, _mm_min_epu8(I3, I4)));
+        __m128i IMax = _mm_max_epu8(_mm_max_epu8(I, I1),
+                                    _mm_max_epu8(I2, _mm_max_epu8(I3, I4)));
+        _mm_storeu_si128((__m128i *)(rowMin + i), IMin);
+        _mm_storeu_si128((__m128i *)(rowMax + i), IMax);
+    }
+    SubPixelBytes(up, row, down, rowMin, rowMax, 0, std::min(step, n), n, step);
+#endif
+    SubPixelBytes(up, row, down, rowMin, rowMax, i, n, n, step);
 }
 
-static void SubPixelColor(RGBImage Im, RGBImage ImMin, RGBImage ImMax) {
-    int I, I1, I2, I3, I4, IMin, IMax;
-
-    Coord p;
-    int xmax = imGetXSize(ImMin), ymax = imGetYSize(ImMin);
-    for (p.y = 0; p.y < ymax; p.y++)
-        for (p.x = 0; p.x < xmax; p.x++)
-            for (int i = 0; i < 3; i++) { // Loop over channels
-                I = IMin = IMax = imRef(Im, p.x, p.y).c[i];
-                I1 = (p.x > 0 ? (imRef(Im, p.x - 1, p.y).c[i] + I) / 2 : I);
-                I2 = (p.x + 1 < xmax ? (imRef(Im, p.x + 1, p.y).c[i] + I) / 2 : I);
-                I3 = (p.y > 0 ? (imRef(Im, p.x, p.y - 1).c[i] + I) / 2 : I);
-                I4 = (p.y + 1 < ymax ? (imRef(Im, p.x, p.y + 1).c[i] + I) / 2 : I);
-
-                if (IMin > I1) {
-                    IMin = I1;
-                }
-                if (IMin > I2) {
-                    IMin = I2;
-                }
-                if (IMin > I3) {
-                    IMin = I3;
-                }
-                if (IMin > I4) {
-                    IMin = I4;
-                }
-                if (IMax < I1) {
-                    IMax = I1;
-                }
-                if (IMax < I2) {
-                    IMax = I2;
-                }
-                if (IMax < I3) {
-                    IMax = I3;
-                }
-                if (IMax < I4) {
-                    IMax = I4;
-                }
+/// Range of gray (\a step=1) or of each color channel (\a step=3) based on
+/// neighbors, rows being processed in parallel.
+static void SubPixel(GeneralImage Im, GeneralImage ImMin, GeneralImage ImMax,
+                     int step, int nbThreads) {
+    const int xmax = imGetXSize(ImMin), ymax = imGetYSize(ImMin);
+    parallel_for(ymax, nbThreads, [&](int begin, int end) {
+        for (int y = begin; y < end; y++) {
+            const unsigned char *row = (const unsigned char *)(Im + y)->data;
+            const unsigned char *up = (y > 0 ?
+                                       (const unsigned char *)(Im + y - 1)->data : row);
+            const unsigned char *down = (y + 1 < ymax ?
+                                         (const unsigned char *)(Im + y + 1)->data : row);
+            SubPixelRow(up, row, down,
+                        (unsigned char *)(ImMin + y)->data,
+                        (unsigned char *)(ImMax + y)->data, xmax * step, step);
+        }
+    });
+}
 
-                imRef(ImMin, p.x, p.y).c[i] = IMin;
-                imRef(ImMax, p.x, p.y).c[i] = IMax;
-            }
+/// Use Birchfield-Tomasi ranges computed by the caller, of the same type as
+/// the images (gray or color), instead of computing them. Match takes their
+/// ownership (they may be views).
+void Match::SetSubPixel(GeneralImage leftMin, GeneralImage leftMax,
+                        GeneralImage rightMin, GeneralImage rightMax) {
+    if (imLeft) {
+        imFree(imLeftMin);
+        imFree(imLeftMax);
+        imFree(imRightMin);
+        imFree(imRightMax);
+        imLeftMin = (GrayImage)leftMin;
+        imLeftMax = (GrayImage)leftMax;
+        imRightMin = (GrayImage)rightMin;
+        imRightMax = (GrayImage)rightMax;
+    } else {
+        imFree(imColorLeftMin);
+        imFree(imColorLeftMax);
+        imFree(imColorRightMin);
+        imFree(imColorRightMax);
+        imColorLeftMin = (RGBImage)leftMin;
+        imColorLeftMax = (RGBImage)leftMax;
+        imColorRightMin = (RGBImage)rightMin;
+        imColorRightMax = (RGBImage)rightMax;
+    }
+    energyDirty = true;
 }
 
 void Match::InitSubPixel() {
+    TraceSpan span("subpixel ranges");
     if (imLeft && !imLeftMin) {
         imLeftMin = (GrayImage)imNew(IMAGE_GRAY, imSizeL);
         imLeftMax = (GrayImage)imNew(IMAGE_GRAY, imSizeL);
         imRightMin = (GrayImage)imNew(IMAGE_GRAY, imSizeR);
         imRightMax = (GrayImage)imNew(IMAGE_GRAY, imSizeR);
 
-        SubPixel(imLeft, imLeftMin, imLeftMax);
-        SubPixel(imRight, imRightMin, imRightMax);
+        SubPixel((GeneralImage)imLeft, (GeneralImage)imLeftMin,
+                 (GeneralImage)imLeftMax, 1, nbThreads);
+        SubPixel((GeneralImage)imRight, (GeneralImage)imRightMin,
+                 (GeneralImage)imRightMax, 1, nbThreads);
     }
     if (imColorLeft && !imColorLeftMin) {
         imColorLeftMin = (RGBImage)imNew(IMAGE_RGB, imSizeL);
@@ -394,8 +618,10 @@ void Match::InitSubPixel() {
         imColorRightMin = (RGBImage)imNew(IMAGE_RGB, imSizeR);
         imColorRightMax = (RGBImage)imNew(IMAGE_RGB, imSizeR);
 
-        SubPixelColor(imColorLeft, imColorLeftMin, imColorLeftMax);
-        SubPixelColor(imColorRight, imColorRightMin, imColorRightMax);
+        SubPixel((GeneralImage)imColorLeft, (GeneralImage)imColorLeftMin,
+                 (GeneralImage)imColorLeftMax, 3, nbThreads);
+        SubPixel((GeneralImage)imColorRight, (GeneralImage)imColorRightMin,
+                 (GeneralImage)imColorRightMax, 3, nbThreads);
     }
 }
 
@@ -437,4 +663,5 @@ int Match::SmoothnessPenaltyColor(Coord p1, Coord p2, int disp) const {
 void Match::SetParameters(Parameters *_params) {
     params = *_params;
     InitSubPixel();
+    energyDirty = true;
 }
\ No newline at end of file
@@ -2,7 +2,10 @@
 #define MATCH_H
 
 #include "image.h"
-class Energy;
+#include "Graph.h"
+#include <cstdio>
+#include <random>
+#include <vector>
 
 /// Main class for Kolmogorov-Zabih algorithm
 class Match {
@@ -28,14 +31,64 @@ class Match {
         int maxIter; ///< Maximum number of iterations
         bool bRandomizeEveryIteration; ///< Random alpha order at each iter
 
+        /// Compare the incremental energy with the graph-cut energy after
+        /// each accepted move, which is free.
+        bool checkEnergy;
+        /// Also check it against a full recomputation every this many
+        /// accepted moves (0: never).
+        int validateEvery;
     };
-    float GetK();
+
+    /// Energy split into its terms. The occlusion term is -K per active
+    /// assignment, that is K per occlusion up to a constant.
+    struct EnergyTerms {
+        long long data;       ///< Sum of data penalties of active assignments
+        long long occlusion;  ///< -K times number of active assignments
+        long long smoothness; ///< Sum of smoothness penalties
+        long long total() const {
+            return data + occlusion + smoothness;
+        }
+    };
+    /// Statistics of an expansion move
+    struct ExpansionStats {
+        int alpha;           ///< Expanded disparity
+        bool accepted;       ///< Whether the move lowered the energy
+        long long E;         ///< Energy after the move
+        double buildSeconds; ///< Time building the graph
+        GraphStats solver;   ///< Graph size, counters and times of max-flow
+    };
+    float GetK(int nbSamples = 0, float *confidence = 0);
     void SetParameters(Parameters *params);
+    void SetSubPixel(GeneralImage leftMin, GeneralImage leftMax,
+                     GeneralImage rightMin, GeneralImage rightMax);
     void KZ2();
 
-    void SaveXLeft(const char *fileName); ///< Save disp. map as float TIFF
+    /// Append the graph of each expansion move to binary file \a fileName
+    /// (see Graph::write), at most \a maxGraphs of them if not negative.
+    void RecordGraphs(const char *fileName, int maxGraphs = -1);
+
+    /// Collect statistics of each expansion move of the next KZ2 calls, from
+    /// an instrumented max-flow. Off by default, the solver is then
+    /// uninstrumented.
+    void CollectSolverStats(bool enable = true);
+    /// Statistics of the expansion moves of the last KZ2 call, in order.
+    const std::vector<ExpansionStats> &GetSolverStats() const;
+
+    /// Threads of the row parallel steps, 0 (default) for one per core.
+    void SetThreads(int nbThreads);
+    /// Seed of the random order of expansions and of the samples of GetK,
+    /// drawn from a generator of this instance (default seed 1).
+    void SetSeed(unsigned int seed);
+
+    void SaveXLeft(const char *fileName) const; ///< Save as float TIFF
     void SaveScaledXLeft(const char *fileName, bool flag); ///< Save colormapped
-    RGBImage GetOutputImage();
+    void SaveDisparity16(const char *fileName, int scale = 256,
+                         bool offset = false) const;
+    void GetOutputImage(unsigned char *out, size_t stride, bool flag,
+                        bool bgr = false) const;
+    void GetDisparity(short *disparity, size_t stride,
+                      unsigned char *occlusion = 0,
+                      size_t occlusionStride = 0) const;
   private:
     Coord imSizeL, imSizeR; ///< image dimensions
     int originalHeightL; ///< true left image height before possible crop
@@ -51,19 +104,43 @@ class Match {
     /// If (p,q) is an active assignment
     /// q == p + Coord(IMREF(d_left,  p), p.y)
     /// p == q + Coord(IMREF(d_right, q), q.y)
-    IntImage  d_left, d_right;
+    ShortImage  d_left, d_right;
     Parameters  params; ///< Set of parameters
 
-    int E; ///< Current energy
-    IntImage vars0; ///< Variables before alpha expansion
-    IntImage varsA; ///< Variables after alpha expansion
+    long long E; ///< Current energy
+    EnergyTerms Eterms; ///< Current energy, maintained incrementally
+    bool energyDirty; ///< Eterms to recompute, after a change of the costs
+    int nbAccepted; ///< Number of accepted expansion moves
+    /// Variables before (vars0) and after (varsA) alpha expansion, packed in
+    /// one word per pixel: see var0 and varA.
+    IntImage vars;
+    long long *varsRowBase; ///< Id of first variable of each row
+
+    /// Graph layout, selected from image size and parameters before run.
+    bool wideValues;  ///< 32-bit term values (instead of 16-bit)
+    bool wideIndices; ///< 64-bit node/arc indices (instead of 32-bit)
+
+    FILE *graphFile; ///< File recording expansion graphs, if not null
+    int graphsLeft;  ///< Graphs still to record, negative for all
+
+    bool collectStats; ///< Use an instrumented max-flow
+    std::vector<ExpansionStats> solverStats; ///< Of the last KZ2 call
+
+    int nbThreads; ///< Threads of row parallel steps, 0 for one per core
+    std::minstd_rand rng; ///< Random order of expansions, samples of GetK
 
     void run();
     void InitSubPixel();
+    void GeneratePermutation(int *buf, int n);
+    static void FillDisparityTile(void *match, size_t x0, size_t y0,
+                                  size_t nx, size_t ny,
+                                  float *tile, size_t stride);
 
     // Data penalty functions
     int  data_penalty_gray (Coord l, Coord r) const;
     int  data_penalty_color(Coord l, Coord r) const;
+    int  data_penalty_max() const;
+    int  kth_data_penalty(Coord p, int k, int *costs) const;
 
     // Smoothness penalty functions
     int  SmoothnessPenaltyGray (Coord p, Coord np, int d) const;
@@ -72,15 +149,30 @@ class Match {
     // Kolmogorov-Zabih algorithm
     int  data_occlusion_penalty(Coord l, Coord r) const;
     int  smoothness_penalty(Coord p, Coord np, int d) const;
-    int  ComputeEnergy() const;
+    long long pair_energy(Coord p1, Coord p2) const;
+    EnergyTerms ComputeEnergy() const;
+    EnergyTerms ComputeLocalEnergy(const std::vector<Coord> &pixels) const;
+    void CheckEnergy();
+    long long var0(Coord p) const;
+    long long varA(Coord p) const;
+    void SelectGraphLayout();
     bool ExpansionMove(int a);
+    template <class EnergyT> bool ExpansionMove(int a);
 
     // Graph construction
-    void build_nodes        (Energy &e, Coord p, int a);
-    void build_smoothness   (Energy &e, Coord p, Coord np, int a);
-    void build_uniqueness_LR(Energy &e, Coord p);
-    void build_uniqueness_RL(Energy &e, Coord p, int a);
-    void update_disparity(const Energy &e, int a);
+    template <class EnergyT> void build_nodes        (EnergyT &e, Coord p, int a);
+    template <class EnergyT> void build_smoothness   (EnergyT &e, Coord p, Coord np, int a);
+    template <class EnergyT> void build_uniqueness_LR(EnergyT &e, Coord p);
+    template <class EnergyT> void build_uniqueness_RL(EnergyT &e, Coord p, int a);
+    template <class EnergyT> void update_disparity(const EnergyT &e, int a);
 };
 
+/// Birchfield-Tomasi range of a row of \a n bytes, gray (\a step=1) or color
+/// (\a step=3), as computed by Match: min and max of each value and of its
+/// half-intervals towards its 4 neighbors. The first and last rows pass
+/// themselves as \a up or \a down.
+void SubPixelRow(const unsigned char *up, const unsigned char *row,
+                 const unsigned char *down,
+                 unsigned char *rowMin, unsigned char *rowMax, int n, int step);
+
 #endif
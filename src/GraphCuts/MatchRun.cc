@@ -1,21 +1,51 @@
 #include "Match.h"
 #include "Energy.h"
+#include "Trace.h"
+#include <algorithm>
+#include <chrono>
 #include <iostream>
 #include <iomanip>
 #include <sstream>
 #include <string>
+#include <limits>
 #include <cassert>
 
 
 /// VAR_ALPHA means disparity alpha before expansion move (in vars0 and varsA)
-static const Energy::Var VAR_ALPHA     = ((Energy::Var) - 1);
+static const int VAR_ALPHA  = -1;
 /// VAR_ABSENT means occlusion in vars0, and p+alpha outside image in varsA
-static const Energy::Var VAR_ABSENT = ((Energy::Var) - 2);
+static const int VAR_ABSENT = -2;
 /// Indicate if the variable has a regular value
-inline bool IS_VAR(Energy::Var var) {
+inline bool IS_VAR(long long var) {
     return (var >= 0);
 }
 
+/// A word of image 'vars' is (offset << 2) | VARS_0 | VARS_A, where offset is
+/// the id of the first variable at the pixel relative to the first of the row.
+/// When both are variables, varsA is the one following vars0.
+static const int VARS_0 = 1; ///< vars0 is a variable, otherwise VAR_ABSENT
+static const int VARS_A = 2; ///< varsA is a variable, otherwise VAR_ABSENT
+static const int VARS_ALPHA = -1; ///< vars0 and varsA are VAR_ALPHA
+
+/// Variable of assignment (p,p+d) before alpha expansion
+inline long long Match::var0(Coord p) const {
+    int w = IMREF(vars, p);
+    if (w == VARS_ALPHA) {
+        return VAR_ALPHA;
+    }
+    return (w & VARS_0) ? varsRowBase[p.y] + (w >> 2) : VAR_ABSENT;
+}
+
+/// Variable of assignment (p,p+alpha) after alpha expansion
+inline long long Match::varA(Coord p) const {
+    int w = IMREF(vars, p);
+    if (w == VARS_ALPHA) {
+        return VAR_ALPHA;
+    }
+    return (w & VARS_A) ? varsRowBase[p.y] + (w >> 2) + (w & VARS_0) :
+           VAR_ABSENT;
+}
+
 /// (half of) the neighborhood system.
 /// The full neighborhood system is edges in NEIGHBORS plus reversed edges.
 const struct Coord NEIGHBORS[] = { Coord(-1, 0), Coord(0, 1) };
@@ -34,31 +64,86 @@ int Match::smoothness_penalty(Coord p1, Coord p2, int d) const {
             SmoothnessPenaltyColor(p1, p2, d));
 }
 
+/// Smoothness energy of neighbor pixels p1 and p2
+long long Match::pair_energy(Coord p1, Coord p2) const {
+    int d1 = IMREF(d_left, p1), d2 = IMREF(d_left, p2);
+    if (d1 == d2) {
+        return 0;    // smoothness satisfied
+    }
+    long long E = 0;
+    if (d1 != OCCLUDED && inRect(p2 + d1, imSizeR)) {
+        E += smoothness_penalty(p1, p2, d1);
+    }
+    if (d2 != OCCLUDED && inRect(p1 + d2, imSizeR)) {
+        E += smoothness_penalty(p1, p2, d2);
+    }
+    return E;
+}
+
 /// Compute current energy.
 /// We use this function only for sanity check.
-int Match::ComputeEnergy() const {
-    int E = 0;
+Match::EnergyTerms Match::ComputeEnergy() const {
+    EnergyTerms E = {0, 0, 0};
 
     RectIterator end = rectEnd(imSizeL);
     for (RectIterator p1 = rectBegin(imSizeL); p1 != end; ++p1) {
         int d1 = IMREF(d_left, *p1);
         if (d1 != OCCLUDED) {
-            E += data_occlusion_penalty(*p1, *p1 + d1);
+            Coord q = *p1 + d1;
+            E.data += params.denominator * (imLeft ?
+                                            data_penalty_gray(*p1, q) :
+                                            data_penalty_color(*p1, q));
+            E.occlusion -= params.K;
+        }
+
+        for (unsigned int k = 0; k < NEIGHBOR_NUM; k++) {
+            Coord p2 = *p1 + NEIGHBORS[k];
+            if (inRect(p2, imSizeL)) {
+                E.smoothness += pair_energy(*p1, p2);
+            }
+        }
+    }
+
+    return E;
+}
+
+/// Order of pixels in raster scan
+static bool raster_less(Coord p, Coord q) {
+    return (p.y < q.y) || (p.y == q.y && p.x < q.x);
+}
+
+/// Is pixel p in the list, sorted in raster order?
+static bool contains(const std::vector<Coord> &pixels, Coord p) {
+    return std::binary_search(pixels.begin(), pixels.end(), p, raster_less);
+}
+
+/// Compute the part of the energy depending on the disparity of pixels, given
+/// in raster order: their data+occlusion terms and the smoothness terms of
+/// pairs including at least one of them.
+Match::EnergyTerms
+Match::ComputeLocalEnergy(const std::vector<Coord> &pixels) const {
+    EnergyTerms E = {0, 0, 0};
+
+    std::vector<Coord>::const_iterator p1 = pixels.begin();
+    for (; p1 != pixels.end(); ++p1) {
+        int d1 = IMREF(d_left, *p1);
+        if (d1 != OCCLUDED) {
+            Coord q = *p1 + d1;
+            E.data += params.denominator * (imLeft ?
+                                            data_penalty_gray(*p1, q) :
+                                            data_penalty_color(*p1, q));
+            E.occlusion -= params.K;
         }
 
         for (unsigned int k = 0; k < NEIGHBOR_NUM; k++) {
             Coord p2 = *p1 + NEIGHBORS[k];
             if (inRect(p2, imSizeL)) {
-                int d2 = IMREF(d_left, p2);
-                if (d1 == d2) {
-                    continue;    // smoothness satisfied
-                }
-                if (d1 != OCCLUDED && inRect(p2 + d1, imSizeR)) {
-                    E += smoothness_penalty(*p1, p2, d1);
-                }
-                if (d2 != OCCLUDED && inRect(*p1 + d2, imSizeR)) {
-                    E += smoothness_penalty(*p1, p2, d2);
-                }
+                E.smoothness += pair_energy(*p1, p2);
+            }
+            // Reversed edge, unless already counted from p0
+            Coord p0(p1->x - NEIGHBORS[k].x, p1->y - NEIGHBORS[k].y);
+            if (inRect(p0, imSizeL) && !contains(pixels, p0)) {
+                E.smoothness += pair_energy(p0, *p1);
             }
         }
     }
@@ -66,37 +151,72 @@ int Match::ComputeEnergy() const {
     return E;
 }
 
+/// Sanity check of the incremental energy after an accepted move.
+///
+/// With params.checkEnergy, its total must match the energy given by the graph
+/// cut, which is free. The full recomputation is done every
+/// params.validateEvery moves. A mismatch is reported and the terms are
+/// recomputed, the run going on.
+void Match::CheckEnergy() {
+    ++nbAccepted;
+    bool ok = !params.checkEnergy || Eterms.total() == E;
+    if (ok && params.validateEvery > 0 &&
+            nbAccepted % params.validateEvery == 0) {
+        EnergyTerms full = ComputeEnergy();
+        ok = (full.data == Eterms.data && full.occlusion == Eterms.occlusion &&
+              full.smoothness == Eterms.smoothness);
+    }
+    if (!ok) {
+        std::cerr << "Error: inconsistent energy after expansion move "
+                  << nbAccepted << "!" << std::endl;
+        Eterms = ComputeEnergy();
+        E = Eterms.total();
+    }
+}
+
 /// Build nodes in graph representing data+occlusion penalty for pixel p.
 ///
 /// For assignments in A^0:       SOURCE means active, SINK means inactive.
 /// For assigments in A^{\alpha}: SOURCE means inactive, SINK means active.
-void Match::build_nodes(Energy &e, Coord p, int a) {
+template <class EnergyT>
+void Match::build_nodes(EnergyT &e, Coord p, int a) {
+    if (p.x == 0) {
+        varsRowBase[p.y] = e.var_num();
+    }
     int d = IMREF(d_left, p);
     Coord q = p + d;
     if (a == d) { // active assignment (p,p+a) in A^a will remain active
-        IMREF(vars0, p) = VAR_ALPHA;
-        IMREF(varsA, p) = VAR_ALPHA;
+        IMREF(vars, p) = VARS_ALPHA;
         e.add_constant(data_occlusion_penalty(p, q));
         return;
     }
 
-    IMREF(vars0, p) = (d != OCCLUDED) ? // (p,p+d) in A^0 can remain active
-                      e.add_variable(data_occlusion_penalty(p, q), 0) : VAR_ABSENT;
+    // At most 2 variables per pixel: the offset in the row fits in the word
+    int w = (int)(e.var_num() - varsRowBase[p.y]) << 2;
+    if (d != OCCLUDED) { // (p,p+d) in A^0 can remain active
+        e.add_variable(data_occlusion_penalty(p, q), 0);
+        w |= VARS_0;
+    }
 
     q = p + a;
-    IMREF(varsA, p) = inRect(q, imSizeR) ? // (p,p+a) in A^a can become active
-                      e.add_variable(0, data_occlusion_penalty(p, q)) : VAR_ABSENT;
+    if (inRect(q, imSizeR)) { // (p,p+a) in A^a can become active
+        e.add_variable(0, data_occlusion_penalty(p, q));
+        w |= VARS_A;
+    }
+    IMREF(vars, p) = w;
 }
 
 /// Build smoothness term for neighbor pixels p1 and p2 with disparity a.
-void Match::build_smoothness(Energy &e, Coord p1, Coord p2, int a) {
+template <class EnergyT>
+void Match::build_smoothness(EnergyT &e, Coord p1, Coord p2, int a) {
+    typedef typename EnergyT::Var Var;
     int d1 = IMREF(d_left, p1);
-    Energy::Var o1 = (Energy::Var) IMREF(vars0, p1);
-    Energy::Var a1 = (Energy::Var) IMREF(varsA, p1);
+    Var o1 = (Var) var0(p1);
+    Var a1 = (Var) varA(p1);
 
     int d2 = IMREF(d_left, p2);
-    Energy::Var o2 = (Energy::Var) IMREF(vars0, p2);
-    Energy::Var a2 = (Energy::Var) IMREF(varsA, p2);
+    Var o2 = (Var) var0(p2);
+    Var a2 = (Var) varA(p2);
 
     // disparity a
     if (a1 != VAR_ABSENT && a2 != VAR_ABSENT) {
@@ -132,9 +252,11 @@ void Match::build_smoothness(Energy &e, Coord p1, Coord p2, int a) {
 
 /// Build edges in graph enforcing uniqueness at pixel p.
 /// Prevent (p,p+d) and (p,p+a) from being both active.
-void Match::build_uniqueness_LR(Energy &e, Coord p) {
-    Energy::Var o = (Energy::Var) IMREF(vars0, p);
-    Energy::Var a = (Energy::Var) IMREF(varsA, p);
+template <class EnergyT>
+void Match::build_uniqueness_LR(EnergyT &e, Coord p) {
+    typedef typename EnergyT::Var Var;
+    Var o = (Var) var0(p);
+    Var a = (Var) varA(p);
 
     if (IS_VAR(o) && a != VAR_ABSENT) {
         e.forbid01(o, a);
@@ -143,17 +265,19 @@ void Match::build_uniqueness_LR(Energy &e, Coord p) {
 
 /// Build edges in graph enforcing uniqueness at pixel q.
 /// Prevent (q-d,q) and (q-alpha,q) from being both active.
-void Match::build_uniqueness_RL(Energy &e, Coord q, int alpha) {
+template <class EnergyT>
+void Match::build_uniqueness_RL(EnergyT &e, Coord q, int alpha) {
+    typedef typename EnergyT::Var Var;
     int minusd = IMREF(d_right, q);
     if (minusd == OCCLUDED) {
         return;
     }
-    Energy::Var o = (Energy::Var) IMREF(vars0, q + minusd);
+    Var o = (Var) var0(q + minusd);
     assert(o != VAR_ABSENT); // since d_right is inverse of d_left
     if (o != VAR_ALPHA) {
         Coord p = q - alpha;
         if (inRect(p, imSizeL)) {
-            Energy::Var a = (Energy::Var) IMREF(varsA, p);
+            Var a = (Var) varA(p);
             assert(IS_VAR(a)); // not active because of current uniqueness
             e.forbid01(o, a);
         }
@@ -162,28 +286,100 @@ void Match::build_uniqueness_RL(Energy &e, Coord q, int alpha) {
 
 /// Update the disparity map according to min cut of energy.
 /// We need to set d_right for smoothness term in next expansion move.
-void Match::update_disparity(const Energy &e, int alpha) {
+/// Energy terms are updated from the pixels whose disparity changes.
+template <class EnergyT>
+void Match::update_disparity(const EnergyT &e, int alpha) {
+    typedef typename EnergyT::Var Var;
+    std::vector<Coord> changed; // In raster order
     RectIterator end = rectEnd(imSizeL);
     for (RectIterator p = rectBegin(imSizeL); p != end; ++p) {
-        Energy::Var o = (Energy::Var) IMREF(vars0, *p);
+        Var o = (Var) var0(*p), a = (Var) varA(*p);
+        if ((IS_VAR(o) && e.get_var(o) == 1) ||
+                (IS_VAR(a) && e.get_var(a) == 1)) {
+            changed.push_back(*p);
+        }
+    }
+
+    EnergyTerms before = ComputeLocalEnergy(changed);
+    std::vector<Coord>::const_iterator p = changed.begin();
+    for (; p != changed.end(); ++p) {
+        Var o = (Var) var0(*p);
         if (IS_VAR(o) && e.get_var(o) == 1) {
             IMREF(d_left, *p) = IMREF(d_right, *p + IMREF(d_left, *p)) = OCCLUDED;
         }
     }
-    for (RectIterator p = rectBegin(imSizeL); p != end; ++p) {
-        Energy::Var a = (Energy::Var) IMREF(varsA, *p);
+    for (p = changed.begin(); p != changed.end(); ++p) {
+        Var a = (Var) varA(*p);
         if (IS_VAR(a) && e.get_var(a) == 1) { // New disparity
             IMREF(d_right, *p + alpha) = -(IMREF(d_left, *p) = alpha);
         }
     }
+    EnergyTerms after = ComputeLocalEnergy(changed);
+
+    Eterms.data += after.data - before.data;
+    Eterms.occlusion += after.occlusion - before.occlusion;
+    Eterms.smoothness += after.smoothness - before.smoothness;
+}
+
+/// Choose the narrowest graph layout that can hold the expansion graphs.
+///
+/// Term values are 16-bit unless a node can accumulate more than a quarter of
+/// the 16-bit range (keep room for the infinite arcs of uniqueness).
+/// Indices are 32-bit unless the number of arcs can exceed 2^31.
+void Match::SelectGraphLayout() {
+    long long data = (long long)params.denominator * data_penalty_max();
+    long long smooth = std::max(params.lambda1, params.lambda2);
+    // Data+occlusion term plus smoothness terms with the 4 neighbors,
+    // each contributing at most twice
+    long long maxValue = data + params.K + 2 * 4 * smooth;
+    wideValues = (maxValue > std::numeric_limits<short>::max() / 4);
+
+    long long maxArcs = 12LL * imSizeL.x * imSizeL.y;
+    wideIndices = (maxArcs > std::numeric_limits<int>::max());
+}
+
+/// Compute the minimum a-expansion configuration, using the graph layout
+/// selected by SelectGraphLayout.
+///
+/// Return whether the move is different from identity.
+bool Match::ExpansionMove(int a) {
+    if (collectStats) {
+        if (wideIndices) {
+            return wideValues ? ExpansionMove<EnergyI64Stats>(a) :
+                   ExpansionMove<EnergyS64Stats>(a);
+        }
+        return wideValues ? ExpansionMove<EnergyI32Stats>(a) :
+               ExpansionMove<EnergyS32Stats>(a);
+    }
+    if (wideIndices) {
+        return wideValues ?
+               ExpansionMove<EnergyI64>(a) : ExpansionMove<EnergyS64>(a);
+    }
+    return wideValues ?
+           ExpansionMove<EnergyI32>(a) : ExpansionMove<EnergyS32>(a);
 }
 
-/// Compute the minimum a-expansion configuration.
+/// Statistics of an instrumented max-flow
+static void CopySolverStats(const GraphStats &stats, GraphStats &out) {
+    out = stats;
+}
+/// Nothing for an uninstrumented one
+static void CopySolverStats(const NoGraphStats &, GraphStats &) {}
+
+/// Compute the minimum a-expansion configuration with energy type EnergyT.
 ///
 /// Return whether the move is different from identity.
+template <class EnergyT>
 bool Match::ExpansionMove(int a) {
+    typedef typename EnergyT::Var Index;
+    TraceSpan build("expansion build");
+    std::chrono::steady_clock::time_point start;
+    if (collectStats) {
+        start = std::chrono::steady_clock::now();
+    }
     // Factors 2 and 12 are minimal ensuring no reallocation
-    Energy e(2 * imSizeL.x * imSizeL.y, 12 * imSizeL.x * imSizeL.y);
+    Index size = (Index)imSizeL.x * imSizeL.y;
+    EnergyT e(2 * size, 12 * size);
 
     // Build graph
     RectIterator endL = rectEnd(imSizeL), endR = rectEnd(imSizeR);
@@ -206,29 +402,54 @@ bool Match::ExpansionMove(int a) {
         build_uniqueness_RL(e, *q, a);
     }
 
-    int oldE = E;
+    build.End();
+    double buildSeconds = 0;
+    if (collectStats) {
+        buildSeconds = std::chrono::duration<double>(
+                           std::chrono::steady_clock::now() - start).count();
+    }
+    if (graphFile && graphsLeft != 0) { // Record graph for solver replay
+        if (!e.write_graph(graphFile)) {
+            std::cerr << "Error writing expansion graph" << std::endl;
+            fclose(graphFile);
+            graphFile = 0;
+        } else if (graphsLeft > 0) {
+            --graphsLeft;
+        }
+    }
+
+    long long oldE = E;
+    TraceSpan maxflow("maxflow");
     E = e.minimize(); // Max-flow, give the lowest-energy expansion move
+    maxflow.End();
 
-    if (E < oldE) { // lower energy, accept the expansion move
+    const bool accepted = (E < oldE);
+    if (accepted) { // lower energy, accept the expansion move
+        TraceSpan update("update disparity");
         update_disparity(e, a);
-        assert(ComputeEnergy() == E);
-        return true;
+        CheckEnergy();
+    }
+    if (collectStats) {
+        ExpansionStats stats;
+        stats.alpha = a;
+        stats.accepted = accepted;
+        stats.E = E;
+        stats.buildSeconds = buildSeconds;
+        CopySolverStats(e.get_stats(), stats.solver);
+        solverStats.push_back(stats);
     }
-    return false;
+    return accepted;
 }
 
 /// Generate a random permutation of the array elements.
 ///
 /// Fisher-Yates shuffle: http://en.wikipedia.org/wiki/Fisher–Yates_shuffle
-static void generate_permutation(int *buf, int n) {
+void Match::GeneratePermutation(int *buf, int n) {
     for (int i = 0; i < n; i++) {
         buf[i] = i;
     }
     for (int i = 0; i < n - 1; i++) {
-        int j = i + (int) (((double)rand() / RAND_MAX) * (n - i));
-        if (j >= n) { // Very unlikely, but still possible
-            continue;
-        }
+        int j = i + (int)(rng() % (n - i));
         std::swap(buf[i], buf[j]);
     }
 }
@@ -241,7 +462,13 @@ void Match::run() {
     const int dispSize = dispMax - dispMin + 1;
     int *permutation = new int[dispSize]; // random permutation
 
-    E = ComputeEnergy();
+    SelectGraphLayout();
+    solverStats.clear();
+    if (energyDirty) { // Costs changed since the disparities were set
+        Eterms = ComputeEnergy();
+        energyDirty = false;
+    }
+    E = Eterms.total();
     std::cout << "E=" << E << std::endl;
 
     bool *done = new bool[dispSize]; // Can expansion of label decrease energy?
@@ -251,7 +478,7 @@ void Match::run() {
     int step = 0;
     for (int iter = 0; iter < params.maxIter && nDone > 0; iter++) {
         if (iter == 0 || params.bRandomizeEveryIteration) {
-            generate_permutation(permutation, dispSize);
+            GeneratePermutation(permutation, dispSize);
         }
 
         for (int index = 0; index < dispSize; index++) {
@@ -276,6 +503,29 @@ void Match::run() {
     }
 
     std::cout << (float)step / dispSize << " iterations" << std::endl;
+    if (collectStats) { // Totals over expansion moves
+        const long long n = std::max<long long>(solverStats.size(), 1);
+        GraphStats total;
+        double buildSeconds = 0;
+        for (size_t i = 0; i < solverStats.size(); i++) {
+            total.add(solverStats[i].solver);
+            buildSeconds += solverStats[i].buildSeconds;
+        }
+        std::cout << "solver: " << solverStats.size() << " graphs of "
+                  << total.nodes / n << " nodes and " << total.arcs / n
+                  << " arcs, "
+                  << total.augmentations << " augmentations (mean path "
+                  << (double)total.pathArcs / std::max(total.augmentations, 1LL)
+                  << ", longest " << total.longestPath << "), "
+                  << total.orphans << " orphans, " << total.walks
+                  << " root searches (" << total.walkSteps << " steps)"
+                  << std::endl
+                  << "solver time: build " << buildSeconds * 1e3
+                  << " ms, grow " << total.seconds[GRAPH_GROW] * 1e3
+                  << " ms, augment " << total.seconds[GRAPH_AUGMENT] * 1e3
+                  << " ms, adopt " << total.seconds[GRAPH_ADOPT] * 1e3
+                  << " ms" << std::endl;
+    }
 
     delete [] permutation;
     delete [] done;
@@ -302,5 +552,6 @@ void Match::KZ2() {
               << ", dataCost = L" <<
               ((params.dataCost == Parameters::L1) ? '1' : '2') << std::endl;
 
+    TraceSpan span("KZ2");
     run();
 }
@@ -4,110 +4,475 @@
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <map>
+#include <vector>
+#include <mutex>
+#include <algorithm>
 #include "Image.h"
+#include "io_pnm.h"
 #ifdef HAS_PNG
 #include "io_png.h"
 #endif
 #ifdef HAS_TIFF
 #include "io_tiff.h"
 #endif
+#ifdef HAS_JPEG
+#include "io_jpeg.h"
+#endif
 
 static const int ONE = 1;
 static const int SWAP_BYTES = (((char *)(&ONE))[0] == 0) ? 1 : 0;
 
-void *imNew(ImageType type, int xsize, int ysize) {
-    void *ptr;
-    GeneralImage im;
-    int data_size;
-    int y;
+/// Alignment in bytes of pixel rows
+static const size_t IM_ALIGN = 64;
 
-    if (xsize <= 0 || ysize <= 0) {
-        return NULL;
-    }
+/// Round up to multiple of IM_ALIGN
+inline size_t imAlign(size_t n) {
+    return (n + IM_ALIGN - 1) / IM_ALIGN * IM_ALIGN;
+}
 
+/// Size in bytes of a pixel of given type, 0 if unknown type
+static int imDataSize(ImageType type) {
     switch (type) {
     case IMAGE_GRAY:
-        data_size = sizeof(unsigned char);
-        break;
+        return sizeof(unsigned char);
     case IMAGE_RGB:
-        data_size = sizeof(unsigned char[3]);
-        break;
+        return sizeof(unsigned char[3]);
+    case IMAGE_SHORT:
+        return sizeof(short);
     case IMAGE_INT:
-        data_size = sizeof(int);
-        break;
+        return sizeof(int);
     case IMAGE_FLOAT:
-        data_size = sizeof(float);
-        break;
-    default:
+        return sizeof(float);
+    }
+    return 0;
+}
+
+/*
+ * BUFFER POOL
+ *
+ * Image blocks are aligned on IM_ALIGN bytes and recycled by size bucket, so
+ * that processing a sequence of frames of similar sizes does not allocate.
+ * Blocks given back beyond poolLimit bytes are freed.
+ */
+
+static std::mutex poolMutex;
+static std::map<size_t, std::vector<void *> > pool; ///< Free blocks by bucket
+static ImagePoolStats poolStats = {0, 0, 0, 0};
+static size_t poolLimit = (size_t)256 << 20; ///< Most bytes kept by the pool
+
+/// Size bucket of a block of \a size bytes: \a size rounded up to a multiple
+/// of the largest power of 2 not above \a size / 8, and of IM_ALIGN. Above
+/// 8 * IM_ALIGN, it is at most 25% more, with 4 buckets per power of 2.
+static size_t poolBucket(size_t size) {
+    size_t step = IM_ALIGN;
+    while (step * 8 <= size) {
+        step *= 2;
+    }
+    return std::max((size + step - 1) / step * step, IM_ALIGN);
+}
+
+static void *alignedAlloc(size_t size) {
+#ifdef _WIN32
+    return _aligned_malloc(size, IM_ALIGN);
+#else
+    void *ptr = 0;
+    return (posix_memalign(&ptr, IM_ALIGN, size) == 0) ? ptr : 0;
+#endif
+}
+
+static void alignedFree(void *ptr) {
+#ifdef _WIN32
+    _aligned_free(ptr);
+#else
+    free(ptr);
+#endif
+}
+
+/// Get block of \a size bytes from the pool, allocate it on a miss. \a size
+/// must be a bucket (poolBucket).
+static void *poolGet(size_t size) {
+    {
+        std::lock_guard<std::mutex> lock(poolMutex);
+        std::map<size_t, std::vector<void *> >::iterator it = pool.find(size);
+        if (it != pool.end() && !it->second.empty()) {
+            void *ptr = it->second.back();
+            it->second.pop_back();
+            poolStats.hits++;
+            poolStats.pooled_bytes -= size;
+            return ptr;
+        }
+        poolStats.misses++;
+    }
+    return alignedAlloc(size);
+}
+
+/// Give back block of \a size bytes to the pool, or free it if the pool is
+/// full
+static void poolPut(void *ptr, size_t size) {
+    {
+        std::lock_guard<std::mutex> lock(poolMutex);
+        if (poolStats.pooled_bytes + size <= poolLimit) {
+            pool[size].push_back(ptr);
+            poolStats.releases++;
+            poolStats.pooled_bytes += size;
+            return;
+        }
+    }
+    alignedFree(ptr);
+}
+
+/// Statistics of the image buffer pool
+void imPoolStats(ImagePoolStats *stats) {
+    std::lock_guard<std::mutex> lock(poolMutex);
+    *stats = poolStats;
+}
+
+/// Release memory held by the image buffer pool
+void imPoolClear() {
+    std::lock_guard<std::mutex> lock(poolMutex);
+    std::map<size_t, std::vector<void *> >::iterator it = pool.begin();
+    for (; it != pool.end(); ++it)
+        for (size_t i = 0; i < it->second.size(); i++) {
+            alignedFree(it->second[i]);
+        }
+    pool.clear();
+    poolStats.pooled_bytes = 0;
+}
+
+/// Most memory the image buffer pool keeps, in bytes (default 256 MiB).
+/// Blocks already pooled beyond it are freed.
+void imPoolSetLimit(size_t bytes) {
+    std::lock_guard<std::mutex> lock(poolMutex);
+    poolLimit = bytes;
+    std::map<size_t, std::vector<void *> >::iterator it = pool.begin();
+    for (; it != pool.end() && poolStats.pooled_bytes > poolLimit; ++it)
+        while (!it->second.empty() && poolStats.pooled_bytes > poolLimit) {
+            alignedFree(it->second.back());
+            it->second.pop_back();
+            poolStats.pooled_bytes -= it->first;
+        }
+}
+
+/// Allocate image in one block: header, row pointers, then pixel rows (if
+/// \a data is null) aligned on IM_ALIGN bytes and \a stride bytes apart.
+static GeneralImage imNewBlock(ImageType type, void *data,
+                               int xsize, int ysize, ptrdiff_t stride) {
+    GeneralImage im;
+    int y;
+
+    size_t headerSize = imAlign(sizeof(ImageHeader) + ysize * sizeof(void *));
+    size_t blockSize = poolBucket(headerSize + (data ? 0 : ysize * stride));
+    char *block = (char *)poolGet(blockSize);
+    if (!block) {
+        return NULL;
+    }
+    im = (GeneralImage) (block + sizeof(ImageHeader));
+
+    imHeader(im)->type       = type;
+    imHeader(im)->data_size  = imDataSize(type);
+    imHeader(im)->xsize      = xsize;
+    imHeader(im)->ysize      = ysize;
+    imHeader(im)->owns_data  = data ? 0 : 1;
+    imHeader(im)->stride     = stride;
+    imHeader(im)->block_size = blockSize;
+    imHeader(im)->mapping    = 0;
+
+    if (!data) {
+        data = block + headerSize;
+    }
+    for (y = 0; y < ysize; y++) {
+        (im + y)->data = ((char *)data) + y * stride;
+    }
+    return im;
+}
+
+/// New image, rows being aligned and padded to IM_ALIGN bytes
+void *imNew(ImageType type, int xsize, int ysize) {
+    int data_size = imDataSize(type);
+
+    if (xsize <= 0 || ysize <= 0 || data_size == 0) {
         return NULL;
     }
+    return imNewBlock(type, 0, xsize, ysize,
+                      (ptrdiff_t)imAlign((size_t)xsize * data_size));
+}
 
-    ptr = malloc(sizeof(ImageHeader) + ysize * sizeof(void *));
-    if (!ptr) {
+/// View of external memory as an image, without copy.
+///
+/// Rows are \a stride bytes apart (negative if stored bottom to top). The memory
+/// is not freed by imFree and must outlive the view.
+void *imWrap(ImageType type, void *data, int xsize, int ysize,
+             ptrdiff_t stride) {
+    if (!data || xsize <= 0 || ysize <= 0 || imDataSize(type) == 0) {
         return NULL;
     }
-    im = (GeneralImage) ((char *)ptr + sizeof(ImageHeader));
+    return imNewBlock(type, data, xsize, ysize, stride);
+}
+
+/// Free image (its pixels too, unless it is a view; the file of imMap)
+void imFree(void *im) {
+    if (im) {
+        io_pnm_unmap(imHeader(im)->mapping);
+        poolPut(imHeader(im), imHeader(im)->block_size);
+    }
+}
+
+/// Image type of samples of mapped file, or -1 if not handled
+static int imPnmType(const io_pnm_info &info) {
+    if (info.depth == 1) {
+        return (info.nc == 1) ? IMAGE_GRAY : IMAGE_RGB;
+    }
+    return (info.nc == 1) ? IMAGE_FLOAT : -1;
+}
 
-    imHeader(im)->type      = type;
-    imHeader(im)->data_size = data_size;
-    imHeader(im)->xsize     = xsize;
-    imHeader(im)->ysize     = ysize;
+/// Pixels of image as contiguous rows. If rows are padded, they are copied to
+/// a new buffer, put in \a tmp to be freed by the caller.
+static const void *imContiguousData(GeneralImage im, void **tmp) {
+    const size_t row = (size_t)imGetXSize(im) * imHeader(im)->data_size;
+    const int ysize = imGetYSize(im);
+    *tmp = 0;
+    if (imGetStride(im) == (ptrdiff_t)row) {
+        return im->data;
+    }
+    char *data = (char *)malloc(row * ysize);
+    if (data) {
+        for (int y = 0; y < ysize; y++) {
+            memcpy(data + y * row, (im + y)->data, row);
+        }
+    }
+    *tmp = data;
+    return data;
+}
 
-    im->data = (void *) malloc(xsize * ysize * data_size);
-    for (y = 1; y < ysize; y++) {
-        (im + y)->data = ((char *)(im->data)) + xsize * y * data_size;
+/// Copy \a n pixels of \a data_size bytes to \a out, reversing byte order
+/// if \a swap is set
+static void CopyBytes(const char *in, char *out, int n, int data_size,
+                      bool swap) {
+    if (!swap || data_size == 1) {
+        memcpy(out, in, (size_t)n * data_size);
+        return;
     }
+    for (int i = 0; i < n; i++, in += data_size, out += data_size)
+        for (int k = 0; k < data_size; k++) {
+            out[k] = in[data_size - k - 1];
+        }
+}
+
+/// Copy \a n pixels of \a data_size bytes to \a out in little endian order
+static void SwapBytes(const char *in, char *out, int n, int data_size) {
+    CopyBytes(in, out, n, data_size, SWAP_BYTES != 0);
+}
 
+/// Zero-copy view of binary PGM (IMAGE_GRAY), PPM (IMAGE_RGB) or gray PFM
+/// (IMAGE_FLOAT) file, mapped in memory until the view is freed.
+/// The view is read-only: writing a pixel (through imRef) crashes. Use imLoad
+/// for a writable copy.
+///
+/// Return NULL if the file is not of that format, or if PFM samples are not in
+/// native byte order (imLoad can read them).
+void *imMap(ImageType type, const char *filename) {
+    io_pnm_info info;
+    void *map = io_pnm_map(filename, &info);
+    if (!map) {
+        return 0;
+    }
+    bool native = (info.depth == 1 || info.little_endian != SWAP_BYTES);
+    if (imPnmType(info) != type || !native) {
+        io_pnm_unmap(map);
+        return 0;
+    }
+    GeneralImage im = (GeneralImage)imWrap(type, info.data, (int)info.nx,
+                                           (int)info.ny, info.stride);
+    if (!im) {
+        io_pnm_unmap(map);
+        return 0;
+    }
+    imHeader(im)->mapping = map;
     return im;
 }
 
-void SwapBytes(GeneralImage im) {
-    if (SWAP_BYTES) {
-        ImageType type = imHeader(im)->type;
+/// Load binary PGM, PPM or PFM file through a mapping, NULL if not possible
+static GeneralImage imLoadMapped(ImageType type, const char *filename) {
+    io_pnm_info info;
+    void *map = io_pnm_map(filename, &info);
+    if (!map) {
+        return 0;
+    }
+    GeneralImage im = 0;
+    if (imPnmType(info) == type) {
+        im = (GeneralImage)imNew(type, (int)info.nx, (int)info.ny);
+    }
+    if (im) {
+        bool swap = (info.depth > 1 && info.little_endian == SWAP_BYTES);
+        for (size_t y = 0; y < info.ny; y++) {
+            CopyBytes((const char *)info.data + (ptrdiff_t)y * info.stride,
+                      (char *)(im + y)->data, (int)info.nx,
+                      imHeader(im)->data_size, swap);
+        }
+    }
+    io_pnm_unmap(map);
+    return im;
+}
 
-        if (type == IMAGE_INT ||
-                type == IMAGE_FLOAT) {
-            char *ptr, c;
-            int i, k;
+#ifdef HAS_PNG
+/// Load PNG file, decoding rows straight into the image
+static GeneralImage imLoadPng(ImageType type, const char *filename) {
+    if (type != IMAGE_GRAY && type != IMAGE_RGB) {
+        return 0;
+    }
+    size_t xsize, ysize;
+    io_png_reader *png = io_png_open_read(filename, (type == IMAGE_GRAY) ?
+                                          IO_PNG_GRAY : IO_PNG_RGB,
+                                          &xsize, &ysize);
+    if (!png) {
+        return 0;
+    }
+    GeneralImage im = (GeneralImage)imNew(type, (int)xsize, (int)ysize);
+    if (im && io_png_read_rows(png, (unsigned char *)im->data,
+                               imGetStride(im), ysize) != 0) {
+        imFree(im);
+        im = 0;
+    }
+    io_png_close_read(png);
+    return im;
+}
+#endif
+
+#ifdef HAS_TIFF
+/// Load float TIFF file, tiled or not
+static GeneralImage imLoadTiff(ImageType type, const char *filename) {
+    size_t xsize, ysize;
+    float *data = 0;
+    if (type == IMAGE_FLOAT) {
+        data = io_tiff_read_f32_gray(filename, &xsize, &ysize);
+    }
+    if (!data) {
+        return 0;
+    }
+    FloatImage im = (FloatImage)imNew(type, (int)xsize, (int)ysize);
+    for (size_t y = 0; im && y < ysize; y++) {
+        memcpy((im + y)->data, data + y * xsize, xsize * sizeof(float));
+    }
+    free(data);
+    return (GeneralImage)im;
+}
+#endif
+
+/// Test if \a filename has JPEG extension
+static bool imIsJpeg(const char *filename) {
+    const char *ext = strrchr(filename, '.');
+    return ext && (strcmp(ext, ".jpg") == 0 || strcmp(ext, ".jpeg") == 0 ||
+                   strcmp(ext, ".JPG") == 0 || strcmp(ext, ".JPEG") == 0);
+}
 
-            int size = (imHeader(im)->xsize) * (imHeader(im)->ysize);
-            int data_size = imHeader(im)->data_size;
+#ifdef HAS_JPEG
+/// Load JPEG file at 1/\a denom of its size (\a denom = 1, 2, 4 or 8)
+static GeneralImage imLoadJpeg(ImageType type, const char *filename,
+                               int denom) {
+    if (type != IMAGE_GRAY && type != IMAGE_RGB) {
+        return 0;
+    }
+    const size_t nc = (type == IMAGE_GRAY) ? 1 : 3;
+    size_t xsize, ysize;
+    unsigned char *data = io_jpeg_read_u8(filename, nc, denom, &xsize, &ysize);
+    if (!data) {
+        return 0;
+    }
+    GeneralImage im = (GeneralImage)imNew(type, (int)xsize, (int)ysize);
+    for (size_t y = 0; im && y < ysize; y++) {
+        memcpy((im + y)->data, data + y * xsize * nc, xsize * nc);
+    }
+    free(data);
+    return im;
+}
+#endif
 
-            ptr = (char *) (im->data);
-            for (i = 0; i < size; i++) {
-                for (k = 0; k < data_size / 2; k++) {
-                    c = ptr[k];
-                    ptr[k] = ptr[data_size - k - 1];
-                    ptr[data_size - k - 1] = c;
+/// Average of \a denom x \a denom blocks of gray or RGB image (partial blocks
+/// at right and bottom borders are averaged too).
+static GeneralImage imReduce(GeneralImage im, int denom) {
+    const int nc = imHeader(im)->data_size;
+    const int xsize = imGetXSize(im), ysize = imGetYSize(im);
+    const int w = (xsize + denom - 1) / denom, h = (ysize + denom - 1) / denom;
+    GeneralImage out = (GeneralImage)imNew(imHeader(im)->type, w, h);
+    if (!out) {
+        return 0;
+    }
+    std::vector<int> sum(w * nc);
+    for (int Y = 0; Y < h; Y++) {
+        std::fill(sum.begin(), sum.end(), 0);
+        const int y0 = Y * denom, y1 = std::min(y0 + denom, ysize);
+        for (int y = y0; y < y1; y++) {
+            const unsigned char *in = (const unsigned char *)(im + y)->data;
+            for (int x = 0; x < xsize; x++)
+                for (int k = 0; k < nc; k++) {
+                    sum[(x / denom) * nc + k] += in[x * nc + k];
                 }
-                ptr += data_size;
+        }
+        unsigned char *row = (unsigned char *)(out + Y)->data;
+        for (int X = 0; X < w; X++) {
+            const int n = (std::min((X + 1) * denom, xsize) - X * denom) *
+                          (y1 - y0);
+            for (int k = 0; k < nc; k++) {
+                row[X * nc + k] = (unsigned char)
+                                  ((sum[X * nc + k] + n / 2) / n);
             }
         }
     }
+    return out;
+}
+
+/// Load gray or RGB image at 1/\a denom of its size, rounded up, for coarse
+/// levels and previews (\a denom = 1, 2, 4 or 8). A JPEG file is decoded
+/// directly at that size with reduced inverse DCTs; other files are loaded
+/// and reduced by block averaging.
+void *imLoadScaled(ImageType type, const char *filename, int denom) {
+    assert(type == IMAGE_GRAY || type == IMAGE_RGB);
+    assert(denom == 1 || denom == 2 || denom == 4 || denom == 8);
+#ifdef HAS_JPEG
+    if (imIsJpeg(filename)) {
+        return imLoadJpeg(type, filename, denom);
+    }
+#endif
+    GeneralImage im = (GeneralImage)imLoad(type, filename);
+    if (!im || denom == 1) {
+        return im;
+    }
+    GeneralImage out = imReduce(im, denom);
+    imFree(im);
+    return out;
 }
 
 /// Load image
 void *imLoad(ImageType type, const char *filename) {
-    assert(type == IMAGE_GRAY || type == IMAGE_RGB);
+    assert(type == IMAGE_GRAY || type == IMAGE_RGB || type == IMAGE_FLOAT);
     unsigned char *data = 0;
     size_t xsize, ysize;
-    int stepColor = 1; // Distance between color planes of same pixel
-    int stepPixel = 3; // Distance between consecutive pixels
+
+    if (imIsJpeg(filename)) {
+#ifdef HAS_JPEG
+        return imLoadJpeg(type, filename, 1);
+#else
+        std::cerr << "Unable to read file " << filename << " as JPEG since the "
+                  << "program was built without JPEG support" << std::endl;
+        return 0;
+#endif
+    }
 
     const char *ext = strrchr(filename, '.');
+    if (ext && (strcmp(ext, ".tif") == 0 || strcmp(ext, ".tiff") == 0)) {
+#ifdef HAS_TIFF
+        return imLoadTiff(type, filename);
+#else
+        std::cerr << "Unable to read file " << filename << " as TIFF since the "
+                  << "program was built without TIFF support" << std::endl;
+        return 0;
+#endif
+    }
+
     if (ext && (strcmp(ext, ".png") == 0)) {
 #ifdef HAS_PNG
-        if (type == IMAGE_GRAY) {
-            data = io_png_read_u8_gray(filename, &xsize, &ysize);
-        }
-        if (type == IMAGE_RGB) {
-            data = io_png_read_u8_rgb(filename, &xsize, &ysize);
-            stepColor = xsize * ysize; // Planar color format
-            stepPixel = 1;
-        }
-        if (! data) {
-            return 0;
-        }
+        return imLoadPng(type, filename);
 #else
         std::cerr << "Unable to read file " << filename << " as PNG since the "
                   << "program was built without PNG support" << std::endl;
@@ -115,7 +480,14 @@ void *imLoad(ImageType type, const char *filename) {
 #endif
     }
 
-    if (! data) { // Read PGM or PPM
+    { // Binary PGM, PPM or PFM
+        GeneralImage im = imLoadMapped(type, filename);
+        if (im || type == IMAGE_FLOAT) {
+            return im;
+        }
+    }
+
+    { // Read ASCII PGM or PPM
         std::ifstream file(filename, std::ifstream::binary);
         if (! file) {
             return 0;
@@ -179,25 +551,38 @@ void *imLoad(ImageType type, const char *filename) {
     }
 
     GeneralImage im = (GeneralImage) imNew(type, xsize, ysize);
-    const size_t size = xsize * ysize;
     if (type == IMAGE_GRAY)
-        for (size_t i = 0; i < size; i++) {
-            imRef((GrayImage)im, i, 0) = data[i];
-        }
-    if (type == IMAGE_RGB) {
-        const size_t r = 0 * stepColor, g = 1 * stepColor, b = 2 * stepColor;
-        for (size_t i = 0, j = 0; i < size; i++, j += stepPixel) {
-            imRef((RGBImage)im, i, 0).c[0] = data[j + r];
-            imRef((RGBImage)im, i, 0).c[1] = data[j + g];
-            imRef((RGBImage)im, i, 0).c[2] = data[j + b];
-        }
-    }
+        for (size_t y = 0, i = 0; y < ysize; y++)
+            for (size_t x = 0; x < xsize; x++, i++) {
+                imRef((GrayImage)im, x, y) = data[i];
+            }
+    if (type == IMAGE_RGB)
+        for (size_t y = 0, j = 0; y < ysize; y++)
+            for (size_t x = 0; x < xsize; x++, j += 3) {
+                imRef((RGBImage)im, x, y).c[0] = data[j + 0];
+                imRef((RGBImage)im, x, y).c[1] = data[j + 1];
+                imRef((RGBImage)im, x, y).c[2] = data[j + 2];
+            }
     free(data);
     return im;
 }
 
+#ifdef HAS_TIFF
+/// Width and height of tiles of saved TIFF images
+static const size_t TIFF_TILE = 256;
+
+/// Copy rectangle of FloatImage \a im to TIFF tile
+static void imFillTile(void *im, size_t x0, size_t y0, size_t nx, size_t ny,
+                       float *tile, size_t stride) {
+    for (size_t y = 0; y < ny; y++) {
+        memcpy(tile + y * stride, &imRef((FloatImage)im, x0, y0 + y),
+               nx * sizeof(float));
+    }
+}
+#endif
+
 int imSave(void *im, const char *filename) {
-    int i;
+    int x, y;
     int im_max = 0;
     ImageType type = imHeader(im)->type;
     int xsize = imHeader(im)->xsize, ysize = imHeader(im)->ysize;
@@ -207,7 +592,8 @@ int imSave(void *im, const char *filename) {
     if (ext && (strcmp(ext, ".tif") == 0 || strcmp(ext, ".tiff") == 0)) {
 #ifdef HAS_TIFF
         assert(type == IMAGE_FLOAT);
-        return io_tiff_write_f32(filename, ((FloatImage)im)->data, xsize, ysize, 1);
+        return io_tiff_write_f32_tiled(filename, xsize, ysize, TIFF_TILE,
+                                       imFillTile, im);
 #else
         std::cerr << "Unable to save file " << filename << " as TIFF since the "
                   << "program was built without TIFF support. Trying PGM..."
@@ -215,27 +601,27 @@ int imSave(void *im, const char *filename) {
 #endif
     }
 
+    if (ext && strcmp(ext, ".pfm") == 0) {
+        assert(type == IMAGE_FLOAT);
+        return io_pnm_write_pfm(filename, ((FloatImage)im)->data,
+                                xsize, ysize, imGetStride(im));
+    }
+
     if (ext && strcmp(ext, ".png") == 0) {
 #ifdef HAS_PNG
-        if (type == IMAGE_GRAY)
-            return io_png_write_u8 (filename, ((GrayImage)im)->data,
-                                    xsize, ysize, 1);
-        if (type == IMAGE_FLOAT)
-            return io_png_write_f32(filename, ((FloatImage)im)->data,
-                                    xsize, ysize, 1);
-        assert(type == IMAGE_RGB);
-        const size_t size = xsize * ysize;
-        unsigned char *data = new unsigned char[3 * size];
-        unsigned char *r = data + 0 * size;
-        unsigned char *g = data + 1 * size;
-        unsigned char *b = data + 2 * size;
-        for (size_t i = 0; i < size; i++) {
-            *r++ = imRef((RGBImage)im, i, 0).c[0];
-            *g++ = imRef((RGBImage)im, i, 0).c[1];
-            *b++ = imRef((RGBImage)im, i, 0).c[2];
+        if (type == IMAGE_GRAY || type == IMAGE_RGB) { // Rows written as is
+            return io_png_write_rows_u8(filename,
+                                        (const unsigned char *)
+                                        ((GeneralImage)im)->data,
+                                        imGetStride(im), xsize, ysize,
+                                        (type == IMAGE_GRAY) ? 1 : 3, 0);
         }
-        int res = io_png_write_u8(filename, data, xsize, ysize, 3);
-        delete [] data;
+        assert(type == IMAGE_FLOAT);
+        void *tmp;
+        const float *data = (const float *)imContiguousData((GeneralImage)im,
+                                                            &tmp);
+        int res = data ? io_png_write_f32(filename, data, xsize, ysize, 1) : -1;
+        free(tmp);
         return res;
 #else
         std::cerr << "Unable to save file " << filename << " as PNG since the "
@@ -252,26 +638,22 @@ int imSave(void *im, const char *filename) {
     switch (type) {
     case IMAGE_GRAY: {
         GrayImage g = (GrayImage)im;
-        for (i = 0; i < xsize * ysize; i++)
-            if (im_max < g->data[i]) {
-                im_max = g->data[i];
-            }
+        for (y = 0; y < ysize; y++)
+            for (x = 0; x < xsize; x++)
+                if (im_max < imRef(g, x, y)) {
+                    im_max = imRef(g, x, y);
+                }
     }
     fprintf(fp, "P5\n%d %d\n%d\n", xsize, ysize, im_max);
     break;
     case IMAGE_RGB: {
         RGBImage rgb = (RGBImage)im;
-        for (i = 0; i < xsize * ysize; i++) {
-            if (im_max < rgb->data[i].c[0]) {
-                im_max = rgb->data[i].c[0];
-            }
-            if (im_max < rgb->data[i].c[1]) {
-                im_max = rgb->data[i].c[1];
-            }
-            if (im_max < rgb->data[i].c[2]) {
-                im_max = rgb->data[i].c[2];
-            }
-        }
+        for (y = 0; y < ysize; y++)
+            for (x = 0; x < xsize; x++)
+                for (int k = 0; k < 3; k++)
+                    if (im_max < imRef(rgb, x, y).c[k]) {
+                        im_max = imRef(rgb, x, y).c[k];
+                    }
     }
     fprintf(fp, "P6\n%d %d\n%d\n", xsize, ysize, im_max);
     break;
@@ -283,12 +665,15 @@ int imSave(void *im, const char *filename) {
         return -1;
     }
 
-    SwapBytes((GeneralImage)im);
-    i = fwrite(((GeneralImage)im)->data, data_size, xsize * ysize, fp);
-    SwapBytes((GeneralImage)im);
-    if (i != xsize * ysize) {
-        fclose(fp);
-        return -1;
+    // Write row by row, in little endian order
+    std::vector<char> row((size_t)xsize * data_size);
+    for (y = 0; y < ysize; y++) {
+        SwapBytes((const char *)((((GeneralImage)im) + y)->data), &row[0],
+                  xsize, data_size);
+        if (fwrite(&row[0], data_size, xsize, fp) != (size_t)xsize) {
+            fclose(fp);
+            return -1;
+        }
     }
 
     fclose(fp);
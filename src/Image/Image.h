@@ -2,10 +2,12 @@
 #define IMAGE_H
 
 #include <stdlib.h>
+#include <stddef.h>
 
 typedef enum {
     IMAGE_GRAY,
     IMAGE_RGB,
+    IMAGE_SHORT,
     IMAGE_INT,
     IMAGE_FLOAT
 } ImageType;
@@ -14,6 +16,10 @@ typedef struct ImageHeader_st {
     ImageType type;
     int data_size;
     int xsize, ysize;
+    int owns_data; /* 0 for a view of external memory */
+    ptrdiff_t stride; /* bytes between rows */
+    size_t block_size; /* bytes of the block holding header (and pixels) */
+    void *mapping; /* mapped file of a read-only view from imMap, else NULL */
 } ImageHeader;
 
 typedef struct GeneralImage_t {
@@ -28,6 +34,9 @@ typedef struct RGBImage_t   {
         unsigned char c[3];
     } *data;
 } *RGBImage;
+typedef struct ShortImage_t {
+    short                        *data;
+} *ShortImage;
 typedef struct IntImage_t   {
     int                          *data;
 } *IntImage;
@@ -40,17 +49,28 @@ typedef struct FloatImage_t {
 #define imRef(im, x, y) ( ((im)+(y))->data[x] )
 #define imGetXSize(im) (imHeader(im)->xsize)
 #define imGetYSize(im) (imHeader(im)->ysize)
+#define imGetStride(im) (imHeader(im)->stride)
 
 void *imNew(ImageType type, int xsize, int ysize);
-inline void imFree(void *im) {
-    if (im) {
-        free(GeneralImage(im)->data);
-        free(imHeader(im));
-    }
-}
+void *imWrap(ImageType type, void *data, int xsize, int ysize,
+             ptrdiff_t stride);
+void imFree(void *im);
 void *imLoad(ImageType type, const char *filename);
+void *imMap(ImageType type, const char *filename); /* read-only view */
+void *imLoadScaled(ImageType type, const char *filename, int denom);
 int imSave(void *im, const char *filename);
 
+/* Statistics of the pool recycling image buffers */
+typedef struct ImagePoolStats_st {
+    size_t hits;         /* allocations served by the pool */
+    size_t misses;       /* allocations served by the system */
+    size_t releases;     /* buffers given back to the pool */
+    size_t pooled_bytes; /* memory currently held by the pool */
+} ImagePoolStats;
+void imPoolStats(ImagePoolStats *stats);
+void imPoolClear();
+void imPoolSetLimit(size_t bytes);
+
 /// Pixel coordinates with basic operations.
 struct Coord {
     int x, y;
@@ -0,0 +1,166 @@
+#include "Trace.h"
+
+#include <stdio.h>
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+std::atomic<bool> traceEnabled(false);
+
+namespace {
+struct TraceEvent {
+    const char *name;
+    std::chrono::steady_clock::time_point begin, end;
+};
+
+/// Spans of the thread of track \a tid
+struct TraceTrack {
+    int tid;
+    std::vector<TraceEvent> events;
+};
+
+/// Spans of a running thread. Only that thread appends to it, under its own
+/// lock, which collecting them takes too.
+struct TraceBuffer {
+    std::mutex mutex;
+    TraceTrack track;
+};
+
+/// Buffer of the calling thread, returned to the free buffers at its exit.
+struct TraceThread {
+    TraceBuffer *buffer;
+    ~TraceThread();
+};
+
+std::mutex traceMutex; ///< Lock of all below, taken before buffer locks
+std::vector<std::unique_ptr<TraceBuffer> > traceBuffers; ///< of live threads
+std::vector<std::unique_ptr<TraceBuffer> > traceFree; ///< to reuse
+std::vector<TraceTrack> traceExited; ///< spans of threads ended in the trace
+int traceThreads = 0;
+std::string traceFile;
+std::chrono::steady_clock::time_point traceOrigin;
+thread_local TraceThread traceThread = { 0 };
+
+TraceThread::~TraceThread() {
+    if (!buffer) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(traceMutex);
+    TraceTrack &track = buffer->track;
+    if (traceEnabled && !track.events.empty()) {
+        traceExited.push_back(TraceTrack());
+        traceExited.back().tid = track.tid;
+        traceExited.back().events.swap(track.events);
+    }
+    track.events.clear();
+    for (size_t i = 0; i < traceBuffers.size(); i++) {
+        if (traceBuffers[i].get() == buffer) {
+            traceFree.push_back(std::move(traceBuffers[i]));
+            traceBuffers.erase(traceBuffers.begin() + i);
+            break;
+        }
+    }
+}
+
+/// Buffer for a new thread, with a new track
+TraceBuffer *TraceAcquire() {
+    std::lock_guard<std::mutex> lock(traceMutex);
+    if (traceFree.empty()) {
+        traceBuffers.push_back(std::unique_ptr<TraceBuffer>(new TraceBuffer));
+    } else {
+        traceBuffers.push_back(std::move(traceFree.back()));
+        traceFree.pop_back();
+    }
+    TraceBuffer *buffer = traceBuffers.back().get();
+    buffer->track.tid = ++traceThreads;
+    return buffer;
+}
+}
+
+void TraceStart(const char *filename) {
+    std::lock_guard<std::mutex> lock(traceMutex);
+    traceFile = filename;
+    traceOrigin = std::chrono::steady_clock::now();
+    traceExited.clear();
+    for (size_t i = 0; i < traceBuffers.size(); i++) {
+        std::lock_guard<std::mutex> bufferLock(traceBuffers[i]->mutex);
+        traceBuffers[i]->track.events.clear();
+    }
+    traceEnabled = true;
+}
+
+void TraceRecord(const char *name,
+                 std::chrono::steady_clock::time_point begin,
+                 std::chrono::steady_clock::time_point end) {
+    if (!traceThread.buffer) {
+        traceThread.buffer = TraceAcquire();
+    }
+    TraceBuffer &b = *traceThread.buffer;
+    TraceEvent e = { name, begin, end };
+    std::lock_guard<std::mutex> lock(b.mutex);
+    b.track.events.push_back(e);
+}
+
+/// Microseconds from \a origin to \a t
+static double TraceMicroseconds(std::chrono::steady_clock::time_point origin,
+                                std::chrono::steady_clock::time_point t) {
+    return std::chrono::duration<double, std::micro>(t - origin).count();
+}
+
+bool TraceStop() {
+    if (!traceEnabled.exchange(false)) {
+        return true;
+    }
+    // Take the spans out of the buffers, then write them without lock
+    std::vector<TraceTrack> tracks;
+    std::string filename;
+    std::chrono::steady_clock::time_point origin;
+    {
+        std::lock_guard<std::mutex> lock(traceMutex);
+        tracks.swap(traceExited);
+        for (size_t i = 0; i < traceBuffers.size(); i++) {
+            TraceBuffer &b = *traceBuffers[i];
+            tracks.push_back(TraceTrack());
+            tracks.back().tid = b.track.tid;
+            std::lock_guard<std::mutex> bufferLock(b.mutex);
+            tracks.back().events.swap(b.track.events);
+        }
+        filename = traceFile;
+        origin = traceOrigin;
+    }
+    std::sort(tracks.begin(), tracks.end(),
+    [](const TraceTrack & a, const TraceTrack & b) {
+        return a.tid < b.tid;
+    });
+    FILE *f = fopen(filename.c_str(), "w");
+    if (!f) {
+        fprintf(stderr, "Error writing file %s\n", filename.c_str());
+        return false;
+    }
+    fprintf(f, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+    const char *sep = "\n";
+    for (size_t i = 0; i < tracks.size(); i++) {
+        const TraceTrack &b = tracks[i];
+        fprintf(f, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, "
+                "\"tid\": %d, \"args\": {\"name\": \"thread %d\"}}",
+                sep, b.tid, b.tid);
+        sep = ",\n";
+        for (size_t k = 0; k < b.events.size(); k++) {
+            const TraceEvent &e = b.events[k];
+            fprintf(f, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, "
+                    "\"tid\": %d, \"ts\": %.3f, \"dur\": %.3f}", e.name, b.tid,
+                    TraceMicroseconds(origin, e.begin),
+                    TraceMicroseconds(origin, e.end) -
+                    TraceMicroseconds(origin, e.begin));
+        }
+    }
+    fprintf(f, "\n]}\n");
+    const bool ok = !ferror(f);
+    if (fclose(f) != 0 || !ok) {
+        fprintf(stderr, "Error writing file %s\n", filename.c_str());
+        return false;
+    }
+    return true;
+}
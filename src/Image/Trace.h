@@ -0,0 +1,75 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <chrono>
+#include <string>
+
+/// Spans of time written as Chrome trace events (JSON for chrome://tracing
+/// or Perfetto), one track per thread. Tracing is off until TraceStart():
+/// a span then costs the test of a flag.
+
+/// Start recording spans, to be written to \a filename by TraceStop().
+void TraceStart(const char *filename);
+/// Write the spans recorded since TraceStart() and stop. Spans still open in
+/// other threads are lost. Return false if the file cannot be written.
+bool TraceStop();
+
+extern std::atomic<bool> traceEnabled;
+inline bool TraceEnabled() {
+    return traceEnabled.load(std::memory_order_relaxed);
+}
+
+/// Record span \a name (a string literal) of [\a begin, \a end).
+void TraceRecord(const char *name,
+                 std::chrono::steady_clock::time_point begin,
+                 std::chrono::steady_clock::time_point end);
+
+/// Span of the lifetime of the object, if tracing is on at its creation.
+class TraceSpan {
+public:
+    explicit TraceSpan(const char *name)
+        : name(TraceEnabled() ? name : 0) {
+        if (this->name) {
+            begin = std::chrono::steady_clock::now();
+        }
+    }
+    ~TraceSpan() {
+        End();
+    }
+    /// End the span before the end of the scope.
+    void End() {
+        if (name) {
+            TraceRecord(name, begin, std::chrono::steady_clock::now());
+            name = 0;
+        }
+    }
+private:
+    TraceSpan(const TraceSpan &);
+    TraceSpan &operator=(const TraceSpan &);
+    const char *name;
+    std::chrono::steady_clock::time_point begin;
+};
+
+/// Trace of the lifetime of the object, written to \a filename at its end.
+/// Nothing if \a filename is empty.
+class TraceSession {
+public:
+    explicit TraceSession(const std::string &filename)
+        : active(!filename.empty()) {
+        if (active) {
+            TraceStart(filename.c_str());
+        }
+    }
+    ~TraceSession() {
+        if (active) {
+            TraceStop();
+        }
+    }
+private:
+    TraceSession(const TraceSession &);
+    TraceSession &operator=(const TraceSession &);
+    bool active;
+};
+
+#endif
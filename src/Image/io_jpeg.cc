@@ -0,0 +1,276 @@
+/**
+ * @file io_jpeg.cc
+ * @brief JPEG read, with DCT-domain downscaling
+ *
+ * This is a front-end to libjpeg, with routines to read a JPEG file
+ * as an interleaved 8bit gray or RGB array, at full size or directly
+ * at 1/2, 1/4 or 1/8 of it. libjpeg then computes a reduced inverse
+ * DCT of each block, several times cheaper than a full decoding
+ * followed by a resize. A reader also decodes the rows of a file a
+ * few at a time, into caller memory.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <setjmp.h>
+
+/* option to use a local version of the libjpeg */
+#ifdef __cplusplus
+extern "C" {
+#endif
+#ifdef IO_JPEG_LOCAL_LIBJPEG
+#include "jpeglib.h"
+#else
+#include <jpeglib.h>
+#endif
+#ifdef __cplusplus
+}
+#endif
+
+/* ensure consistency */
+#include "io_jpeg.h"
+
+/**
+ * local error structure
+ */
+typedef struct _io_jpeg_err_s {
+    struct jpeg_error_mgr pub;
+    jmp_buf jmpbuf;
+} _io_jpeg_err_t;
+
+/**
+ * local error handler
+ */
+static void _io_jpeg_err_hdl(j_common_ptr cinfo) {
+    _io_jpeg_err_t *err = (_io_jpeg_err_t *) cinfo->err;
+
+    (*cinfo->err->output_message) (cinfo);
+    longjmp(err->jmpbuf, 1);
+}
+
+/*
+ * READ
+ */
+
+/**
+ * @brief read a JPEG file into an interleaved 8bit integer array
+ *
+ * @param fname JPEG file name
+ * @param nc number of channels of the array: 1 for gray, 3 for RGB
+ * @param scale_denom 1, 2, 4 or 8: the image is decoded at
+ *        1/scale_denom of its size, rounded up
+ * @param nxp, nyp pointers to variables to be filled
+ *        with the number of columns and lines of the array
+ * @return pointer to an allocated array of pixels,
+ *         or NULL if an error happens
+ */
+unsigned char *io_jpeg_read_u8(const char *fname, size_t nc, int scale_denom,
+                               size_t *nxp, size_t *nyp) {
+    struct jpeg_decompress_struct cinfo;
+    _io_jpeg_err_t err;
+    /* volatile: because of setjmp/longjmp */
+    FILE *volatile fp = NULL;
+    unsigned char *volatile data = NULL;
+    JSAMPROW row;
+
+    /* parameters check */
+    if (NULL == fname || NULL == nxp || NULL == nyp) {
+        return NULL;
+    }
+    if ((1 != nc && 3 != nc) || (1 != scale_denom && 2 != scale_denom
+                                 && 4 != scale_denom && 8 != scale_denom)) {
+        return NULL;
+    }
+    if (NULL == (fp = fopen(fname, "rb"))) {
+        return NULL;
+    }
+
+    cinfo.err = jpeg_std_error(&err.pub);
+    err.pub.error_exit = _io_jpeg_err_hdl;
+    if (setjmp(err.jmpbuf)) {
+        jpeg_destroy_decompress(&cinfo);
+        (void) fclose(fp);
+        free(data);
+        return NULL;
+    }
+    jpeg_create_decompress(&cinfo);
+    jpeg_stdio_src(&cinfo, fp);
+    (void) jpeg_read_header(&cinfo, TRUE);
+
+    /* reduced DCT and color conversion done by libjpeg */
+    cinfo.scale_num = 1;
+    cinfo.scale_denom = (unsigned int) scale_denom;
+    cinfo.out_color_space = (1 == nc) ? JCS_GRAYSCALE : JCS_RGB;
+    cinfo.dct_method = JDCT_ISLOW;
+    (void) jpeg_start_decompress(&cinfo);
+
+    *nxp = (size_t) cinfo.output_width;
+    *nyp = (size_t) cinfo.output_height;
+    if (NULL == (data = (unsigned char *) malloc(*nxp * *nyp * nc))) {
+        jpeg_destroy_decompress(&cinfo);
+        (void) fclose(fp);
+        return NULL;
+    }
+    while (cinfo.output_scanline < cinfo.output_height) {
+        row = data + (size_t) cinfo.output_scanline * *nxp * nc;
+        (void) jpeg_read_scanlines(&cinfo, &row, 1);
+    }
+
+    (void) jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+    (void) fclose(fp);
+    return data;
+}
+
+/**
+ * @brief read a JPEG file into a 8bit gray array, possibly downscaled
+ *
+ * See io_jpeg_read_u8() for details.
+ */
+unsigned char *io_jpeg_read_u8_gray(const char *fname, int scale_denom,
+                                    size_t *nxp, size_t *nyp) {
+    return io_jpeg_read_u8(fname, 1, scale_denom, nxp, nyp);
+}
+
+/*
+ * ROW READER
+ */
+
+/**
+ * state of a JPEG file read row by row
+ */
+struct io_jpeg_reader_s {
+    FILE *fp;
+    struct jpeg_decompress_struct cinfo;
+    _io_jpeg_err_t err;
+    int started;                /* jpeg_start_decompress() called */
+    size_t ny;
+    size_t row;                 /* next row to read */
+};
+
+/**
+ * @brief open a JPEG file to read its rows in order
+ *
+ * Only the header is read: the decoding starts with the first rows.
+ *
+ * @param fname JPEG file name
+ * @param nc number of channels of the rows: 1 for gray, 3 for RGB
+ * @param nxp, nyp pointers to variables to be filled
+ *        with the number of columns and lines of the image
+ * @return reader to pass to io_jpeg_read_rows() and
+ *         io_jpeg_close_read(), or NULL if an error happens
+ */
+io_jpeg_reader *io_jpeg_open_read(const char *fname, size_t nc,
+                                  size_t *nxp, size_t *nyp) {
+    /* volatile: because of setjmp/longjmp */
+    io_jpeg_reader *volatile reader;
+
+    /* parameters check */
+    if (NULL == fname || NULL == nxp || NULL == nyp
+            || (1 != nc && 3 != nc)) {
+        return NULL;
+    }
+    if (NULL == (reader = (io_jpeg_reader *) calloc(1, sizeof(*reader)))) {
+        return NULL;
+    }
+    if (NULL == (reader->fp = fopen(fname, "rb"))) {
+        free(reader);
+        return NULL;
+    }
+
+    reader->cinfo.err = jpeg_std_error(&reader->err.pub);
+    reader->err.pub.error_exit = _io_jpeg_err_hdl;
+    if (setjmp(reader->err.jmpbuf)) {
+        io_jpeg_close_read(reader);
+        return NULL;
+    }
+    jpeg_create_decompress(&reader->cinfo);
+    jpeg_stdio_src(&reader->cinfo, reader->fp);
+    (void) jpeg_read_header(&reader->cinfo, TRUE);
+
+    reader->cinfo.out_color_space = (1 == nc) ? JCS_GRAYSCALE : JCS_RGB;
+    reader->cinfo.dct_method = JDCT_ISLOW;
+    jpeg_calc_output_dimensions(&reader->cinfo);
+    reader->ny = (size_t) reader->cinfo.output_height;
+
+    *nxp = (size_t) reader->cinfo.output_width;
+    *nyp = reader->ny;
+    return reader;
+}
+
+/**
+ * @brief tell if the rows of a JPEG file are only available once the
+ * whole file is decoded
+ *
+ * libjpeg then holds the coefficients of the whole image from the
+ * first rows read.
+ *
+ * @return 1 if the image is progressive, 0 otherwise
+ */
+int io_jpeg_read_progressive(const io_jpeg_reader *reader) {
+    return reader->cinfo.progressive_mode ? 1 : 0;
+}
+
+/**
+ * @brief decode rows once the error handler is set
+ */
+static void _io_jpeg_read_rows(io_jpeg_reader *reader, unsigned char *data,
+                               ptrdiff_t stride, size_t nrows) {
+    size_t j;
+    JSAMPROW row;
+
+    if (!reader->started) {
+        (void) jpeg_start_decompress(&reader->cinfo);
+        reader->started = 1;
+    }
+    for (j = 0; j < nrows; j++) {
+        row = data + (ptrdiff_t) j * stride;
+        (void) jpeg_read_scanlines(&reader->cinfo, &row, 1);
+    }
+    reader->row += nrows;
+}
+
+/**
+ * @brief read the next rows of a JPEG file into caller memory
+ *
+ * @param reader reader returned by io_jpeg_open_read()
+ * @param data first pixel of the first row to fill
+ * @param stride bytes from one row to the next in data
+ * @param nrows number of rows to read
+ * @return 0 if everything OK, -1 if an error occured
+ */
+int io_jpeg_read_rows(io_jpeg_reader *reader, unsigned char *data,
+                      ptrdiff_t stride, size_t nrows) {
+    /* volatile: because of setjmp/longjmp */
+    io_jpeg_reader *volatile r = reader;
+    unsigned char *volatile d = data;
+    volatile ptrdiff_t s = stride;
+    volatile size_t n = nrows;
+
+    /* parameters check */
+    if (NULL == reader || NULL == data || reader->row + nrows > reader->ny) {
+        return -1;
+    }
+
+    /* handle read errors */
+    if (setjmp(reader->err.jmpbuf)) {
+        return -1;
+    }
+    _io_jpeg_read_rows(r, d, s, n);
+    return 0;
+}
+
+/**
+ * @brief close a JPEG file opened by io_jpeg_open_read()
+ *
+ * The rows left are not decoded.
+ */
+void io_jpeg_close_read(io_jpeg_reader *reader) {
+    if (NULL == reader) {
+        return;
+    }
+    /* no-op on a structure jpeg_create_decompress() did not fill */
+    jpeg_destroy_decompress(&reader->cinfo);
+    (void) fclose(reader->fp);
+    free(reader);
+}
@@ -0,0 +1,28 @@
+#ifndef _IO_JPEG_H
+#define _IO_JPEG_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+/* io_jpeg.c */
+unsigned char *io_jpeg_read_u8(const char *fname, size_t nc, int scale_denom,
+                               size_t *nxp, size_t *nyp);
+unsigned char *io_jpeg_read_u8_gray(const char *fname, int scale_denom,
+                                    size_t *nxp, size_t *nyp);
+
+typedef struct io_jpeg_reader_s io_jpeg_reader;
+io_jpeg_reader *io_jpeg_open_read(const char *fname, size_t nc,
+                                  size_t *nxp, size_t *nyp);
+int io_jpeg_read_rows(io_jpeg_reader *reader, unsigned char *data,
+                      ptrdiff_t stride, size_t nrows);
+int io_jpeg_read_progressive(const io_jpeg_reader *reader);
+void io_jpeg_close_read(io_jpeg_reader *reader);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !_IO_JPEG_H */
@@ -19,7 +19,9 @@
  *
  * This is a front-end to libpng, with routines to:
  * @li read a PNG file as a de-interlaced 8bit integer or float array
+ * @li read the rows of a PNG file into caller memory, interleaved
  * @li write a 8bit integer or float array to a PNG file
+ * @li write the rows of a PNG file as they are produced
  *
  * Multi-channel images are handled: gray, gray+alpha, rgb and
  * rgb+alpha, as well as on-the-fly color model conversion.
@@ -513,10 +515,282 @@ float *io_png_read_f32_gray(const char *fname, size_t *nxp, size_t *nyp) {
     }
 }
 
+/*
+ * STREAMING READ
+ */
+
+/* PNG file being read row by row */
+struct io_png_reader_s {
+    FILE *fp;
+    png_structp png_ptr;
+    png_infop info_ptr;
+    _io_png_err_t err;
+    size_t nx, ny;
+    size_t nc;                  /* channels of the rows decoded by libpng */
+    int layout;
+    int interlaced;
+    size_t row;                 /* next row to read */
+    png_bytep buf;              /* decoded rows, when converted to gray */
+    png_bytepp row_pointers;    /* rows of an interlaced image */
+};
+
+/**
+ * @brief RGB->gray conversion of interleaved 8bit pixels
+ *
+ * Same integer approximation as io_png_read_u8_gray().
+ *
+ * @param rgb input RGB RGB RGB pixels
+ * @param gray output gray pixels
+ * @param n number of pixels
+ */
+static void _io_png_rgb_to_gray_u8(const png_byte *rgb, unsigned char *gray,
+                                   size_t n) {
+    size_t i;
+
+    for (i = 0; i < n; i++, rgb += 3)
+        gray[i] = (unsigned char) ((6968ul * rgb[0] + 23434ul * rgb[1]
+                                    + 2366ul * rgb[2] + (1 << 14)) >> 15);
+}
+
+/**
+ * @brief release a reader returned by io_png_open_read()
+ */
+void io_png_close_read(io_png_reader *reader) {
+    if (NULL == reader) {
+        return;
+    }
+    (void) _io_png_read_abort(reader->fp, &reader->png_ptr,
+                              &reader->info_ptr);
+    free(reader->buf);
+    free(reader->row_pointers);
+    free(reader);
+}
+
+/**
+ * @brief open a PNG file to read its rows into caller memory
+ *
+ * The rows are decoded as 8bit pixels in the requested layout:
+ * 1, 2 and 4bit samples are expanded to bytes, 16bit samples are
+ * downscaled to 8bit, palette is expanded and alpha is stripped, gray
+ * is converted to RGB or color to gray if needed.
+ *
+ * @param fname PNG file name, "-" means stdin
+ * @param layout IO_PNG_GRAY, IO_PNG_RGB or IO_PNG_BGR
+ * @param nxp, nyp pointers to variables to be filled
+ *        with the number of columns and lines of the image
+ * @return the reader, to release with io_png_close_read(),
+ *         or NULL if an error happens
+ */
+io_png_reader *io_png_open_read(const char *fname, int layout,
+                                size_t *nxp, size_t *nyp) {
+    png_byte png_sig[PNG_SIG_LEN];
+    /* volatile: because of setjmp/longjmp */
+    io_png_reader *volatile reader;
+
+    /* parameters check */
+    if (NULL == fname || NULL == nxp || NULL == nyp) {
+        return NULL;
+    }
+    if (IO_PNG_GRAY != layout && IO_PNG_RGB != layout
+            && IO_PNG_BGR != layout) {
+        return NULL;
+    }
+    if (NULL == (reader = (io_png_reader *) calloc(1, sizeof(*reader)))) {
+        return NULL;
+    }
+    reader->layout = layout;
+
+    /* open the PNG input file */
+    if (0 == strcmp(fname, "-")) {
+        reader->fp = stdin;
+    } else if (NULL == (reader->fp = fopen(fname, "rb"))) {
+        free(reader);
+        return NULL;
+    }
+
+    /* read in some of the signature bytes and check this signature */
+    if ((PNG_SIG_LEN != fread(png_sig, 1, PNG_SIG_LEN, reader->fp))
+            || 0 != png_sig_cmp(png_sig, (png_size_t) 0, PNG_SIG_LEN)
+            || NULL == (reader->png_ptr =
+                            png_create_read_struct(PNG_LIBPNG_VER_STRING,
+                                    &reader->err, &_io_png_err_hdl, NULL))
+            || NULL == (reader->info_ptr =
+                            png_create_info_struct(reader->png_ptr))) {
+        io_png_close_read(reader);
+        return NULL;
+    }
+
+    /* handle read errors */
+    if (setjmp(reader->err.jmpbuf)) {
+        io_png_close_read(reader);
+        return NULL;
+    }
+
+    png_init_io(reader->png_ptr, reader->fp);
+    png_set_sig_bytes(reader->png_ptr, PNG_SIG_LEN);
+    png_read_info(reader->png_ptr, reader->info_ptr);
+
+    /* same transforms as io_png_read_raw(), then the layout */
+    png_set_strip_16(reader->png_ptr);
+    png_set_packing(reader->png_ptr);
+    png_set_palette_to_rgb(reader->png_ptr);
+    png_set_strip_alpha(reader->png_ptr);
+    if (IO_PNG_GRAY != layout) {
+        png_set_gray_to_rgb(reader->png_ptr);
+    }
+    if (IO_PNG_BGR == layout) {
+        png_set_bgr(reader->png_ptr);
+    }
+    reader->interlaced = (1 < png_set_interlace_handling(reader->png_ptr));
+    png_read_update_info(reader->png_ptr, reader->info_ptr);
+
+    reader->nx = (size_t) png_get_image_width(reader->png_ptr,
+                 reader->info_ptr);
+    reader->ny = (size_t) png_get_image_height(reader->png_ptr,
+                 reader->info_ptr);
+    reader->nc = (size_t) png_get_channels(reader->png_ptr, reader->info_ptr);
+
+    /* color rows are decoded in a buffer before conversion to gray */
+    if (IO_PNG_GRAY == layout && 1 != reader->nc) {
+        size_t nrows = reader->interlaced ? reader->ny : 1;
+        if (NULL == (reader->buf = (png_bytep)
+                                   malloc(reader->nx * reader->nc * nrows))) {
+            io_png_close_read(reader);
+            return NULL;
+        }
+    }
+
+    *nxp = reader->nx;
+    *nyp = reader->ny;
+    return reader;
+}
+
+/**
+ * @brief tell if the rows of a PNG file can only be read all at once
+ *
+ * @return 1 if the image is interlaced, 0 otherwise
+ */
+int io_png_read_interlaced(const io_png_reader *reader) {
+    return reader->interlaced;
+}
+
+/**
+ * @brief decode rows once the error handler is set
+ *
+ * @return 0 if everything OK, -1 if an error occured
+ */
+static int _io_png_read_rows(io_png_reader *reader, unsigned char *data,
+                             ptrdiff_t stride, size_t nrows) {
+    size_t j;
+    int convert = (NULL != reader->buf);
+
+    if (!reader->interlaced) {
+        for (j = 0; j < nrows; j++) {
+            unsigned char *row = data + (ptrdiff_t) j * stride;
+            png_read_row(reader->png_ptr, convert ? reader->buf : row, NULL);
+            if (convert) {
+                _io_png_rgb_to_gray_u8(reader->buf, row, reader->nx);
+            }
+        }
+        reader->row += nrows;
+        return 0;
+    }
+
+    /* all passes of the interlaced image over the whole buffer */
+    if (NULL == (reader->row_pointers = (png_bytepp)
+                                        malloc(nrows * sizeof(png_bytep)))) {
+        return -1;
+    }
+    for (j = 0; j < nrows; j++)
+        reader->row_pointers[j] = convert
+                                  ? reader->buf + j * reader->nx * reader->nc
+                                  : data + (ptrdiff_t) j * stride;
+    png_read_image(reader->png_ptr, reader->row_pointers);
+    if (convert)
+        for (j = 0; j < nrows; j++)
+            _io_png_rgb_to_gray_u8(reader->row_pointers[j],
+                                   data + (ptrdiff_t) j * stride, reader->nx);
+    reader->row = nrows;
+    return 0;
+}
+
+/**
+ * @brief read the next rows of a PNG file into caller memory
+ *
+ * Interlaced images can only be read with all their rows at once.
+ *
+ * @param reader reader returned by io_png_open_read()
+ * @param data first pixel of the first row to fill
+ * @param stride bytes from one row to the next in data
+ * @param nrows number of rows to read
+ * @return 0 if everything OK, -1 if an error occured
+ */
+int io_png_read_rows(io_png_reader *reader, unsigned char *data,
+                     ptrdiff_t stride, size_t nrows) {
+    /* volatile: because of setjmp/longjmp */
+    io_png_reader *volatile r = reader;
+    unsigned char *volatile d = data;
+    volatile ptrdiff_t s = stride;
+    volatile size_t n = nrows;
+
+    /* parameters check */
+    if (NULL == reader || NULL == data || reader->row + nrows > reader->ny) {
+        return -1;
+    }
+    if (reader->interlaced && (0 != reader->row || reader->ny != nrows)) {
+        return -1;
+    }
+
+    /* handle read errors */
+    if (setjmp(reader->err.jmpbuf)) {
+        return -1;
+    }
+    return _io_png_read_rows(r, d, s, n);
+}
+
 /*
  * WRITE
  */
 
+/**
+ * @brief fill PNG write options with the defaults
+ *
+ * No interlacing, default zlib level and strategy, adaptive row
+ * filter.
+ */
+void io_png_write_opt_default(io_png_write_opt *opt) {
+    opt->interlace = 0;
+    opt->level = -1;
+    opt->strategy = -1;
+    opt->filter = -1;
+}
+
+/**
+ * @brief internal function used to apply the write options
+ *
+ * @return the interlace type to write in the image header
+ */
+static int _io_png_set_opt(png_structp png_ptr, const io_png_write_opt *opt) {
+    io_png_write_opt def;
+
+    if (NULL == opt) {
+        io_png_write_opt_default(&def);
+        opt = &def;
+    }
+    if (0 <= opt->level) {
+        png_set_compression_level(png_ptr, opt->level);
+    }
+    if (0 <= opt->strategy) {
+        png_set_compression_strategy(png_ptr, opt->strategy);
+    }
+    if (IO_PNG_FILTER_NONE <= opt->filter
+            && IO_PNG_FILTER_PAETH >= opt->filter) {
+        png_set_filter(png_ptr, PNG_FILTER_TYPE_BASE,
+                       PNG_FILTER_NONE << opt->filter);
+    }
+    return opt->interlace ? PNG_INTERLACE_ADAM7 : PNG_INTERLACE_NONE;
+}
+
 /**
  * @brief internal function used to cleanup the memory when
  * png_write_raw() fails
@@ -547,8 +821,8 @@ static int _io_png_write_abort(FILE *fp,
 /**
  * @brief internal function used to write a byte array as a PNG file
  *
- * The PNG file is written as a 8bit image file, interlaced,
- * truecolor. Depending on the number of channels, the color model is
+ * The PNG file is written as a 8bit image file, with default
+ * options (see io_png_write_opt_default()), truecolor. Depending on the number of channels, the color model is
  * gray, gray+alpha, rgb, rgb+alpha.
  *
  * @todo handle 16bit
@@ -653,7 +927,7 @@ static int io_png_write_raw(const char *fname, const void *data,
         (void) fclose(fp);
         return -1;
     }
-    interlace = PNG_INTERLACE_ADAM7;
+    interlace = _io_png_set_opt(png_ptr, NULL);
     compression = PNG_COMPRESSION_TYPE_BASE;
     filter = PNG_FILTER_TYPE_BASE;
 
@@ -720,6 +994,285 @@ static int io_png_write_raw(const char *fname, const void *data,
     return 0;
 }
 
+/**
+ * @brief internal function used to get the PNG color type of
+ * interleaved pixels
+ *
+ * @param nc number of channels: gray, gray+alpha, rgb or rgb+alpha
+ * @return the color type, -1 if nc is not supported
+ */
+static int _io_png_color_type(size_t nc) {
+    switch (nc) {
+    case 1:
+        return PNG_COLOR_TYPE_GRAY;
+    case 2:
+        return PNG_COLOR_TYPE_GRAY_ALPHA;
+    case 3:
+        return PNG_COLOR_TYPE_RGB;
+    case 4:
+        return PNG_COLOR_TYPE_RGB_ALPHA;
+    default:
+        return -1;
+    }
+}
+
+/**
+ * @brief internal function used to write interleaved rows as a PNG file
+ *
+ * The rows are written straight from the caller memory. With 16bit
+ * samples, the rows are in host byte order.
+ *
+ * @param fname PNG file name, "-" means stdout
+ * @param data first sample of the first row
+ * @param stride bytes from one row to the next
+ * @param nx, ny, nc number of columns, lines and channels
+ * @param bit_depth 8 or 16
+ * @param opt write options, NULL for defaults
+ * @return 0 if everything OK, -1 if an error occured
+ */
+static int _io_png_write_rows(const char *fname, const void *data,
+                              ptrdiff_t stride,
+                              size_t nx, size_t ny, size_t nc,
+                              int bit_depth, const io_png_write_opt *opt) {
+    static const int one = 1;
+    png_structp png_ptr;
+    png_infop info_ptr;
+    /* volatile: because of setjmp/longjmp */
+    FILE *volatile fp;
+    int color_type, interlace, passes, pass;
+    size_t j;
+    /* error structure */
+    _io_png_err_t err;
+
+    /* parameters check */
+    if (NULL == fname || NULL == data || 0 == nx || 0 == ny
+            || 0 > (color_type = _io_png_color_type(nc))) {
+        return -1;
+    }
+
+    /* open the PNG output file */
+    if (0 == strcmp(fname, "-")) {
+        fp = stdout;
+    } else if (NULL == (fp = fopen(fname, "wb"))) {
+        return -1;
+    }
+
+    if (NULL == (png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING,
+                           &err, &_io_png_err_hdl,
+                           NULL))) {
+        return _io_png_write_abort(fp, NULL, NULL, NULL, NULL);
+    }
+    if (NULL == (info_ptr = png_create_info_struct(png_ptr))) {
+        return _io_png_write_abort(fp, NULL, NULL, &png_ptr, NULL);
+    }
+
+    /* handle write errors */
+    if (0 != setjmp(err.jmpbuf))
+        return _io_png_write_abort(fp, NULL, NULL, &png_ptr, &info_ptr);
+
+    png_init_io(png_ptr, fp);
+    interlace = _io_png_set_opt(png_ptr, opt);
+    png_set_IHDR(png_ptr, info_ptr, (png_uint_32) nx, (png_uint_32) ny,
+                 bit_depth, color_type, interlace,
+                 PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE);
+    png_write_info(png_ptr, info_ptr);
+
+    /* PNG samples are big endian */
+    if (16 == bit_depth && 1 == *(const char *) &one) {
+        png_set_swap(png_ptr);
+    }
+
+    passes = png_set_interlace_handling(png_ptr);
+    for (pass = 0; pass < passes; pass++)
+        for (j = 0; j < ny; j++)
+            png_write_row(png_ptr, (png_const_bytep) data
+                          + (ptrdiff_t) j * stride);
+    png_write_end(png_ptr, info_ptr);
+
+    /* clean up and free any memory allocated, close the file */
+    (void) _io_png_write_abort(fp, NULL, NULL, &png_ptr, &info_ptr);
+
+    return 0;
+}
+
+/**
+ * @brief write interleaved 8bit rows (gray, gray+alpha, rgb or
+ * rgb+alpha) into a PNG file, without copy
+ *
+ * @param fname PNG file name
+ * @param data first sample of the first row
+ * @param stride bytes from one row to the next
+ * @param nx, ny, nc number of columns, lines and channels of the image
+ * @param opt write options, NULL for defaults
+ * @return 0 if everything OK, -1 if an error occured
+ */
+int io_png_write_rows_u8(const char *fname, const unsigned char *data,
+                         ptrdiff_t stride, size_t nx, size_t ny, size_t nc,
+                         const io_png_write_opt *opt) {
+    return _io_png_write_rows(fname, data, stride, nx, ny, nc, 8, opt);
+}
+
+/**
+ * @brief write a 16bit gray image into a PNG file, without copy
+ *
+ * Used for fixed-point disparity maps, like the KITTI format where
+ * the samples are 256 times the disparity.
+ *
+ * @param fname PNG file name
+ * @param data first sample of the first row
+ * @param stride bytes from one row to the next
+ * @param nx, ny number of columns and lines of the image
+ * @param opt write options, NULL for defaults
+ * @return 0 if everything OK, -1 if an error occured
+ */
+int io_png_write_u16_gray(const char *fname, const unsigned short *data,
+                          ptrdiff_t stride, size_t nx, size_t ny,
+                          const io_png_write_opt *opt) {
+    return _io_png_write_rows(fname, data, stride, nx, ny, 1, 16, opt);
+}
+
+/*
+ * STREAMING WRITE
+ */
+
+/* PNG file being written row by row */
+struct io_png_writer_s {
+    FILE *fp;
+    png_structp png_ptr;
+    png_infop info_ptr;
+    _io_png_err_t err;
+    size_t ny;
+    size_t row;                 /* next row to write */
+};
+
+/**
+ * @brief open a PNG file to write 8bit interleaved rows as they are
+ * produced
+ *
+ * The image is never interlaced, whatever the options, so that each
+ * row is compressed as soon as it is given.
+ *
+ * @param fname PNG file name, "-" means stdout
+ * @param nx, ny, nc number of columns, lines and channels of the image
+ * @param opt write options, NULL for defaults
+ * @return the writer, to release with io_png_close_write(),
+ *         or NULL if an error happens
+ */
+io_png_writer *io_png_open_write(const char *fname,
+                                 size_t nx, size_t ny, size_t nc,
+                                 const io_png_write_opt *opt) {
+    io_png_write_opt no_interlace;
+    int color_type;
+    /* volatile: because of setjmp/longjmp */
+    io_png_writer *volatile writer;
+
+    /* parameters check */
+    if (NULL == fname || 0 == nx || 0 == ny
+            || 0 > (color_type = _io_png_color_type(nc))) {
+        return NULL;
+    }
+    if (NULL == opt) {
+        io_png_write_opt_default(&no_interlace);
+    } else {
+        no_interlace = *opt;
+    }
+    no_interlace.interlace = 0;
+    if (NULL == (writer = (io_png_writer *) calloc(1, sizeof(*writer)))) {
+        return NULL;
+    }
+    writer->ny = ny;
+
+    /* open the PNG output file */
+    if (0 == strcmp(fname, "-")) {
+        writer->fp = stdout;
+    } else if (NULL == (writer->fp = fopen(fname, "wb"))) {
+        free(writer);
+        return NULL;
+    }
+
+    if (NULL == (writer->png_ptr =
+                     png_create_write_struct(PNG_LIBPNG_VER_STRING,
+                             &writer->err, &_io_png_err_hdl, NULL))
+            || NULL == (writer->info_ptr =
+                            png_create_info_struct(writer->png_ptr))) {
+        (void) _io_png_write_abort(writer->fp, NULL, NULL,
+                                   &writer->png_ptr, NULL);
+        free(writer);
+        return NULL;
+    }
+
+    /* handle write errors */
+    if (0 != setjmp(writer->err.jmpbuf)) {
+        (void) _io_png_write_abort(writer->fp, NULL, NULL,
+                                   &writer->png_ptr, &writer->info_ptr);
+        free(writer);
+        return NULL;
+    }
+
+    png_init_io(writer->png_ptr, writer->fp);
+    (void) _io_png_set_opt(writer->png_ptr, &no_interlace);
+    png_set_IHDR(writer->png_ptr, writer->info_ptr,
+                 (png_uint_32) nx, (png_uint_32) ny, 8, color_type,
+                 PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_BASE,
+                 PNG_FILTER_TYPE_BASE);
+    png_write_info(writer->png_ptr, writer->info_ptr);
+    return writer;
+}
+
+/**
+ * @brief write the next rows of a PNG file from caller memory
+ *
+ * @param writer writer returned by io_png_open_write()
+ * @param data first sample of the first row to write
+ * @param stride bytes from one row to the next in data
+ * @param nrows number of rows to write
+ * @return 0 if everything OK, -1 if an error occured
+ */
+int io_png_write_rows(io_png_writer *writer, const unsigned char *data,
+                      ptrdiff_t stride, size_t nrows) {
+    size_t j;
+
+    /* parameters check */
+    if (NULL == writer || NULL == data || writer->row + nrows > writer->ny) {
+        return -1;
+    }
+
+    /* handle write errors */
+    if (setjmp(writer->err.jmpbuf)) {
+        return -1;
+    }
+
+    for (j = 0; j < nrows; j++)
+        png_write_row(writer->png_ptr, (png_const_bytep) data
+                      + (ptrdiff_t) j * stride);
+    writer->row += nrows;
+    return 0;
+}
+
+/**
+ * @brief finish a PNG file and release a writer returned by
+ * io_png_open_write()
+ *
+ * @return 0 if everything OK, -1 if an error occured or if some rows
+ *         were not written
+ */
+int io_png_close_write(io_png_writer *writer) {
+    if (NULL == writer) {
+        return -1;
+    }
+    if (writer->row != writer->ny || 0 != setjmp(writer->err.jmpbuf)) {
+        (void) _io_png_write_abort(writer->fp, NULL, NULL,
+                                   &writer->png_ptr, &writer->info_ptr);
+        free(writer);
+        return -1;
+    }
+    png_write_end(writer->png_ptr, writer->info_ptr);
+    (void) _io_png_write_abort(writer->fp, NULL, NULL,
+                               &writer->png_ptr, &writer->info_ptr);
+    free(writer);
+    return 0;
+}
+
 /**
  * @brief write a 8bit unsigned integer array into a PNG file
  *
@@ -17,6 +17,51 @@ unsigned char *io_png_read_u8_gray(const char *fname, size_t *nxp, size_t *nyp);
 float *io_png_read_f32(const char *fname, size_t *nxp, size_t *nyp, size_t *ncp);
 float *io_png_read_f32_rgb(const char *fname, size_t *nxp, size_t *nyp);
 float *io_png_read_f32_gray(const char *fname, size_t *nxp, size_t *nyp);
+
+/* layouts of the rows filled by io_png_read_rows() */
+#define IO_PNG_GRAY 1           /* gray, converted from color on the fly */
+#define IO_PNG_RGB  3           /* interleaved RGB */
+#define IO_PNG_BGR  4           /* interleaved BGR */
+
+typedef struct io_png_reader_s io_png_reader;
+io_png_reader *io_png_open_read(const char *fname, int layout,
+                                size_t *nxp, size_t *nyp);
+int io_png_read_rows(io_png_reader *reader, unsigned char *data,
+                     ptrdiff_t stride, size_t nrows);
+int io_png_read_interlaced(const io_png_reader *reader);
+void io_png_close_read(io_png_reader *reader);
+
+/* options of the PNG writers */
+typedef struct io_png_write_opt_s {
+    int interlace;              /* 1 for Adam7 interlacing, 0 for none */
+    int level;                  /* zlib level 0-9, -1 for zlib default */
+    int strategy;               /* zlib strategy (Z_RLE...), -1 for default */
+    int filter;                 /* row filter IO_PNG_FILTER_*, -1 adaptive */
+} io_png_write_opt;
+
+/* row filters */
+#define IO_PNG_FILTER_NONE  0
+#define IO_PNG_FILTER_SUB   1
+#define IO_PNG_FILTER_UP    2
+#define IO_PNG_FILTER_AVG   3
+#define IO_PNG_FILTER_PAETH 4
+
+void io_png_write_opt_default(io_png_write_opt *opt);
+int io_png_write_rows_u8(const char *fname, const unsigned char *data,
+                         ptrdiff_t stride, size_t nx, size_t ny, size_t nc,
+                         const io_png_write_opt *opt);
+int io_png_write_u16_gray(const char *fname, const unsigned short *data,
+                          ptrdiff_t stride, size_t nx, size_t ny,
+                          const io_png_write_opt *opt);
+
+typedef struct io_png_writer_s io_png_writer;
+io_png_writer *io_png_open_write(const char *fname,
+                                 size_t nx, size_t ny, size_t nc,
+                                 const io_png_write_opt *opt);
+int io_png_write_rows(io_png_writer *writer, const unsigned char *data,
+                      ptrdiff_t stride, size_t nrows);
+int io_png_close_write(io_png_writer *writer);
+
 int io_png_write_u8(const char *fname, const unsigned char *data, size_t nx, size_t ny, size_t nc);
 int io_png_write_f32(const char *fname, const float *data, size_t nx, size_t ny, size_t nc);
 
@@ -0,0 +1,271 @@
+/**
+ * @file io_pnm.cc
+ * @brief memory-mapped PGM/PPM/PFM read, streaming PFM write
+ *
+ * Binary PGM (P5) and PPM (P6) files with 8bit samples and PFM files
+ * (Pf gray, PF color, 32bit float) store their pixels uncompressed
+ * after a short text header, so the mapped file can be used as the
+ * image memory. PFM lines are stored from bottom to top: the returned
+ * stride is negative.
+ *
+ * ASCII PGM/PPM (P2/P3) and 16bit samples are not handled.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+/* ensure consistency */
+#include "io_pnm.h"
+
+/* mapped file */
+typedef struct _io_pnm_map_s {
+    void *addr;
+    size_t length;
+#ifdef _WIN32
+    HANDLE file, mapping;
+#endif
+} _io_pnm_map_t;
+
+/*
+ * MAPPING
+ */
+
+/**
+ * @brief map file in memory, read-only
+ *
+ * @return the mapping, or NULL if an error happens
+ */
+static _io_pnm_map_t *_io_pnm_map_file(const char *fname) {
+    _io_pnm_map_t *map = (_io_pnm_map_t *) malloc(sizeof(_io_pnm_map_t));
+    if (NULL == map) {
+        return NULL;
+    }
+#ifdef _WIN32
+    LARGE_INTEGER size;
+    map->file = CreateFileA(fname, GENERIC_READ, FILE_SHARE_READ, NULL,
+                            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (INVALID_HANDLE_VALUE == map->file) {
+        free(map);
+        return NULL;
+    }
+    if (!GetFileSizeEx(map->file, &size) || 0 == size.QuadPart
+            || NULL == (map->mapping = CreateFileMappingA(map->file, NULL,
+                                       PAGE_READONLY, 0, 0, NULL))) {
+        CloseHandle(map->file);
+        free(map);
+        return NULL;
+    }
+    map->length = (size_t) size.QuadPart;
+    map->addr = MapViewOfFile(map->mapping, FILE_MAP_READ, 0, 0, 0);
+    if (NULL == map->addr) {
+        CloseHandle(map->mapping);
+        CloseHandle(map->file);
+        free(map);
+        return NULL;
+    }
+#else
+    struct stat st;
+    int fd = open(fname, O_RDONLY);
+    if (fd < 0) {
+        free(map);
+        return NULL;
+    }
+    if (0 != fstat(fd, &st) || 0 == st.st_size) {
+        close(fd);
+        free(map);
+        return NULL;
+    }
+    map->length = (size_t) st.st_size;
+    map->addr = mmap(NULL, map->length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); /* the mapping keeps the file */
+    if (MAP_FAILED == map->addr) {
+        free(map);
+        return NULL;
+    }
+    (void) madvise(map->addr, map->length, MADV_SEQUENTIAL);
+#endif
+    return map;
+}
+
+/**
+ * @brief release a mapping returned by io_pnm_map()
+ */
+void io_pnm_unmap(void *map_) {
+    _io_pnm_map_t *map = (_io_pnm_map_t *) map_;
+    if (NULL == map) {
+        return;
+    }
+#ifdef _WIN32
+    UnmapViewOfFile(map->addr);
+    CloseHandle(map->mapping);
+    CloseHandle(map->file);
+#else
+    munmap(map->addr, map->length);
+#endif
+    free(map);
+}
+
+/*
+ * READ
+ */
+
+/**
+ * @brief skip whitespace and comments of a PNM header
+ *
+ * @return position of next token, or end
+ */
+static const char *_io_pnm_skip(const char *p, const char *end) {
+    while (p < end) {
+        if ('#' == *p) {
+            while (p < end && '\n' != *p) {
+                p++;
+            }
+        } else if (isspace((unsigned char) *p)) {
+            p++;
+        } else {
+            break;
+        }
+    }
+    return p;
+}
+
+/**
+ * @brief read a token of a PNM header as a number
+ *
+ * @return position after the token, or NULL if there is no number
+ */
+static const char *_io_pnm_number(const char *p, const char *end,
+                                  double *value) {
+    char token[64];
+    char *tail;
+    size_t n = 0;
+
+    p = _io_pnm_skip(p, end);
+    while (p < end && !isspace((unsigned char) *p) && n + 1 < sizeof(token)) {
+        token[n++] = *p++;
+    }
+    token[n] = '\0';
+    *value = strtod(token, &tail);
+    return (0 == n || '\0' != *tail) ? NULL : p;
+}
+
+/**
+ * @brief map a binary PGM, PPM or PFM file
+ *
+ * @param fname file name
+ * @param info filled with the layout of the pixels in the mapping
+ * @return the mapping, to release with io_pnm_unmap(),
+ *         or NULL if the file is not of a supported format
+ */
+void *io_pnm_map(const char *fname, io_pnm_info *info) {
+    _io_pnm_map_t *map;
+    const char *p, *end;
+    double nx, ny, max;
+    size_t line, size;
+    int pfm;
+
+    if (NULL == fname || NULL == info
+            || NULL == (map = _io_pnm_map_file(fname))) {
+        return NULL;
+    }
+    p = (const char *) map->addr;
+    end = p + map->length;
+
+    if (map->length < 3 || 'P' != p[0]) {
+        io_pnm_unmap(map);
+        return NULL;
+    }
+    pfm = ('f' == p[1] || 'F' == p[1]);
+    if (pfm) {
+        info->nc = ('F' == p[1]) ? 3 : 1;
+        info->depth = 4;
+    } else if ('5' == p[1] || '6' == p[1]) {
+        info->nc = ('6' == p[1]) ? 3 : 1;
+        info->depth = 1;
+    } else {
+        io_pnm_unmap(map);
+        return NULL;
+    }
+    p += 2;
+
+    if (NULL == (p = _io_pnm_number(p, end, &nx))
+            || NULL == (p = _io_pnm_number(p, end, &ny))
+            || NULL == (p = _io_pnm_number(p, end, &max))
+            || p >= end || nx < 1 || ny < 1
+            || (!pfm && (max < 1 || max > 255)) || (pfm && 0 == max)) {
+        io_pnm_unmap(map);
+        return NULL;
+    }
+    p++; /* single whitespace before the samples */
+
+    info->nx = (size_t) nx;
+    info->ny = (size_t) ny;
+    info->little_endian = pfm && max < 0;
+    line = info->nx * info->nc * info->depth;
+    size = line * info->ny;
+    if ((size_t) (end - p) < size) {
+        io_pnm_unmap(map);
+        return NULL;
+    }
+
+    if (pfm) { /* bottom to top */
+        info->data = (unsigned char *) p + (info->ny - 1) * line;
+        info->stride = -(ptrdiff_t) line;
+    } else {
+        info->data = (unsigned char *) p;
+        info->stride = (ptrdiff_t) line;
+    }
+    return map;
+}
+
+/*
+ * WRITE
+ */
+
+/**
+ * @brief write a gray float image as PFM, in native byte order
+ *
+ * Lines are written straight from the caller memory, from bottom to top.
+ *
+ * @param fname PFM file name
+ * @param data first sample of the top line
+ * @param nx, ny number of columns and lines of the image
+ * @param stride bytes from one line to the next below it
+ * @return 0 if everything OK, -1 if an error occured
+ */
+int io_pnm_write_pfm(const char *fname, const float *data,
+                     size_t nx, size_t ny, ptrdiff_t stride) {
+    static const int one = 1;
+    const int little_endian = (1 == *(const char *) &one);
+    FILE *fp;
+    size_t j;
+
+    if (NULL == fname || NULL == data || 0 == nx || 0 == ny) {
+        return -1;
+    }
+    if (NULL == (fp = fopen(fname, "wb"))) {
+        return -1;
+    }
+    fprintf(fp, "Pf\n%lu %lu\n%s\n", (unsigned long) nx, (unsigned long) ny,
+            little_endian ? "-1.0" : "1.0");
+    for (j = ny; j-- > 0;) {
+        const float *row = (const float *)
+                           ((const char *) data + (ptrdiff_t) j * stride);
+        if (nx != fwrite(row, sizeof(float), nx, fp)) {
+            (void) fclose(fp);
+            return -1;
+        }
+    }
+    return (0 == fclose(fp)) ? 0 : -1;
+}
@@ -0,0 +1,31 @@
+#ifndef _IO_PNM_H
+#define _IO_PNM_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define IO_PNM_VERSION "0.20261019"
+
+#include <stddef.h>
+
+/* layout of the pixels of a mapped binary PGM/PPM/PFM file */
+typedef struct io_pnm_info_s {
+    size_t nx, ny, nc;      /* number of columns, lines and channels */
+    size_t depth;           /* bytes per sample: 1 (P5/P6) or 4 (PFM) */
+    int little_endian;      /* byte order of PFM samples */
+    ptrdiff_t stride;       /* bytes from one line to the next below it */
+    unsigned char *data;    /* first sample of the top line */
+} io_pnm_info;
+
+/* io_pnm.c */
+void *io_pnm_map(const char *fname, io_pnm_info *info);
+void io_pnm_unmap(void *map);
+int io_pnm_write_pfm(const char *fname, const float *data,
+                     size_t nx, size_t ny, ptrdiff_t stride);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !_IO_PNM_H */
@@ -19,7 +19,10 @@
  *
  * This is a front-end to libtiff, with routines to:
  * @li read a TIFF file as a deinterlaced float array
+ * @li read a rectangle of a float TIFF file, decoding only its tiles
  * @li write a float array to a TIFF file
+ * @li write a float image as tiled TIFF, DEFLATE compressed with
+ *     floating point predictor
  *
  * @todo handle multi-channel images and on-the-fly color model conversion
  * @todo add a test suite
@@ -68,39 +71,126 @@ char *io_tiff_info(void)
  */
 
 /**
- * Read a TIFF float image.
+ * Size of a TIFF gray image of float or 8bit unsigned samples. Return the
+ * bytes per sample, 0 if the TIFF is not of this type.
  */
-static float *readTIFF(TIFF * tif, size_t * nx, size_t * ny)
+static int sizeTIFF(TIFF * tif, uint32 * w, uint32 * h)
 {
-    uint32 w = 0, h = 0, i;
-    uint16 spp = 0, bps = 0, fmt = 0;
-    float *data, *line;
+    uint16 spp = 0, bps = 0, fmt = SAMPLEFORMAT_UINT;
 
-    TIFFGetField(tif, TIFFTAG_IMAGEWIDTH, &w);
-    TIFFGetField(tif, TIFFTAG_IMAGELENGTH, &h);
+    TIFFGetField(tif, TIFFTAG_IMAGEWIDTH, w);
+    TIFFGetField(tif, TIFFTAG_IMAGELENGTH, h);
     TIFFGetField(tif, TIFFTAG_SAMPLESPERPIXEL, &spp);
     TIFFGetField(tif, TIFFTAG_BITSPERSAMPLE, &bps);
     TIFFGetField(tif, TIFFTAG_SAMPLEFORMAT, &fmt);
-    if (spp != 1 || bps != (uint16) sizeof(float) * 8
-        || fmt != SAMPLEFORMAT_IEEEFP)
+    if (spp != 1)
+        return 0;
+    if (bps == (uint16) sizeof(float) * 8 && fmt == SAMPLEFORMAT_IEEEFP)
+        return (int) sizeof(float);
+    if (bps == 8 && fmt == SAMPLEFORMAT_UINT)
+        return 1;
+    return 0;
+}
+
+/**
+ * Copy n samples of size bps bytes (float or 8bit unsigned) as floats.
+ */
+static void copySamples(float *dst, const void *src, uint32 n, int bps)
+{
+    uint32 i;
+
+    if (bps == (int) sizeof(float)) {
+        memcpy(dst, src, n * sizeof(float));
+        return;
+    }
+    for (i = 0; i < n; i++)
+        dst[i] = (float) ((const unsigned char *) src)[i];
+}
+
+/**
+ * Read the rectangle of nx x ny pixels at (x0,y0) of a TIFF gray image as
+ * floats. For tiled files, only the tiles meeting the rectangle are decoded.
+ */
+static float *readTIFFRect(TIFF * tif, uint32 x0, uint32 y0,
+                           uint32 nx, uint32 ny)
+{
+    uint32 w = 0, h = 0, tw = 0, th = 0, x, y, i;
+    float *data;
+    unsigned char *buf;
+    int bps = sizeTIFF(tif, &w, &h);
+
+    if (!bps || nx == 0 || ny == 0
+        || x0 > w || nx > w - x0 || y0 > h || ny > h - y0)
+        return NULL;
+    data = (float *) malloc((size_t) nx * ny * sizeof(float));
+    if (!data)
         return NULL;
 
-    assert((size_t) TIFFScanlineSize(tif) == w * sizeof(float));
-    data = (float *) malloc(w * h * sizeof(float));
-    *nx = (size_t) w;
-    *ny = (size_t) h;
-    for (i = 0; i < h; i++) {
-        line = data + i * w;
-        if (TIFFReadScanline(tif, line, i, 0) < 0) {
-            fprintf(stderr, "readTIFF: error reading row %u\n", i);
+    if (!TIFFIsTiled(tif)) {
+        buf = (unsigned char *) malloc((size_t) w * bps);
+        assert((size_t) TIFFScanlineSize(tif) == (size_t) w * bps);
+        for (i = 0; buf && i < ny; i++) {
+            if (TIFFReadScanline(tif, buf, y0 + i, 0) < 0) {
+                fprintf(stderr, "readTIFF: error reading row %u\n", y0 + i);
+                break;
+            }
+            copySamples(data + (size_t) i * nx, buf + (size_t) x0 * bps, nx,
+                        bps);
+        }
+        free(buf);
+        if (i < ny) {
             free(data);
             return NULL;
         }
+        return data;
     }
 
+    TIFFGetField(tif, TIFFTAG_TILEWIDTH, &tw);
+    TIFFGetField(tif, TIFFTAG_TILELENGTH, &th);
+    buf = (unsigned char *) malloc((size_t) TIFFTileSize(tif));
+    if (!buf) {
+        free(data);
+        return NULL;
+    }
+    for (y = y0 - y0 % th; y < y0 + ny; y += th)
+        for (x = x0 - x0 % tw; x < x0 + nx; x += tw) {
+            /* intersection of tile and rectangle */
+            uint32 xb = (x > x0) ? x : x0, xe = x + tw;
+            uint32 yb = (y > y0) ? y : y0, ye = y + th;
+            if (xe > x0 + nx)
+                xe = x0 + nx;
+            if (ye > y0 + ny)
+                ye = y0 + ny;
+            if (TIFFReadTile(tif, buf, x, y, 0, 0) < 0) {
+                fprintf(stderr, "readTIFF: error reading tile %u,%u\n",
+                        x, y);
+                free(buf);
+                free(data);
+                return NULL;
+            }
+            for (i = yb; i < ye; i++)
+                copySamples(data + (size_t) (i - y0) * nx + (xb - x0),
+                            buf + ((size_t) (i - y) * tw + (xb - x)) * bps,
+                            xe - xb, bps);
+        }
+    free(buf);
     return data;
 }
 
+/**
+ * Read a TIFF float image.
+ */
+static float *readTIFF(TIFF * tif, size_t * nx, size_t * ny)
+{
+    uint32 w = 0, h = 0;
+
+    if (!sizeTIFF(tif, &w, &h))
+        return NULL;
+    *nx = (size_t) w;
+    *ny = (size_t) h;
+    return readTIFFRect(tif, 0, 0, w, h);
+}
+
 /**
  * Load TIFF float image.
  */
@@ -117,6 +207,45 @@ float *io_tiff_read_f32_gray(const char *fname, size_t * nx, size_t * ny)
     return data;
 }
 
+/**
+ * Size of TIFF gray image (float or 8bit unsigned samples), 0 if everything
+ * OK, -1 if an error occured.
+ */
+int io_tiff_read_size(const char *fname, size_t * nx, size_t * ny)
+{
+    uint32 w = 0, h = 0;
+    int ok;
+    TIFF *tif = TIFFOpen(fname, "r");
+    if (!tif) {
+        fprintf(stderr, "Unable to read TIFF file %s\n", fname);
+        return -1;
+    }
+    ok = sizeTIFF(tif, &w, &h);
+    TIFFClose(tif);
+    *nx = (size_t) w;
+    *ny = (size_t) h;
+    return (ok ? 0 : -1);
+}
+
+/**
+ * Load rectangle of nx x ny pixels at (x0,y0) of TIFF gray image (float or
+ * 8bit unsigned samples) as floats.
+ */
+float *io_tiff_read_f32_rect(const char *fname, size_t x0, size_t y0,
+                             size_t nx, size_t ny)
+{
+    float *data;
+    TIFF *tif = TIFFOpen(fname, "r");
+    if (!tif) {
+        fprintf(stderr, "Unable to read TIFF file %s\n", fname);
+        return NULL;
+    }
+    data = readTIFFRect(tif, (uint32) x0, (uint32) y0, (uint32) nx,
+                        (uint32) ny);
+    TIFFClose(tif);
+    return data;
+}
+
 /*
  * WRITE
  */
@@ -172,3 +301,70 @@ int io_tiff_write_f32(const char *fname, const float *data,
     TIFFClose(tif);
     return (ok ? 0 : -1);
 }
+
+/**
+ * Write float image as tiled TIFF 32 bits per sample, DEFLATE compressed
+ * with floating point predictor.
+ *
+ * The pixels of each tile are given by the fill function, so that they can
+ * come straight from the caller buffer, whatever its type. Tiles crossing
+ * the image border are padded with zeros.
+ *
+ * @param tile_size width and height of tiles, multiple of 16
+ */
+int io_tiff_write_f32_tiled(const char *fname, size_t nx, size_t ny,
+                            size_t tile_size,
+                            io_tiff_fill_f32 fill, void *ctx)
+{
+    size_t x, y, w, h;
+    float *tile;
+    int ok = 1;
+    TIFF *tif;
+
+    if (nx == 0 || ny == 0 || tile_size == 0 || tile_size % 16 != 0)
+        return -1;
+    tile = (float *) malloc(tile_size * tile_size * sizeof(float));
+    if (!tile)
+        return -1;
+    tif = TIFFOpen(fname, "w");
+    if (!tif) {
+        fprintf(stderr, "Unable to write TIFF file %s\n", fname);
+        free(tile);
+        return -1;
+    }
+
+    TIFFSetField(tif, TIFFTAG_IMAGEWIDTH, (uint32) nx);
+    TIFFSetField(tif, TIFFTAG_IMAGELENGTH, (uint32) ny);
+    TIFFSetField(tif, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
+    TIFFSetField(tif, TIFFTAG_SAMPLESPERPIXEL, (uint16) 1);
+    TIFFSetField(tif, TIFFTAG_BITSPERSAMPLE, (uint16) sizeof(float) * 8);
+    TIFFSetField(tif, TIFFTAG_SAMPLEFORMAT, SAMPLEFORMAT_IEEEFP);
+    TIFFSetField(tif, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_MINISBLACK);
+    TIFFSetField(tif, TIFFTAG_TILEWIDTH, (uint32) tile_size);
+    TIFFSetField(tif, TIFFTAG_TILELENGTH, (uint32) tile_size);
+    TIFFSetField(tif, TIFFTAG_COMPRESSION, COMPRESSION_ADOBE_DEFLATE);
+    TIFFSetField(tif, TIFFTAG_PREDICTOR, PREDICTOR_FLOATINGPOINT);
+    TIFFSetField(tif, TIFFTAG_ORIENTATION, ORIENTATION_TOPLEFT);
+
+    for (y = 0; ok && y < ny; y += tile_size)
+        for (x = 0; ok && x < nx; x += tile_size) {
+            w = (nx - x < tile_size) ? nx - x : tile_size;
+            h = (ny - y < tile_size) ? ny - y : tile_size;
+            if (w < tile_size || h < tile_size)
+                memset(tile, 0, tile_size * tile_size * sizeof(float));
+            fill(ctx, x, y, w, h, tile, tile_size);
+            if (TIFFWriteEncodedTile(tif,
+                                     TIFFComputeTile(tif, (uint32) x,
+                                                     (uint32) y, 0, 0),
+                                     tile, (tmsize_t) (tile_size * tile_size
+                                                       * sizeof(float)))
+                < 0) {
+                fprintf(stderr, "writeTIFF: error writing tile %i,%i\n",
+                        (int) x, (int) y);
+                ok = 0;
+            }
+        }
+    TIFFClose(tif);
+    free(tile);
+    return (ok ? 0 : -1);
+}
@@ -10,8 +10,20 @@ extern "C" {
 #include <stddef.h>
 
 float *io_tiff_read_f32_gray(const char *fname, size_t *nx, size_t *ny);
+int io_tiff_read_size(const char *fname, size_t *nx, size_t *ny);
+float *io_tiff_read_f32_rect(const char *fname, size_t x0, size_t y0,
+                             size_t nx, size_t ny);
 int io_tiff_write_f32(const char *fname, const float *data, size_t nx, size_t ny, size_t nc);
 
+/* fill the rectangle of nx x ny pixels at (x0,y0), rows being stride floats
+ * apart in tile */
+typedef void (*io_tiff_fill_f32)(void *ctx, size_t x0, size_t y0,
+                                 size_t nx, size_t ny,
+                                 float *tile, size_t stride);
+int io_tiff_write_f32_tiled(const char *fname, size_t nx, size_t ny,
+                            size_t tile_size,
+                            io_tiff_fill_f32 fill, void *ctx);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,376 @@
+#include "BatchMatcher.h"
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include "Trace.h"
+
+using namespace std;
+using namespace cv;
+
+/// Seconds elapsed since \a start
+static double Since(const chrono::steady_clock::time_point &start) {
+    return chrono::duration<double>(chrono::steady_clock::now() -
+                                    start).count();
+}
+
+BatchMatcher::BatchMatcher(const string &method, const MatcherConfig &config,
+                           int threads, size_t pixelsPerThread)
+    : method(method), config(config),
+      threads(threads > 0 ? threads :
+              max((int)thread::hardware_concurrency(), 1)),
+      pixelsPerThread(max(pixelsPerThread, (size_t)1)), freeThreads(0) {
+    unique_ptr<StereoMatcher> matcher = StereoMatcher::Create(method);
+    transform = matcher ? matcher->Transform() : TRANSFORM_NONE;
+    local = matcher && matcher->Local();
+}
+
+static bool IsDirectory(const string &path) {
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+/// File of directory \a dir named \a base with an image extension, empty if
+/// none.
+static string FindView(const string &dir, const vector<string> &files,
+                       const string &base) {
+    static const char *const exts[] = { "png", "jpg", "jpeg", "bmp", "ppm",
+                                        "pgm", "tif", "tiff"
+                                      };
+    for (size_t e = 0; e < sizeof(exts) / sizeof(exts[0]); ++e) {
+        const string name = base + "." + exts[e];
+        if (find(files.begin(), files.end(), name) != files.end()) {
+            return dir + "/" + name;
+        }
+    }
+    return string();
+}
+
+static void DiscoverDir(const string &dir, const string &name,
+                        const string &outDir, const string &ext,
+                        vector<BatchJob> &jobs) {
+    DIR *d = opendir(dir.c_str());
+    if (!d) {
+        return;
+    }
+    vector<string> files, subdirs;
+    for (struct dirent *e; (e = readdir(d)) != NULL;) {
+        const string entry = e->d_name;
+        if (entry == "." || entry == "..") {
+            continue;
+        }
+        (IsDirectory(dir + "/" + entry) ? subdirs : files).push_back(entry);
+    }
+    closedir(d);
+
+    static const char *const views[][2] = {
+        { "imL", "imR" }, { "im0", "im1" }, { "left", "right" }
+    };
+    for (size_t v = 0; v < sizeof(views) / sizeof(views[0]); ++v) {
+        BatchJob job;
+        job.files.left = FindView(dir, files, views[v][0]);
+        job.files.right = FindView(dir, files, views[v][1]);
+        if (job.files.left.empty() || job.files.right.empty()) {
+            continue;
+        }
+        if (find(files.begin(), files.end(), "para.txt") != files.end()) {
+            job.files.calib = dir + "/para.txt";
+        }
+        job.name = name;
+        job.output = outDir + "/" + name + ext;
+        jobs.push_back(job);
+        break;
+    }
+    sort(subdirs.begin(), subdirs.end());
+    for (size_t i = 0; i < subdirs.size(); ++i) {
+        DiscoverDir(dir + "/" + subdirs[i], name + "_" + subdirs[i], outDir,
+                    ext, jobs);
+    }
+}
+
+vector<BatchJob> BatchMatcher::Discover(const string &root,
+                                        const string &outDir,
+                                        const string &ext) {
+    string dir = root;
+    while (dir.size() > 1 && dir[dir.size() - 1] == '/') {
+        dir.erase(dir.size() - 1);
+    }
+    const size_t slash = dir.rfind('/');
+    vector<BatchJob> jobs;
+    DiscoverDir(dir, slash == string::npos ? dir : dir.substr(slash + 1),
+                outDir, ext, jobs);
+    return jobs;
+}
+
+bool BatchMatcher::ReadManifest(const string &filename, const string &outDir,
+                                const string &ext, vector<BatchJob> &jobs) {
+    ifstream ifs(filename.c_str());
+    if (!ifs) {
+        cerr << "Error reading file " << filename << endl;
+        return false;
+    }
+    string line;
+    for (int n = 1; getline(ifs, line); ++n) {
+        istringstream fields(line);
+        BatchJob job;
+        if (!(fields >> job.files.left) || job.files.left[0] == '#') {
+            continue;
+        }
+        if (!(fields >> job.files.right)) {
+            cerr << "Error: no right view at line " << n << " of "
+                 << filename << endl;
+            return false;
+        }
+        if (fields >> job.files.calib && job.files.calib == "-") {
+            job.files.calib.clear();
+        }
+        if (!(fields >> job.name)) {
+            // Left view path, without extension
+            job.name = job.files.left.substr(0, job.files.left.rfind('.'));
+            replace(job.name.begin(), job.name.end(), '/', '_');
+        }
+        job.output = outDir + "/" + job.name + ext;
+        jobs.push_back(job);
+    }
+    return true;
+}
+
+bool BatchMatcher::Run(const vector<BatchJob> &jobs,
+                       vector<BatchTiming> &timings) {
+    timings.assign(jobs.size(), BatchTiming());
+    freeThreads = threads;
+
+    // Largest pairs first, by size of the left view file, so that they do
+    // not run alone at the end
+    vector<size_t> order(jobs.size());
+    vector<off_t> bytes(jobs.size(), 0);
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        struct stat st;
+        if (stat(jobs[i].files.left.c_str(), &st) == 0) {
+            bytes[i] = st.st_size;
+        }
+        order[i] = i;
+    }
+    stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return bytes[a] > bytes[b];
+    });
+
+    // Loading of pairs overlaps matching: a worker per thread
+    atomic<size_t> next(0);
+    vector<thread> workers;
+    for (int i = 0; i < min(threads, (int)jobs.size()); ++i) {
+        workers.push_back(thread([&]() {
+            MatcherSet matchers;
+            for (size_t j; (j = next++) < jobs.size();) {
+                Process(jobs[order[j]], matchers, timings[order[j]]);
+            }
+        }));
+    }
+    for (size_t i = 0; i < workers.size(); ++i) {
+        workers[i].join();
+    }
+    for (size_t i = 0; i < timings.size(); ++i)
+        if (!timings[i].ok) {
+            return false;
+        }
+    return true;
+}
+
+void BatchMatcher::Process(const BatchJob &job, MatcherSet &matchers,
+                           BatchTiming &timing) {
+    timing.name = job.name;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    TraceSpan load("load pair");
+    Mat left = imread(job.files.left, IMREAD_GRAYSCALE);
+    Mat right = imread(job.files.right, IMREAD_GRAYSCALE);
+    load.End();
+    timing.load = Since(start);
+    if (left.empty() || right.empty()) {
+        cerr << "Error reading views " << job.files.left << " and "
+             << job.files.right << endl;
+        return;
+    }
+    timing.size = left.size();
+
+    start = chrono::steady_clock::now();
+    TransformedView views[2];
+    {
+        TraceSpan span("rectify pair");
+        Rectify(job.files.calib, left, right, views);
+    }
+    timing.rectify = Since(start);
+
+    // Empty range and no window: defaults of the interactive program
+    MatcherConfig pairConfig = config;
+    if (config.dMin > config.dMax) {
+        pairConfig.dMin = -left.cols / 8;
+        pairConfig.dMax = 0;
+    }
+    if (config.windowSize <= 0) {
+        pairConfig.windowSize = (left.cols / 8 / 12) * 2 + 1;
+    }
+
+    const int n = AcquireThreads(left.size());
+    timing.threads = n;
+    // A strip per thread if the matcher allows it, else one match taking all
+    // threads: a graph cut of the whole pair is not that of its strips
+    const int strips = local ? n : 1;
+    pairConfig.threads = local ? 1 : n;
+    for (size_t i = 0; i < (size_t)strips; ++i) {
+        if (i == matchers.size()) {
+            matchers.push_back(StereoMatcher::Create(method));
+        }
+        const MatcherConfig &c = matchers[i]->Config();
+        if (matchers[i]->Stats().calls == 0 || c.dMin != pairConfig.dMin ||
+                c.dMax != pairConfig.dMax ||
+                c.windowSize != pairConfig.windowSize ||
+                c.threads != pairConfig.threads) {
+            matchers[i]->Configure(pairConfig);
+        }
+    }
+    start = chrono::steady_clock::now();
+    Mat disparity(left.size(), CV_32FC1);
+    bool ok = MatchStrips(matchers, strips, views[0], views[1], disparity);
+    timing.match = Since(start);
+    ReleaseThreads(n);
+    if (!ok) {
+        return;
+    }
+
+    size_t matched = 0;
+    for (int y = 0; y < disparity.rows; ++y) {
+        const float *d = disparity.ptr<float>(y);
+        for (int x = 0; x < disparity.cols; ++x) {
+            matched += !std::isnan(d[x]);
+        }
+    }
+    timing.matched = (double)matched / disparity.total();
+
+    start = chrono::steady_clock::now();
+    timing.ok = SaveDisparity(job.output, disparity);
+    timing.save = Since(start);
+}
+
+/// Rectify views of calibration file \a calib, if any, with the maps shared
+/// by all pairs of this calibration, along with the transform of the
+/// matchers, into \a views.
+bool BatchMatcher::Rectify(const string &calib, const Mat &left,
+                           const Mat &right, TransformedView views[2]) {
+    shared_ptr<SharedRectifier> shared;
+    if (!calib.empty()) {
+        lock_guard<std::mutex> lock(mutex);
+        shared_ptr<SharedRectifier> &entry = rectifiers[calib];
+        if (!entry) {
+            entry.reset(new SharedRectifier);
+        }
+        shared = entry;
+    }
+    // Headers of the maps of the cache, which never overwrites them: only
+    // getting them takes the lock
+    Mat map_l[2], map_r[2];
+    bool rectify = false;
+    if (shared) {
+        lock_guard<std::mutex> lock(shared->mutex);
+        rectify = shared->rectifier.GetMaps(calib, left.size(), map_l, map_r);
+    }
+    RectifyTransformView(left, map_l[0], map_l[1], transform, views[0]);
+    RectifyTransformView(right, map_r[0], map_r[1], transform, views[1]);
+    return rectify;
+}
+
+/// Wait for the threads a pair of \a size deserves and take them.
+int BatchMatcher::AcquireThreads(const Size &size) {
+    const size_t wanted = ((size_t)size.area() + pixelsPerThread - 1) /
+                          pixelsPerThread;
+    const int n = (int)min(max(wanted, (size_t)1), (size_t)threads);
+    unique_lock<std::mutex> lock(mutex);
+    threadsFreed.wait(lock, [&]() {
+        return freeThreads >= n;
+    });
+    freeThreads -= n;
+    return n;
+}
+
+void BatchMatcher::ReleaseThreads(int n) {
+    {
+        lock_guard<std::mutex> lock(mutex);
+        freeThreads += n;
+    }
+    threadsFreed.notify_all();
+}
+
+/// Rows [\a a, \a b) of \a view and of its transform
+static TransformedView ViewRows(const TransformedView &view, int a, int b) {
+    TransformedView rows;
+    rows.image = view.image.rowRange(a, b);
+    if (!view.transform.empty()) {
+        rows.transform = view.transform.rowRange(a, b);
+    }
+    if (!view.max.empty()) {
+        rows.max = view.max.rowRange(a, b);
+    }
+    return rows;
+}
+
+/// Match \a strips horizontal strips of the views in parallel, each by its
+/// matcher. Strips overlap so that their windows and smoothness see the
+/// rows around them; each keeps the disparities of its own rows.
+bool BatchMatcher::MatchStrips(MatcherSet &matchers, int strips,
+                               const TransformedView &left_view,
+                               const TransformedView &right_view,
+                               Mat &disparity) {
+    const Mat &left = left_view.image;
+    const int overlap = max(32, matchers[0]->Config().windowSize);
+    strips = max(min(strips, left.rows / (2 * overlap)), 1);
+    if (strips == 1) {
+        return matchers[0]->Match(left_view, right_view, disparity);
+    }
+    vector<char> ok(strips, 0);
+    auto strip = [&](int s) {
+        const int y0 = left.rows * s / strips;
+        const int y1 = left.rows * (s + 1) / strips;
+        const int a = max(y0 - overlap, 0), b = min(y1 + overlap, left.rows);
+        Mat out(b - a, left.cols, CV_32FC1);
+        ok[s] = matchers[s]->Match(ViewRows(left_view, a, b),
+                                   ViewRows(right_view, a, b), out);
+        if (ok[s]) {
+            Mat rows = disparity.rowRange(y0, y1);
+            out.rowRange(y0 - a, y1 - a).copyTo(rows);
+        }
+    };
+    vector<thread> helpers;
+    for (int s = 1; s < strips; ++s) {
+        helpers.push_back(thread(strip, s));
+    }
+    strip(0);
+    for (size_t i = 0; i < helpers.size(); ++i) {
+        helpers[i].join();
+    }
+    return find(ok.begin(), ok.end(), 0) == ok.end();
+}
+
+bool BatchMatcher::WriteReport(const string &filename,
+                               const vector<BatchTiming> &timings) {
+    ofstream ofs(filename.c_str());
+    ofs << "name,width,height,threads,load_ms,rectify_ms,match_ms,save_ms,"
+        << "matched,ok" << endl;
+    for (size_t i = 0; i < timings.size(); ++i) {
+        const BatchTiming &t = timings[i];
+        ofs << t.name << ',' << t.size.width << ',' << t.size.height << ','
+            << t.threads << ',' << t.load * 1000 << ',' << t.rectify * 1000
+            << ',' << t.match * 1000 << ',' << t.save * 1000 << ','
+            << t.matched << ',' << (t.ok ? 1 : 0) << endl;
+    }
+    if (!ofs) {
+        cerr << "Error writing file " << filename << endl;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,103 @@
+#ifndef BATCH_MATCHER_H_
+#define BATCH_MATCHER_H_
+
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "opencv2/opencv.hpp"
+#include "StereoMatcher.h"
+#include "StereoPipeline.h"
+#include "StereoRectifier.h"
+
+/// Stereo pair of a batch and where its disparity goes.
+struct BatchJob {
+    StereoPairFiles files;
+    std::string name;   ///< unique name of the pair, for output and report
+    std::string output; ///< disparity file
+};
+
+/// Report of a pair of a batch. Times in seconds.
+struct BatchTiming {
+    std::string name;
+    cv::Size size;
+    int threads;        ///< threads matching the pair
+    double load, rectify, match, save;
+    double matched;     ///< fraction of pixels with a disparity
+    bool ok;
+    BatchTiming() : threads(0), load(0), rectify(0), match(0), save(0),
+        matched(0), ok(false) {}
+};
+
+/// Match many pairs with a pool of threads. Small pairs are matched side by
+/// side, one thread each; a pair gets one more thread per \a pixelsPerThread
+/// pixels, up to the whole pool. Local matchers then match it in horizontal
+/// strips in parallel, a thread each; others get the threads for one match
+/// of the whole pair. Larger pairs start first. Pairs sharing a calibration
+/// file share its rectification maps, and are rectified concurrently. Views
+/// are rectified along with the transform the matchers read, computed once
+/// for all strips.
+class BatchMatcher {
+  public:
+    /// 0 threads means one per core. An empty disparity range (dMin > dMax)
+    /// and a window size of 0 in \a config are chosen per pair as by the
+    /// interactive program.
+    BatchMatcher(const std::string &method, const MatcherConfig &config,
+                 int threads = 0, size_t pixelsPerThread = (size_t)1 << 18);
+
+    /// Pairs of the directory tree \a root: views imL/imR, im0/im1 or
+    /// left/right (any image extension) of a directory, calibration para.txt
+    /// of the same directory if any. Disparities go to \a outDir with
+    /// extension \a ext.
+    static std::vector<BatchJob> Discover(const std::string &root,
+                                          const std::string &outDir,
+                                          const std::string &ext);
+
+    /// Pairs of a manifest, a line per pair: "left right [calib [name]]",
+    /// calib being "-" for none. Lines starting with '#' are skipped.
+    static bool ReadManifest(const std::string &filename,
+                             const std::string &outDir, const std::string &ext,
+                             std::vector<BatchJob> &jobs);
+
+    /// Match all \a jobs, \a timings getting a report per job, in order.
+    /// False if a pair failed.
+    bool Run(const std::vector<BatchJob> &jobs,
+             std::vector<BatchTiming> &timings);
+
+    /// Write \a timings as CSV.
+    static bool WriteReport(const std::string &filename,
+                            const std::vector<BatchTiming> &timings);
+  private:
+    /// Rectifier of a calibration file, used by one pair at a time.
+    struct SharedRectifier {
+        std::mutex mutex;
+        StereoRectifier rectifier;
+    };
+    typedef std::vector<std::unique_ptr<StereoMatcher> > MatcherSet;
+
+    void Process(const BatchJob &job, MatcherSet &matchers,
+                 BatchTiming &timing);
+    bool Rectify(const std::string &calib, const cv::Mat &left,
+                 const cv::Mat &right, TransformedView views[2]);
+    int AcquireThreads(const cv::Size &size);
+    void ReleaseThreads(int n);
+    bool MatchStrips(MatcherSet &matchers, int strips,
+                     const TransformedView &left, const TransformedView &right,
+                     cv::Mat &disparity);
+
+    std::string method;
+    RowTransform transform; ///< of the matchers of the method
+    bool local; ///< matchers of the method can match strips
+    MatcherConfig config;
+    int threads;
+    size_t pixelsPerThread;
+
+    std::mutex mutex;
+    std::condition_variable threadsFreed;
+    int freeThreads;
+    std::map<std::string, std::shared_ptr<SharedRectifier> > rectifiers;
+};
+
+#endif  // BATCH_MATCHER_H_
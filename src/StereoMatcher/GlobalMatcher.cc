@@ -1,39 +1,177 @@
 #include "GlobalMatcher.h"
+#include "Trace.h"
 using namespace std;
 using namespace cv;
 
+GlobalMatcher::GlobalMatcher()
+    : occlusionK(-1), lastK(-1), maxGraphs(-1), collectStats(false),
+      threads(0), rng((unsigned int)time(NULL)) {}
+
+void GlobalMatcher::SetOcclusionCost(float K) {
+    occlusionK = K;
+}
+
+float GlobalMatcher::OcclusionCost() const {
+    return lastK;
+}
+
+void GlobalMatcher::CollectSolverStats(bool enable) {
+    collectStats = enable;
+    solverStats.clear();
+}
+
+const vector<Match::ExpansionStats> &GlobalMatcher::SolverStats() const {
+    return solverStats;
+}
+
+void GlobalMatcher::SetThreads(int threads) {
+    this->threads = threads;
+}
+
+void GlobalMatcher::SetSeed(unsigned int seed) {
+    rng.seed(seed);
+}
+
+void GlobalMatcher::RecordGraphs(const string &filename, int maxGraphs) {
+    graphFile = filename;
+    this->maxGraphs = maxGraphs;
+}
+
 int GlobalMatcher::run(Mat &left_view, Mat &right_view,
-                       int dMin, int dMax, Mat &output) {
-    //srand
-    time_t seed = time(NULL);
-    srand((unsigned int)seed);
-    //convert image
-    int xsize = left_view.cols, ysize = left_view.rows;
-    GeneralImage im1 = (GeneralImage)imNew(IMAGE_GRAY, xsize, ysize);
-    GeneralImage im2 = (GeneralImage)imNew(IMAGE_GRAY, xsize, ysize);
-    const size_t size = xsize*ysize;
-    for (size_t i = 0; i < size; i++) {
-        imRef((GrayImage)im1, i, 0) = left_view.data[i];
-        imRef((GrayImage)im2, i, 0) = right_view.data[i];
+                       int dMin, int dMax, Mat &output,
+                       Mat *disparity, Mat *occlusion) {
+    return match(left_view, right_view, nullptr, nullptr, dMin, dMax, output,
+                 disparity, occlusion);
+}
+
+int GlobalMatcher::run(TransformedView &left, TransformedView &right,
+                       int dMin, int dMax, Mat &output,
+                       Mat *disparity, Mat *occlusion) {
+    CV_Assert(!left.max.empty() && !right.max.empty());
+    return match(left.image, right.image, &left, &right, dMin, dMax, output,
+                 disparity, occlusion);
+}
+
+int GlobalMatcher::run(Mat &left_view, Mat &right_view,
+                       const Rect &left_roi, const Rect &right_roi,
+                       int dMin, int dMax, Mat &output,
+                       Mat *disparity, Mat *occlusion) {
+    return match_region(left_view, right_view, nullptr, nullptr, left_roi,
+                        right_roi, dMin, dMax, output, disparity, occlusion);
+}
+
+int GlobalMatcher::run(TransformedView &left, TransformedView &right,
+                       const Rect &left_roi, const Rect &right_roi,
+                       int dMin, int dMax, Mat &output,
+                       Mat *disparity, Mat *occlusion) {
+    CV_Assert(!left.max.empty() && !right.max.empty());
+    return match_region(left.image, right.image, &left, &right, left_roi,
+                        right_roi, dMin, dMax, output, disparity, occlusion);
+}
+
+int GlobalMatcher::match_region(Mat &left_view, Mat &right_view,
+                                TransformedView *bt_left,
+                                TransformedView *bt_right,
+                                const Rect &left_roi, const Rect &right_roi,
+                                int dMin, int dMax, Mat &output,
+                                Mat *disparity, Mat *occlusion) {
+    CV_Assert(left_roi.y == right_roi.y && left_roi.height == right_roi.height);
+    //pad with occlusion: 0 disparity, cyan (BGR)
+    Mat disp_tmp, occl_tmp;
+    Mat &disp = disparity ? *disparity : disp_tmp;
+    Mat &occl = occlusion ? *occlusion : occl_tmp;
+    output.create(left_view.size(), CV_8UC3);
+    output.setTo(Scalar(255, 255, 0));
+    disp.create(left_view.size(), CV_16SC1);
+    disp.setTo(Scalar(0));
+    occl.create(left_view.size(), CV_8UC1);
+    occl.setTo(Scalar(255));
+    //disparities between crops are offset by the shift of their origins
+    const int shift = right_roi.x - left_roi.x;
+    Mat left_crop = left_view(left_roi), right_crop = right_view(right_roi);
+    Mat output_crop = output(left_roi);
+    Mat disp_crop = disp(left_roi), occl_crop = occl(left_roi);
+    //Birchfield-Tomasi ranges, if any, are cropped with the views
+    const bool bt = bt_left && bt_right;
+    TransformedView bt_crop[2];
+    if (bt) {
+        bt_crop[0].image = left_crop;
+        bt_crop[0].transform = bt_left->transform(left_roi);
+        bt_crop[0].max = bt_left->max(left_roi);
+        bt_crop[1].image = right_crop;
+        bt_crop[1].transform = bt_right->transform(right_roi);
+        bt_crop[1].max = bt_right->max(right_roi);
+    }
+    int ret = match(left_crop, right_crop, bt ? &bt_crop[0] : nullptr,
+                    bt ? &bt_crop[1] : nullptr, dMin - shift, dMax - shift,
+                    output_crop, &disp_crop, &occl_crop);
+    if (disparity && shift != 0) {
+        add(disp_crop, Scalar(shift), disp_crop, occl_crop == 0);
     }
-    bool color = false;
+    return ret;
+}
+
+int GlobalMatcher::match(Mat &left_view, Mat &right_view,
+                         TransformedView *bt_left, TransformedView *bt_right,
+                         int dMin, int dMax, Mat &output,
+                         Mat *disparity, Mat *occlusion) {
+    //wrap views without copy, they may be ROIs of a larger image
+    int xsize = left_view.cols, ysize = left_view.rows;
+    bool color = (left_view.type() == CV_8UC3);
+    CV_Assert(left_view.type() == right_view.type() &&
+              (color || left_view.type() == CV_8UC1));
+    ImageType type = color ? IMAGE_RGB : IMAGE_GRAY;
+    GeneralImage im1 = (GeneralImage)imWrap(type, left_view.data,
+                                            xsize, ysize, left_view.step);
+    GeneralImage im2 = (GeneralImage)imWrap(type, right_view.data,
+                                            right_view.cols, right_view.rows,
+                                            right_view.step);
     //set match
     Match m(im1, im2, color);
     m.SetDispRange(dMin, dMax);
+    if (!graphFile.empty()) {
+        m.RecordGraphs(graphFile.c_str(), maxGraphs);
+    }
+    m.CollectSolverStats(collectStats);
+    //own threads and random generator: runs may be concurrent
+    m.SetThreads(threads);
+    m.SetSeed((unsigned int)rng());
+    if (bt_left && bt_right) { // Birchfield-Tomasi ranges already computed
+        Mat *bt[4] = { &bt_left->transform, &bt_left->max,
+                       &bt_right->transform, &bt_right->max
+                     };
+        GeneralImage range[4];
+        for (int i = 0; i < 4; i++)
+            range[i] = (GeneralImage)imWrap(type, bt[i]->data, bt[i]->cols,
+                                            bt[i]->rows, bt[i]->step);
+        m.SetSubPixel(range[0], range[1], range[2], range[3]);
+    }
     //set param
     //params.maxIter, params.edgeThresh, params.bRandomizeEveryIteration, params.dataCost;
-    float K =-1, lambda = -1, lambda1 = -1, lambda2 = -1;
+    float K = occlusionK, lambda = -1, lambda1 = -1, lambda2 = -1;
     Match::Parameters params = { // Default parameters
         Match::Parameters::L2, 1, // dataCost, denominator
         8, -1, -1, // edgeThresh, lambda1, lambda2 (smoothness cost)
         -1,        // K (occlusion cost)
-        4, false   // maxIter, bRandomizeEveryIteration
+        4, false,  // maxIter, bRandomizeEveryIteration
+        true, 0    // checkEnergy, validateEvery
     };
     fix_parameters(m, params, K, lambda, lambda1, lambda2);
+    lastK = K;
     m.KZ2();
+    solverStats = m.GetSolverStats();
     //output
-    m.SaveScaledXLeft("../output.png", false);
-    output = imread("../output.png");
+    TraceSpan span("GC output");
+    output.create(ysize, xsize, CV_8UC3);
+    m.GetOutputImage(output.data, output.step, false, true);
+    if (disparity || occlusion) {
+        Mat disp_tmp, occl_tmp;
+        Mat &disp = disparity ? *disparity : disp_tmp;
+        Mat &occl = occlusion ? *occlusion : occl_tmp;
+        disp.create(ysize, xsize, CV_16SC1);
+        occl.create(ysize, xsize, CV_8UC1);
+        m.GetDisparity(disp.ptr<short>(), disp.step, occl.data, occl.step);
+    }
 
     imFree(im1);
     imFree(im2);
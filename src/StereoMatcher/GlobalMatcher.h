@@ -6,14 +6,78 @@
 #include <limits>
 #include <iostream>
 #include <ctime>
+#include <random>
+#include <string>
+#include <vector>
 #include "match.h"
 #include "opencv2/opencv.hpp"
+#include "RectifyTransform.h"
 
 class GlobalMatcher {
   public:
+    GlobalMatcher();
+
+    /// Occlusion cost K of the next runs. If negative (default), it is
+    /// computed from the views at each run.
+    void SetOcclusionCost(float K);
+    /// Occlusion cost K of the last run, to reuse on similar views.
+    float OcclusionCost() const;
+
+    /// Append the graphs of the expansion moves of the next runs to binary
+    /// file \a filename, at most \a maxGraphs per run if not negative, to
+    /// replay them in a max-flow benchmark. Empty name to stop.
+    void RecordGraphs(const std::string &filename, int maxGraphs = -1);
+
+    /// Collect statistics of the expansion moves of the next runs (see
+    /// Match::CollectSolverStats).
+    void CollectSolverStats(bool enable = true);
+    /// Statistics of the expansion moves of the last run, if collected.
+    const std::vector<Match::ExpansionStats> &SolverStats() const;
+
+    /// Threads of a run (see Match::SetThreads), 0 (default) for one per core.
+    void SetThreads(int threads);
+    /// Seed of the generator of this instance, drawing the seed of each run
+    /// (see Match::SetSeed). Seeded with the time by default.
+    void SetSeed(unsigned int seed);
+
+    /// Compute disparity with Kolmogorov-Zabih graph cuts.
+    ///
+    /// \a output gets the colormapped disparity (CV_8UC3). If not null,
+    /// \a disparity gets the raw disparities (CV_16SC1, 0 where occluded) and
+    /// \a occlusion the occlusion mask (CV_8UC1, 255 where occluded).
     int run(cv::Mat &left_view, cv::Mat &right_view, int dMin, int dMax,
-            cv::Mat &output);
+            cv::Mat &output, cv::Mat *disparity = nullptr,
+            cv::Mat *occlusion = nullptr);
+
+    /// Same on views from StereoRectifier::RectifyTransform with
+    /// TRANSFORM_BT: their Birchfield-Tomasi ranges are used as they are.
+    int run(TransformedView &left, TransformedView &right, int dMin, int dMax,
+            cv::Mat &output, cv::Mat *disparity = nullptr,
+            cv::Mat *occlusion = nullptr);
+
+    /// Same, matching only rectangle \a left_roi of the left view against
+    /// \a right_roi of the right view, on the same rows (see
+    /// StereoRectifier::MatchRegion). Outputs have the size of the views and
+    /// are occluded outside \a left_roi.
+    int run(cv::Mat &left_view, cv::Mat &right_view, const cv::Rect &left_roi,
+            const cv::Rect &right_roi, int dMin, int dMax, cv::Mat &output,
+            cv::Mat *disparity = nullptr, cv::Mat *occlusion = nullptr);
+    /// Same on views with their Birchfield-Tomasi ranges, cropped with them.
+    int run(TransformedView &left, TransformedView &right,
+            const cv::Rect &left_roi, const cv::Rect &right_roi, int dMin,
+            int dMax, cv::Mat &output, cv::Mat *disparity = nullptr,
+            cv::Mat *occlusion = nullptr);
   private:
+    int match_region(cv::Mat &left_view, cv::Mat &right_view,
+                     TransformedView *bt_left, TransformedView *bt_right,
+                     const cv::Rect &left_roi, const cv::Rect &right_roi,
+                     int dMin, int dMax, cv::Mat &output, cv::Mat *disparity,
+                     cv::Mat *occlusion);
+    int match(cv::Mat &left_view, cv::Mat &right_view,
+              TransformedView *bt_left, TransformedView *bt_right,
+              int dMin, int dMax, cv::Mat &output, cv::Mat *disparity,
+              cv::Mat *occlusion);
+
     /// Store in \a params fractions approximating the last 3 parameters.
     ///
     /// They have the same denominator (up to \c MAX_DENOM), chosen so that the sum
@@ -29,6 +93,14 @@ class GlobalMatcher {
     void fix_parameters(Match &m, Match::Parameters &params,
                         float &K, float &lambda, float &lambda1, float &lambda2);
 
+    float occlusionK, lastK;
+    std::string graphFile;
+    int maxGraphs;
+    bool collectStats;
+    std::vector<Match::ExpansionStats> solverStats;
+    int threads;
+    std::minstd_rand rng;
+
 };
 
 #endif // GLOBALMATCHER_H
\ No newline at end of file
@@ -1,9 +1,39 @@
 #include "LocalMatcher.h"
+#include "Trace.h"
 
 using namespace cv;
 
+/// Gray level of offsets in the disparity image: scaled to [0,255]
+static void OffsetsToColor(const Mat &offset, int search_scope, Mat &disparity) {
+    for (int y = 0; y < offset.rows; ++y) {
+        for (int x = 0; x < offset.cols; ++x) {
+            int doff = offset.at<short>(y, x);
+            if (doff >= 0) {
+                doff = doff * 255 / search_scope;
+                disparity.at<Vec3b>(y, x) = Vec3b(doff, doff, doff);
+            }
+        }
+    }
+}
+
 void LocalMatcher::LocalMatchingSAD(Mat &img1, Mat &img2, int window_size,
                                     int search_scope, Mat &disparity) {
+    Mat offset(img1.rows, img1.cols, CV_16SC1);
+    SearchSAD(img1, img2, window_size, search_scope, offset);
+    OffsetsToColor(offset, search_scope, disparity);
+}
+
+void LocalMatcher::LocalMatchingNCC(Mat &img1, Mat &img2, int window_size,
+                                    int search_scope, Mat &disparity) {
+    Mat offset(img1.rows, img1.cols, CV_16SC1);
+    SearchNCC(img1, img2, window_size, search_scope, offset);
+    OffsetsToColor(offset, search_scope, disparity);
+}
+
+void LocalMatcher::SearchSAD(const Mat &img1, const Mat &img2, int window_size,
+                             int search_scope, Mat &offset) {
+    TraceSpan span("SAD search");
+    offset.setTo(Scalar(-1));
     const int width = img1.cols;
     const int height = img1.rows;
     int N = window_size;
@@ -36,15 +66,55 @@ void LocalMatcher::LocalMatchingSAD(Mat &img1, Mat &img2, int window_size,
                     min_doff = doff;
                 }
             }
-            min_doff  = min_doff * 255 / search_scope;
-            disparity.at<Vec3b>(y + N / 2, x + N / 2) = Vec3b(min_doff, min_doff, min_doff);
+            offset.at<short>(y + N / 2, x + N / 2) = (short)min_doff;
         }
     }
 }
 
 
-void LocalMatcher::LocalMatchingNCC(Mat &img1, Mat &img2, int window_size,
-                                    int search_scope, Mat &disparity) {
+/// Number of bits set in \a v
+static inline int BitCount(unsigned int v) {
+    v = v - ((v >> 1) & 0x55555555u);
+    v = (v & 0x33333333u) + ((v >> 2) & 0x33333333u);
+    return (int)((((v + (v >> 4)) & 0x0F0F0F0Fu) * 0x01010101u) >> 24);
+}
+
+void LocalMatcher::SearchCensus(const Mat &census1, const Mat &census2,
+                                int window_size, int search_scope,
+                                Mat &offset) {
+    TraceSpan span("census search");
+    offset.setTo(Scalar(-1));
+    const int width = census1.cols;
+    const int height = census1.rows;
+    int N = window_size;
+
+    for (int y = 0; y < height - N; ++y) {
+        for (int x = search_scope; x < width - N; ++x) {
+            int min_sum = 32 * N * N;
+            int min_doff = 0;
+            for (int doff = 0; doff < search_scope; ++doff) {
+                int sum = 0;
+                for (int j = y; j < y + N; ++j) {
+                    const int *c1 = census1.ptr<int>(j);
+                    const int *c2 = census2.ptr<int>(j);
+                    for (int i = x; i < x + N; ++i) {
+                        sum += BitCount((unsigned int)(c1[i] ^ c2[i - doff]));
+                    }
+                }
+                if (sum < min_sum) {
+                    min_sum = sum;
+                    min_doff = doff;
+                }
+            }
+            offset.at<short>(y + N / 2, x + N / 2) = (short)min_doff;
+        }
+    }
+}
+
+void LocalMatcher::SearchNCC(const Mat &img1, const Mat &img2, int window_size,
+                             int search_scope, Mat &offset) {
+    TraceSpan span("NCC search");
+    offset.setTo(Scalar(-1));
     const int width = img1.cols;
     const int height = img1.rows;
     int N = window_size;
@@ -85,8 +155,7 @@ void LocalMatcher::LocalMatchingNCC(Mat &img1, Mat &img2, int window_size,
                     max_doff = doff;
                 }
             }
-            max_doff = max_doff * 255 / search_scope;
-            disparity.at<Vec3b>(y + N / 2, x + N / 2) = Vec3b(max_doff, max_doff, max_doff);
+            offset.at<short>(y + N / 2, x + N / 2) = (short)max_doff;
 
         }
     }
@@ -9,5 +9,16 @@ class LocalMatcher {
 
     void LocalMatchingNCC(cv::Mat &img1, cv::Mat &img2, int window_size,
                           int search_scope, cv::Mat &disparity);
+
+    /// Same searches, \a offset (CV_16SC1, allocated) getting the offset doff
+    /// of the best match img2(x - doff) of each window center, -1 elsewhere.
+    void SearchSAD(const cv::Mat &img1, const cv::Mat &img2, int window_size,
+                   int search_scope, cv::Mat &offset);
+    void SearchNCC(const cv::Mat &img1, const cv::Mat &img2, int window_size,
+                   int search_scope, cv::Mat &offset);
+    /// Same search on census transforms (CV_32SC1, see RectifyTransformView),
+    /// summing Hamming distances over the window.
+    void SearchCensus(const cv::Mat &census1, const cv::Mat &census2,
+                      int window_size, int search_scope, cv::Mat &offset);
 };
 #endif  // LOCAL_MATCHER_H_
\ No newline at end of file
@@ -0,0 +1,148 @@
+#include "RectifyTransform.h"
+
+#include <algorithm>
+#include "Match.h"
+
+using namespace std;
+using namespace cv;
+
+/// Bits of the fractional part of map coordinates (cv::INTER_BITS)
+static const int MAP_BITS = 5;
+static const int MAP_SIZE = 1 << MAP_BITS;
+
+/// Pixel of \a src, 0 outside (constant border, like cv::remap)
+static inline int Pixel(const Mat &src, int x, int y) {
+    if (x < 0 || y < 0 || x >= src.cols || y >= src.rows) {
+        return 0;
+    }
+    return src.ptr<uchar>(y)[x];
+}
+
+/// Remap row \a y of the maps into row \a dstRow of \a dst with fixed-point
+/// bilinear interpolation. \a src holds the rows of the view from \a srcY0.
+static void RemapRow(const Mat &src, int srcY0, const Mat &map1,
+                     const Mat &map2, int y, Mat &dst, int dstRow) {
+    const short *xy = map1.ptr<short>(y);
+    const ushort *frac = map2.ptr<ushort>(y);
+    uchar *out = dst.ptr<uchar>(dstRow);
+    const int w = 2 * MAP_BITS, half = 1 << (w - 1);
+    for (int x = 0; x < dst.cols; ++x) {
+        const int sx = xy[2 * x], sy = xy[2 * x + 1] - srcY0;
+        const int fx = frac[x] & (MAP_SIZE - 1), fy = frac[x] >> MAP_BITS;
+        int v;
+        if (sx >= 0 && sy >= 0 && sx + 1 < src.cols && sy + 1 < src.rows) {
+            const uchar *p = src.ptr<uchar>(sy) + sx;
+            const uchar *q = p + src.step;
+            v = (p[0] * (MAP_SIZE - fx) + p[1] * fx) * (MAP_SIZE - fy) +
+                (q[0] * (MAP_SIZE - fx) + q[1] * fx) * fy;
+        } else {
+            v = (Pixel(src, sx, sy) * (MAP_SIZE - fx) +
+                 Pixel(src, sx + 1, sy) * fx) * (MAP_SIZE - fy) +
+                (Pixel(src, sx, sy + 1) * (MAP_SIZE - fx) +
+                 Pixel(src, sx + 1, sy + 1) * fx) * fy;
+        }
+        out[x] = (uchar)((v + half) >> w);
+    }
+}
+
+/// 5x5 census of row \a y, replicated border
+static void CensusRow(const Mat &im, Mat &out, int y) {
+    const int n = im.cols, m = im.rows;
+    const uchar *rows[5];
+    for (int j = 0; j < 5; ++j) {
+        rows[j] = im.ptr<uchar>(min(max(y + j - 2, 0), m - 1));
+    }
+    int *c = out.ptr<int>(y);
+    for (int x = 0; x < n; ++x) {
+        const int I = rows[2][x];
+        int bits = 0;
+        for (int j = 0; j < 5; ++j)
+            for (int i = -2; i <= 2; ++i) {
+                if (j == 2 && i == 0) {
+                    continue;
+                }
+                bits = (bits << 1) | (rows[j][min(max(x + i, 0), n - 1)] < I);
+            }
+        c[x] = bits;
+    }
+}
+
+/// Birchfield-Tomasi range of row \a y, by the row function of Match
+static void BTRow(const Mat &im, Mat &outMin, Mat &outMax, int y) {
+    SubPixelRow(im.ptr<uchar>(y > 0 ? y - 1 : y), im.ptr<uchar>(y),
+                im.ptr<uchar>(y + 1 < im.rows ? y + 1 : y),
+                outMin.ptr<uchar>(y), outMax.ptr<uchar>(y), im.cols, 1);
+}
+
+void RectifyTransformView(const Mat &view, const Mat &map1, const Mat &map2,
+                          RowTransform transform, TransformedView &out,
+                          int bandRows) {
+    CV_Assert(view.type() == CV_8UC1);
+    const bool remap = !map1.empty();
+    const Size size = remap ? map1.size() : view.size();
+    const int height = size.height;
+    // Rows of the view around a row needed by the transform
+    const int halo = (transform == TRANSFORM_CENSUS) ? 2 :
+                     (transform == TRANSFORM_BT) ? 1 : 0;
+
+    if (remap) {
+        CV_Assert(map1.type() == CV_16SC2 && map2.type() == CV_16UC1);
+        out.image.create(size, CV_8UC1);
+    } else {
+        out.image = view;
+    }
+    out.transform.release();
+    out.max.release();
+    if (transform == TRANSFORM_CENSUS) {
+        out.transform.create(size, CV_32SC1);
+    }
+    if (transform == TRANSFORM_BT) {
+        out.transform.create(size, CV_8UC1);
+        out.max.create(size, CV_8UC1);
+    }
+
+    bandRows = max(bandRows, 1);
+    int remapped = remap ? 0 : height; // rows of out.image done
+    for (int y0 = 0; y0 < height; y0 += bandRows) {
+        const int y1 = min(y0 + bandRows, height);
+        for (; remapped < min(y1 + halo, height); ++remapped) {
+            RemapRow(view, 0, map1, map2, remapped, out.image, remapped);
+        }
+        for (int y = y0; y < y1; ++y) {
+            switch (transform) {
+            case TRANSFORM_CENSUS:
+                CensusRow(out.image, out.transform, y);
+                break;
+            case TRANSFORM_BT:
+                BTRow(out.image, out.transform, out.max, y);
+                break;
+            default:
+                break;
+            }
+        }
+    }
+}
+
+void RemapSourceRows(const Mat &map1, int y0, int y1, int height,
+                     int *first, int *last) {
+    int lo = height, hi = 0;
+    for (int y = y0; y < y1; ++y) {
+        const short *xy = map1.ptr<short>(y);
+        for (int x = 0; x < map1.cols; ++x) {
+            lo = min(lo, (int)xy[2 * x + 1]);
+            hi = max(hi, xy[2 * x + 1] + 2);
+        }
+    }
+    *first = max(lo, 0);
+    *last = max(min(hi, height), *first);
+}
+
+void RemapRows(const Mat &src, int srcY0, const Mat &map1, const Mat &map2,
+               int y0, int y1, Mat &dst) {
+    CV_Assert(src.type() == CV_8UC1 && map1.type() == CV_16SC2 &&
+              map2.type() == CV_16UC1);
+    dst.create(y1 - y0, map1.cols, CV_8UC1);
+    for (int y = y0; y < y1; ++y) {
+        RemapRow(src, srcY0, map1, map2, y, dst, y - y0);
+    }
+}
@@ -0,0 +1,40 @@
+#ifndef RECTIFY_TRANSFORM_H_
+#define RECTIFY_TRANSFORM_H_
+
+#include "opencv2/opencv.hpp"
+
+/// Per-pixel transform of a matcher, applied right after remapping.
+enum RowTransform {
+    TRANSFORM_NONE,   ///< rectified view only
+    TRANSFORM_CENSUS, ///< 5x5 census, 24 bits (neighbor < center)
+    TRANSFORM_BT      ///< Birchfield-Tomasi range, as in Match
+};
+
+/// Rectified gray view with the transform of a matcher.
+struct TransformedView {
+    cv::Mat image;     ///< rectified view (CV_8UC1)
+    cv::Mat transform; ///< census (CV_32SC1) or BT min (CV_8UC1)
+    cv::Mat max;       ///< BT max (CV_8UC1)
+};
+
+/// Remap gray \a view with fixed-point maps (\a map1 CV_16SC2, \a map2
+/// CV_16UC1, as from initUndistortRectifyMap) by bilinear interpolation, and
+/// apply \a transform, band of \a bandRows rows after band so that the
+/// rectified rows are still in cache when transformed. Empty maps mean no
+/// remapping.
+void RectifyTransformView(const cv::Mat &view, const cv::Mat &map1,
+                          const cv::Mat &map2, RowTransform transform,
+                          TransformedView &out, int bandRows = 32);
+
+/// Rows [\a first, \a last) of a view of \a height rows read when remapping
+/// rows [\a y0, \a y1) with \a map1.
+void RemapSourceRows(const cv::Mat &map1, int y0, int y1, int height,
+                     int *first, int *last);
+
+/// Remap rows [\a y0, \a y1) of the maps into \a dst, from \a src holding
+/// the rows of the view from \a srcY0 on (at least those given by
+/// RemapSourceRows). Same result as RectifyTransformView on these rows.
+void RemapRows(const cv::Mat &src, int srcY0, const cv::Mat &map1,
+               const cv::Mat &map2, int y0, int y1, cv::Mat &dst);
+
+#endif  // RECTIFY_TRANSFORM_H_
@@ -0,0 +1,273 @@
+#include "StereoMatcher.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <limits>
+#include <thread>
+#ifdef HAS_PNG
+#include "io_png.h"
+#endif
+#include "io_pnm.h"
+#ifdef HAS_TIFF
+#include "io_tiff.h"
+#endif
+#include "Trace.h"
+
+using namespace std;
+using namespace cv;
+
+unique_ptr<StereoMatcher> StereoMatcher::Create(const string &name) {
+    if (name == "sad") {
+        return unique_ptr<StereoMatcher>(new LocalStereoMatcher(LocalStereoMatcher::SAD));
+    }
+    if (name == "ncc") {
+        return unique_ptr<StereoMatcher>(new LocalStereoMatcher(LocalStereoMatcher::NCC));
+    }
+    if (name == "census") {
+        return unique_ptr<StereoMatcher>(new LocalStereoMatcher(LocalStereoMatcher::CENSUS));
+    }
+    if (name == "gc") {
+        return unique_ptr<StereoMatcher>(new GraphCutStereoMatcher);
+    }
+    return unique_ptr<StereoMatcher>();
+}
+
+void StereoMatcher::Configure(const MatcherConfig &config) {
+    this->config = config;
+}
+
+bool StereoMatcher::CheckViews(const Mat &left, const Mat &right,
+                               const Mat &disparity) const {
+    if (left.type() != CV_8UC1 || right.type() != CV_8UC1 ||
+        left.rows != right.rows || disparity.type() != CV_32FC1 ||
+        disparity.size() != left.size() || config.dMin > config.dMax) {
+        cerr << "Error: " << Name() << " matcher got views or disparity of "
+             << "wrong type or size" << endl;
+        return false;
+    }
+    return true;
+}
+
+bool StereoMatcher::Match(const Mat &left, const Mat &right, Mat &disparity) {
+    if (!CheckViews(left, right, disparity)) {
+        return false;
+    }
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    TraceSpan span(Name());
+    const RowTransform transform = Transform();
+    const Mat none;
+    if (transform == TRANSFORM_NONE) {
+        views[0].image = left;
+        views[1].image = right;
+    } else if (config.threads == 1) {
+        RectifyTransformView(left, none, none, transform, views[0]);
+        RectifyTransformView(right, none, none, transform, views[1]);
+    } else { // Views in parallel, without remapping
+        thread rightView([&]() {
+            RectifyTransformView(right, none, none, transform, views[1]);
+        });
+        RectifyTransformView(left, none, none, transform, views[0]);
+        rightView.join();
+    }
+    Compute(views[0], views[1], disparity);
+    // Transforms are kept for the next pair, not the views of the caller
+    views[0].image.release();
+    views[1].image.release();
+    span.End();
+    UpdateStats(chrono::duration<double>(chrono::steady_clock::now() -
+                                         start).count(), disparity);
+    return true;
+}
+
+/// Whether \a view has the \a transform of its image
+static bool HasTransform(const TransformedView &view, RowTransform transform) {
+    const Size size = view.image.size();
+    switch (transform) {
+    case TRANSFORM_CENSUS:
+        return view.transform.type() == CV_32SC1 &&
+               view.transform.size() == size;
+    case TRANSFORM_BT:
+        return view.transform.type() == CV_8UC1 &&
+               view.transform.size() == size &&
+               view.max.type() == CV_8UC1 && view.max.size() == size;
+    default:
+        return true;
+    }
+}
+
+bool StereoMatcher::Match(const TransformedView &left,
+                          const TransformedView &right, Mat &disparity) {
+    if (!CheckViews(left.image, right.image, disparity)) {
+        return false;
+    }
+    if (!HasTransform(left, Transform()) || !HasTransform(right, Transform())) {
+        cerr << "Error: " << Name() << " matcher got views without its "
+             << "transform" << endl;
+        return false;
+    }
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    TraceSpan span(Name());
+    Compute(left, right, disparity);
+    span.End();
+    UpdateStats(chrono::duration<double>(chrono::steady_clock::now() -
+                                         start).count(), disparity);
+    return true;
+}
+
+void StereoMatcher::UpdateStats(double seconds, const Mat &disparity) {
+    stats.seconds = seconds;
+    stats.pixels = (size_t)disparity.total();
+    stats.matched = 0;
+    for (int y = 0; y < disparity.rows; ++y) {
+        const float *d = disparity.ptr<float>(y);
+        for (int x = 0; x < disparity.cols; ++x) {
+            stats.matched += !std::isnan(d[x]);
+        }
+    }
+    stats.expansions = 0;
+    stats.buildSeconds = 0;
+    stats.solver.reset();
+    AddSolverStats(stats);
+    ++stats.calls;
+}
+
+void LocalStereoMatcher::Compute(const TransformedView &left_view,
+                                 const TransformedView &right_view,
+                                 Mat &disparity) {
+    // Census is compared instead of gray levels
+    const Mat &left = cost == CENSUS ? left_view.transform : left_view.image;
+    const Mat &right = cost == CENSUS ? right_view.transform : right_view.image;
+    const float NaN = numeric_limits<float>::quiet_NaN();
+    disparity.setTo(Scalar(NaN));
+    if (right.cols != left.cols) {
+        cerr << "Error: " << Name() << " matcher needs views of same size"
+             << endl;
+        return;
+    }
+    // LocalMatcher compares img1(x) with img2(x - doff), 0 <= doff < search:
+    // shift the right view by dMax so that d = dMax - doff
+    const int dMax = config.dMax, w = right.cols - abs(dMax);
+    if (dMax == 0) {
+        shifted = right;
+    } else {
+        shifted.create(right.size(), right.type());
+        shifted.setTo(Scalar(0));
+        if (w > 0) {
+            right(Rect(max(dMax, 0), 0, w, right.rows))
+            .copyTo(shifted(Rect(max(-dMax, 0), 0, w, right.rows)));
+        }
+    }
+    const int search = config.dMax - config.dMin + 1;
+    offset.create(left.size(), CV_16SC1);
+    if (cost == SAD) {
+        matcher.SearchSAD(left, shifted, config.windowSize, search, offset);
+    } else if (cost == NCC) {
+        matcher.SearchNCC(left, shifted, config.windowSize, search, offset);
+    } else {
+        matcher.SearchCensus(left, shifted, config.windowSize, search, offset);
+    }
+    for (int y = 0; y < left.rows; ++y) {
+        const short *doff = offset.ptr<short>(y);
+        float *d = disparity.ptr<float>(y);
+        for (int x = 0; x < left.cols; ++x)
+            if (doff[x] >= 0) {
+                d[x] = (float)(dMax - doff[x]);
+            }
+    }
+}
+
+void GraphCutStereoMatcher::Configure(const MatcherConfig &config) {
+    StereoMatcher::Configure(config);
+    matcher.SetOcclusionCost(-1);
+    matcher.CollectSolverStats(config.solverStats);
+    matcher.SetThreads(config.threads);
+    matcher.SetSeed(config.seed);
+}
+
+void GraphCutStereoMatcher::Compute(const TransformedView &left,
+                                    const TransformedView &right,
+                                    Mat &disparity) {
+    // GlobalMatcher takes views as non-const headers, left untouched. Their
+    // Birchfield-Tomasi ranges are used as they are.
+    TransformedView left_view = left, right_view = right;
+    matcher.run(left_view, right_view, config.dMin, config.dMax, output,
+                &disp, &occl);
+    disp.convertTo(disparity, CV_32F);
+    disparity.setTo(Scalar(numeric_limits<float>::quiet_NaN()), occl);
+    if (config.reuseCost) {
+        matcher.SetOcclusionCost(matcher.OcclusionCost());
+    }
+}
+
+void GraphCutStereoMatcher::AddSolverStats(MatcherStats &stats) const {
+    const vector<Match::ExpansionStats> &moves = matcher.SolverStats();
+    for (size_t i = 0; i < moves.size(); ++i) {
+        stats.buildSeconds += moves[i].buildSeconds;
+        stats.solver.add(moves[i].solver);
+    }
+    stats.expansions += moves.size();
+}
+
+static bool HasExtension(const string &filename, const string &ext) {
+    return filename.size() > ext.size() &&
+           filename.compare(filename.size() - ext.size(), ext.size(), ext) == 0;
+}
+
+bool SaveDisparity(const string &filename, const Mat &disparity) {
+    TraceSpan span("save disparity");
+    int ret = -1;
+    if (HasExtension(filename, ".tif") || HasExtension(filename, ".tiff")) {
+#ifdef HAS_TIFF
+        Mat d = disparity.isContinuous() ? disparity : disparity.clone();
+        ret = io_tiff_write_f32(filename.c_str(), d.ptr<float>(), d.cols,
+                                d.rows, 1);
+#else
+        cerr << "Unable to save file " << filename << " as TIFF since the "
+             << "program was built without TIFF support" << endl;
+        return false;
+#endif
+    } else if (HasExtension(filename, ".pfm")) {
+        ret = io_pnm_write_pfm(filename.c_str(), disparity.ptr<float>(),
+                               disparity.cols, disparity.rows, disparity.step);
+    } else {
+#ifdef HAS_PNG
+        // Non-positive disparities (right x = left x + d) are negated
+        bool negative = false, positive = false;
+        for (int y = 0; y < disparity.rows; ++y) {
+            const float *d = disparity.ptr<float>(y);
+            for (int x = 0; x < disparity.cols; ++x) {
+                negative = negative || d[x] < 0;
+                positive = positive || d[x] > 0;
+            }
+        }
+        if (negative && positive) {
+            cerr << "Error: disparities of both signs do not fit in 16-bit "
+                 << "PNG " << filename << endl;
+            return false;
+        }
+        const float scale = negative ? -256.0f : 256.0f;
+        Mat u16(disparity.size(), CV_16UC1);
+        for (int y = 0; y < disparity.rows; ++y) {
+            const float *d = disparity.ptr<float>(y);
+            ushort *out = u16.ptr<ushort>(y);
+            for (int x = 0; x < disparity.cols; ++x) {
+                out[x] = std::isnan(d[x]) ? 0 :
+                         (ushort)min(d[x] * scale + 0.5f, 65535.0f);
+            }
+        }
+        ret = io_png_write_u16_gray(filename.c_str(), u16.ptr<ushort>(),
+                                    u16.step, u16.cols,
+                                    u16.rows, NULL);
+#else
+        cerr << "Unable to save file " << filename << " as PNG since the "
+             << "program was built without PNG support" << endl;
+        return false;
+#endif
+    }
+    if (ret != 0) {
+        cerr << "Error writing file " << filename << endl;
+    }
+    return ret == 0;
+}
@@ -0,0 +1,141 @@
+#ifndef STEREO_MATCHER_H_
+#define STEREO_MATCHER_H_
+
+#include <memory>
+#include <string>
+#include "opencv2/opencv.hpp"
+#include "GlobalMatcher.h"
+#include "LocalMatcher.h"
+#include "RectifyTransform.h"
+
+/// Parameters of a matcher.
+struct MatcherConfig {
+    int dMin, dMax;  ///< disparity range, right x = left x + d
+    int windowSize;  ///< window of local matchers (odd)
+    bool reuseCost;  ///< GC: keep the occlusion cost of the first pair
+    bool solverStats; ///< GC: collect max-flow statistics, slower
+    int threads;     ///< threads of a match, 0 for one per core
+    /// GC: seed of the random order of expansions, reset by Configure
+    unsigned int seed;
+    MatcherConfig() : dMin(-16), dMax(0), windowSize(9), reuseCost(false),
+        solverStats(false), threads(0), seed(1) {}
+};
+
+/// Statistics of a matcher.
+struct MatcherStats {
+    double seconds;  ///< wall time of the last match
+    size_t pixels;   ///< pixels of the last left view
+    size_t matched;  ///< pixels of the last left view with a disparity
+    size_t calls;    ///< matches since creation
+    /// GC with MatcherConfig::solverStats: expansion moves of the last match,
+    /// time building their graphs and their max-flow statistics summed.
+    size_t expansions;
+    double buildSeconds;
+    GraphStats solver;
+    MatcherStats() : seconds(0), pixels(0), matched(0), calls(0),
+        expansions(0), buildSeconds(0) {}
+};
+
+/// Disparity of rectified gray views, without user interface. A matcher keeps
+/// its buffers, and its state if configured to, from one pair to the next.
+class StereoMatcher {
+  public:
+    virtual ~StereoMatcher() {}
+
+    /// Matcher "sad", "ncc", "census" or "gc", null for another name.
+    static std::unique_ptr<StereoMatcher> Create(const std::string &name);
+    virtual const char *Name() const = 0;
+    /// Transform of the views read by the matcher, best computed along with
+    /// rectification (see StereoRectifier::RectifyTransform).
+    virtual RowTransform Transform() const {
+        return TRANSFORM_NONE;
+    }
+    /// Whether the disparity of a pixel depends only on the window around
+    /// it, so that views can be matched in overlapping strips.
+    virtual bool Local() const {
+        return false;
+    }
+
+    virtual void Configure(const MatcherConfig &config);
+    const MatcherConfig &Config() const {
+        return config;
+    }
+
+    /// Disparity of \a left (CV_8UC1) against \a right into \a disparity,
+    /// allocated by the caller (CV_32FC1, size of \a left): d such that
+    /// right x = left x + d, NaN where unknown. False if types or sizes do
+    /// not fit. The transform of the views is computed here.
+    bool Match(const cv::Mat &left, const cv::Mat &right, cv::Mat &disparity);
+    /// Same on views already having the transform of the matcher.
+    bool Match(const TransformedView &left, const TransformedView &right,
+               cv::Mat &disparity);
+
+    const MatcherStats &Stats() const {
+        return stats;
+    }
+  protected:
+    StereoMatcher() {}
+    virtual void Compute(const TransformedView &left,
+                         const TransformedView &right, cv::Mat &disparity) = 0;
+    /// Add the solver statistics of the last Compute() to \a stats, if any.
+    virtual void AddSolverStats(MatcherStats &) const {}
+
+    MatcherConfig config;
+  private:
+    bool CheckViews(const cv::Mat &left, const cv::Mat &right,
+                    const cv::Mat &disparity) const;
+    void UpdateStats(double seconds, const cv::Mat &disparity);
+
+    MatcherStats stats;
+    TransformedView views[2]; ///< buffers of Match on plain views
+};
+
+/// Window matchers of LocalMatcher.
+class LocalStereoMatcher : public StereoMatcher {
+  public:
+    enum Cost { SAD, NCC, CENSUS };
+    explicit LocalStereoMatcher(Cost cost) : cost(cost) {}
+    const char *Name() const {
+        return cost == SAD ? "sad" : cost == NCC ? "ncc" : "census";
+    }
+    RowTransform Transform() const {
+        return cost == CENSUS ? TRANSFORM_CENSUS : TRANSFORM_NONE;
+    }
+    bool Local() const {
+        return true;
+    }
+  protected:
+    void Compute(const TransformedView &left, const TransformedView &right,
+                 cv::Mat &disparity);
+  private:
+    Cost cost;
+    LocalMatcher matcher;
+    cv::Mat shifted, offset; ///< buffers kept between pairs
+};
+
+/// Graph cuts matcher of GlobalMatcher.
+class GraphCutStereoMatcher : public StereoMatcher {
+  public:
+    const char *Name() const {
+        return "gc";
+    }
+    RowTransform Transform() const {
+        return TRANSFORM_BT;
+    }
+    void Configure(const MatcherConfig &config);
+  protected:
+    void Compute(const TransformedView &left, const TransformedView &right,
+                 cv::Mat &disparity);
+    void AddSolverStats(MatcherStats &stats) const;
+  private:
+    GlobalMatcher matcher;
+    cv::Mat output, disp, occl; ///< buffers kept between pairs
+};
+
+/// Save float disparities \a disparity (NaN where unknown) to \a filename, by
+/// extension: .tif/.tiff float TIFF, .pfm, others KITTI 16-bit PNG of 256 * d
+/// (0 where unknown), like Match::SaveDisparity16. Non-positive disparities
+/// are negated in PNG, which cannot hold both signs.
+bool SaveDisparity(const std::string &filename, const cv::Mat &disparity);
+
+#endif  // STEREO_MATCHER_H_
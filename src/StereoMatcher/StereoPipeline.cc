@@ -0,0 +1,125 @@
+#include "StereoPipeline.h"
+#include "Image.h"
+#include "Trace.h"
+
+using namespace std;
+using namespace cv;
+
+Mat LoadViewScaled(const string &filename, int flags, int denom) {
+    if (denom == 1) {
+        return imread(filename, flags);
+    }
+    const bool gray = (flags == IMREAD_GRAYSCALE);
+    GeneralImage im = (GeneralImage)imLoadScaled(gray ? IMAGE_GRAY : IMAGE_RGB,
+                      filename.c_str(), denom);
+    Mat view;
+    if (im) {
+        Mat wrap(imGetYSize(im), imGetXSize(im), gray ? CV_8UC1 : CV_8UC3,
+                 im->data, imGetStride(im));
+        if (gray) {
+            wrap.copyTo(view);
+        } else {
+            cvtColor(wrap, view, COLOR_RGB2BGR);
+        }
+        imFree(im);
+    }
+    return view;
+}
+
+AsyncPairLoader::AsyncPairLoader(const vector<StereoPairFiles> &pairs,
+                                 size_t capacity, int flags, int denom)
+    : pairs(pairs), capacity(max(capacity, (size_t)1)), flags(flags),
+      denom(denom), stopped(false), done(false) {
+    producer = thread(&AsyncPairLoader::Produce, this);
+}
+
+AsyncPairLoader::~AsyncPairLoader() {
+    {
+        lock_guard<std::mutex> lock(mutex);
+        stopped = true;
+    }
+    notFull.notify_all();
+    producer.join();
+}
+
+void AsyncPairLoader::Produce() {
+    for (size_t i = 0; i < pairs.size(); ++i) {
+        {
+            // Room for the pair before decoding it, so that at most capacity
+            // pairs are held ahead of the consumer, the one decoded included.
+            // Only this thread adds pairs: the room stays.
+            unique_lock<std::mutex> lock(mutex);
+            notFull.wait(lock, [this]() {
+                return stopped || queue.size() < capacity;
+            });
+            if (stopped) {
+                return;
+            }
+        }
+        StereoFrame frame;
+        frame.index = i;
+        frame.files = pairs[i];
+        thread right([&frame, this]() {
+            TraceSpan span("load view");
+            frame.right = LoadViewScaled(frame.files.right, flags, denom);
+        });
+        {
+            TraceSpan span("load view");
+            frame.left = LoadViewScaled(frame.files.left, flags, denom);
+        }
+        right.join();
+
+        lock_guard<std::mutex> lock(mutex);
+        if (stopped) {
+            return;
+        }
+        queue.push_back(std::move(frame));
+        notEmpty.notify_one();
+    }
+    lock_guard<std::mutex> lock(mutex);
+    done = true;
+    notEmpty.notify_all();
+}
+
+bool AsyncPairLoader::Next(StereoFrame &frame) {
+    unique_lock<std::mutex> lock(mutex);
+    notEmpty.wait(lock, [this]() {
+        return done || !queue.empty();
+    });
+    if (queue.empty()) {
+        return false;
+    }
+    frame = std::move(queue.front());
+    queue.pop_front();
+    notFull.notify_one();
+    return true;
+}
+
+StereoPipeline::StereoPipeline(const vector<StereoPairFiles> &pairs,
+                               size_t queueSize, int flags, int denom,
+                               RowTransform transform)
+    : pairs(pairs), queueSize(queueSize), flags(flags), denom(denom),
+      transform(transform) {}
+
+void StereoPipeline::Run(const Consumer &consume) {
+    AsyncPairLoader loader(pairs, queueSize, flags, denom);
+    StereoFrame frame;
+    while (loader.Next(frame)) {
+        if (!frame.left.empty() && !frame.right.empty()) {
+            // Maps of full size views do not apply to previews
+            const string calib = denom == 1 ? frame.files.calib : string();
+            if (flags == IMREAD_GRAYSCALE) {
+                rectifier.RectifyTransform(calib, frame.left, frame.right,
+                                           transform, frame.transformed[0],
+                                           frame.transformed[1]);
+                frame.left = frame.transformed[0].image;
+                frame.right = frame.transformed[1].image;
+                hconcat(frame.left, frame.right, frame.stereo);
+            } else {
+                rectifier.StereoRectify(calib, frame.left, frame.right,
+                                        frame.stereo);
+            }
+        }
+        consume(frame);
+    }
+}
@@ -0,0 +1,92 @@
+#ifndef STEREO_PIPELINE_H_
+#define STEREO_PIPELINE_H_
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "opencv2/opencv.hpp"
+#include "StereoRectifier.h"
+
+/// Files of a stereo pair. The calibration file may not exist, then the views
+/// are used as they are.
+struct StereoPairFiles {
+    std::string left, right, calib;
+};
+
+/// Stereo pair going through the pipeline.
+struct StereoFrame {
+    size_t index;       ///< rank of the pair in the sequence
+    StereoPairFiles files;
+    cv::Mat left, right; ///< views, empty if they could not be read
+    cv::Mat stereo;     ///< both views side by side, after rectification
+    /// Gray views with the transform of the pipeline, computed along with
+    /// rectification; their images are \a left and \a right.
+    TransformedView transformed[2];
+};
+
+/// View of \a filename (\a flags of cv::imread) at 1/\a denom of its size,
+/// rounded up (\a denom = 1, 2, 4 or 8). A JPEG file is decoded directly at
+/// that size (see imLoadScaled). Empty if the file cannot be read.
+cv::Mat LoadViewScaled(const std::string &filename, int flags, int denom);
+
+/// Load stereo pairs in a background thread, both views of a pair being
+/// decoded in parallel. Up to \a capacity pairs are decoded ahead of the
+/// consumer; the loader then waits until one is taken. Views are reduced by
+/// \a denom (see LoadViewScaled).
+class AsyncPairLoader {
+  public:
+    AsyncPairLoader(const std::vector<StereoPairFiles> &pairs,
+                    size_t capacity = 2, int flags = cv::IMREAD_GRAYSCALE,
+                    int denom = 1);
+    ~AsyncPairLoader();
+
+    /// Wait for the next pair, return false after the last one.
+    bool Next(StereoFrame &frame);
+  private:
+    void Produce();
+
+    std::vector<StereoPairFiles> pairs;
+    size_t capacity;
+    int flags, denom;
+    std::deque<StereoFrame> queue;
+    std::mutex mutex;
+    std::condition_variable notFull, notEmpty;
+    bool stopped, done;
+    std::thread producer;
+};
+
+/// Load, rectify and hand over stereo pairs to a matcher, loading of the next
+/// pairs overlapping the processing of the current one.
+class StereoPipeline {
+  public:
+    /// Processing of a rectified pair, typically a matcher.
+    typedef std::function<void(StereoFrame &frame)> Consumer;
+
+    /// With \a denom > 1, views are previews at 1/\a denom of their size
+    /// (see LoadViewScaled), not rectified: the calibration is that of full
+    /// size views. Gray views are rectified along with \a transform,
+    /// typically StereoMatcher::Transform() of the consumer.
+    StereoPipeline(const std::vector<StereoPairFiles> &pairs,
+                   size_t queueSize = 2, int flags = cv::IMREAD_GRAYSCALE,
+                   int denom = 1, RowTransform transform = TRANSFORM_NONE);
+
+    /// Run \a consume on each pair, in sequence order.
+    void Run(const Consumer &consume);
+
+    /// Rectifier of the pairs, holding the valid region of the last one.
+    const StereoRectifier &Rectifier() const {
+        return rectifier;
+    }
+  private:
+    std::vector<StereoPairFiles> pairs;
+    size_t queueSize;
+    int flags, denom;
+    RowTransform transform;
+    StereoRectifier rectifier;
+};
+
+#endif  // STEREO_PIPELINE_H_
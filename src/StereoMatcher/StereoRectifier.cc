@@ -1,13 +1,41 @@
 #include "StereoRectifier.h"
+#include "Trace.h"
 
+#include <sys/stat.h>
+#include <cstring>
 #include <fstream>
 #include <istream>
+#include <iterator>
 #include <streambuf>
+#include <thread>
 #include <vector>
 
 using namespace std;
 using namespace cv;
 
+/// Tag of the binary file of maps
+static const char MAP_FILE_MAGIC[8] = { 'S', 'R', 'M', 'A', 'P', 'S', '0', '2' };
+/// Written in native byte order after the tag: the file is read only on a
+/// machine of the same byte order.
+static const unsigned int MAP_FILE_BYTE_ORDER = 0x01020304;
+
+StereoRectifier::StereoRectifier(bool cacheMaps)
+    : cacheMaps(cacheMaps), rectified(false), valid(false), calibTime(0),
+      calibHash(0) {}
+
+void StereoRectifier::SetMapFile(const string &filename) {
+    mapFile = filename;
+}
+
+/// 64-bit FNV-1a hash of \a data
+static unsigned long long HashBytes(const vector<char> &data) {
+    unsigned long long h = 14695981039346656037ULL;
+    for (size_t i = 0; i < data.size(); ++i) {
+        h = (h ^ (unsigned char)data[i]) * 1099511628211ULL;
+    }
+    return h;
+}
+
 void StereoRectifier::ReadParam(const string &filename, Mat &cam_matrix,
                                 Mat *left_RT, Mat *right_RT) {
     ifstream ifs(filename);
@@ -47,7 +75,24 @@ void StereoRectifier::Rectify(const Mat &left_view, const Mat &right_view,
                               const Mat &left_RT, const Mat &right_RT,
                               Mat *view_rect_l, Mat *view_rect_r,
                               Rect *roi_l, Rect *roi_r) {
-    // Compute RT
+    ComputeMaps(left_view.size(), cam_matrix, dist_coeffs, left_RT, right_RT);
+    valid = false; // Not tied to a calibration file
+    if (roi_l) {
+        *roi_l = roi[0];
+    }
+    if (roi_r) {
+        *roi_r = roi[1];
+    }
+    TraceSpan span("rectify remap");
+    remap(left_view, *view_rect_l, maps[0][0], maps[0][1], CV_INTER_LINEAR);
+    remap(right_view, *view_rect_r, maps[1][0], maps[1][1], CV_INTER_LINEAR);
+}
+
+/// Rectification rotations \a R and projections \a P of both views of given
+/// size, storing their valid rectangles.
+void StereoRectifier::ComputeRectification(const Size &size,
+        const Mat &cam_matrix, const Mat &dist_coeffs,
+        const Mat &left_RT, const Mat &right_RT, Mat R_rect[2], Mat P[2]) {
     Mat RT_r2l = right_RT * left_RT.inv();
     Mat R = (Mat1d(3, 3) <<
              RT_r2l.at<float>(0), RT_r2l.at<float>(1), RT_r2l.at<float>(2),
@@ -55,33 +100,233 @@ void StereoRectifier::Rectify(const Mat &left_view, const Mat &right_view,
              RT_r2l.at<float>(8), RT_r2l.at<float>(9), RT_r2l.at<float>(10));
     Mat T = (Mat1d(3, 1) <<
              RT_r2l.at<float>(3), RT_r2l.at<float>(7), RT_r2l.at<float>(11));
-    // Rectify
-    Mat R1, R2, P1, P2, Q;
-    Size size = left_view.size();
+    Mat Q;
     stereoRectify(cam_matrix, dist_coeffs, cam_matrix, dist_coeffs, size, R, T,
-                  R1, R2, P1, P2, Q, CALIB_ZERO_DISPARITY, -1, Size(), roi_l, roi_r);
-
-    // Remap
-    Mat map_matrix[2][2];
-    initUndistortRectifyMap(cam_matrix, dist_coeffs, R1, P1, size,
-                            CV_16SC2, map_matrix[0][0], map_matrix[0][1]);
-    initUndistortRectifyMap(cam_matrix, dist_coeffs, R2, P2, size,
-                            CV_16SC2, map_matrix[1][0], map_matrix[1][1]);
-
-    remap(left_view, *view_rect_l, map_matrix[0][0], map_matrix[0][1],
-          CV_INTER_LINEAR);
-    remap(right_view, *view_rect_r, map_matrix[1][0], map_matrix[1][1],
-          CV_INTER_LINEAR);
+                  R_rect[0], R_rect[1], P[0], P[1], Q, CALIB_ZERO_DISPARITY,
+                  -1, Size(), &roi[0], &roi[1]);
+}
+
+/// Compute and store the rectification maps for views of given size, in new
+/// buffers: maps handed out by GetMaps are not overwritten.
+void StereoRectifier::ComputeMaps(const Size &size,
+                                  const Mat &cam_matrix, const Mat &dist_coeffs,
+                                  const Mat &left_RT, const Mat &right_RT) {
+    TraceSpan span("rectify maps");
+    Mat R[2], P[2];
+    ComputeRectification(size, cam_matrix, dist_coeffs, left_RT, right_RT,
+                         R, P);
+    for (int i = 0; i < 2; ++i) {
+        maps[i][0] = Mat();
+        maps[i][1] = Mat();
+        initUndistortRectifyMap(cam_matrix, dist_coeffs, R[i], P[i], size,
+                                CV_16SC2, maps[i][0], maps[i][1]);
+    }
+}
+
+void ViewRectification::BandMaps(int y0, int y1, Mat &map1, Mat &map2) const {
+    // Rows from y0 on are those of a camera whose principal point is y0 rows
+    // higher
+    Mat band_P = P(Rect(0, 0, 3, 3)).clone();
+    band_P.at<double>(1, 2) -= y0;
+    initUndistortRectifyMap(camera, distortion, R, band_P,
+                            Size(size.width, y1 - y0), CV_16SC2, map1, map2);
+}
+
+/// Make the maps match the calibration file and image size, recomputing them
+/// only if the file content changed (its hash is computed only if its
+/// modification time changed). Return false if there is no calibration file.
+bool StereoRectifier::UpdateMaps(const string &calib_filename,
+                                 const Size &size) {
+    struct stat st;
+    if (stat(calib_filename.c_str(), &st) != 0) {
+        return false;
+    }
+    if (valid && calib_filename == calibFile && st.st_mtime == calibTime &&
+            size == mapSize) {
+        return true;
+    }
+
+    ifstream ifs(calib_filename.c_str(), ios::binary);
+    vector<char> content((istreambuf_iterator<char>(ifs)),
+                         istreambuf_iterator<char>());
+    unsigned long long hash = HashBytes(content);
+    calibFile = calib_filename;
+    calibTime = st.st_mtime;
+    if (valid && hash == calibHash && size == mapSize) {
+        return true;
+    }
+    calibHash = hash;
+    mapSize = size;
+    valid = true;
+    if (LoadMaps(hash, size)) {
+        return true;
+    }
+
+    Mat cam_matrix;
+    Mat dist_coeffs = Mat(1, 4, CV_32FC1, Scalar(0));
+    Mat left_RT, right_RT;
+    ReadParam(calib_filename, cam_matrix, &left_RT, &right_RT);
+    ComputeMaps(size, cam_matrix, dist_coeffs, left_RT, right_RT);
+    SaveMaps();
+    return true;
+}
+
+bool StereoRectifier::RectifyTransform(const string &calib_filename,
+                                       const Mat &view_l, const Mat &view_r,
+                                       RowTransform transform,
+                                       TransformedView &out_l,
+                                       TransformedView &out_r, int bandRows) {
+    const bool rectify = UpdateMaps(calib_filename, view_l.size());
+    TraceSpan span("rectify transform");
+    rectified = rectify;
+    viewSize = view_l.size();
+    const Mat none;
+    thread right([&]() {
+        RectifyTransformView(view_r, rectify ? maps[1][0] : none,
+                             rectify ? maps[1][1] : none,
+                             transform, out_r, bandRows);
+    });
+    RectifyTransformView(view_l, rectify ? maps[0][0] : none,
+                         rectify ? maps[0][1] : none,
+                         transform, out_l, bandRows);
+    right.join();
+    return rectify;
+}
+
+bool StereoRectifier::GetMaps(const string &calib_filename, const Size &size,
+                              Mat map_l[2], Mat map_r[2]) {
+    rectified = UpdateMaps(calib_filename, size);
+    viewSize = size;
+    for (int j = 0; j < 2; ++j) {
+        map_l[j] = rectified ? maps[0][j] : Mat();
+        map_r[j] = rectified ? maps[1][j] : Mat();
+    }
+    return rectified;
+}
+
+bool StereoRectifier::GetRectification(const string &calib_filename,
+                                       const Size &size,
+                                       ViewRectification &left,
+                                       ViewRectification &right) {
+    struct stat st;
+    rectified = stat(calib_filename.c_str(), &st) == 0;
+    viewSize = size;
+    if (!rectified) {
+        return false;
+    }
+    Mat cam_matrix;
+    Mat dist_coeffs = Mat(1, 4, CV_32FC1, Scalar(0));
+    Mat left_RT, right_RT;
+    ReadParam(calib_filename, cam_matrix, &left_RT, &right_RT);
+    Mat R[2], P[2];
+    ComputeRectification(size, cam_matrix, dist_coeffs, left_RT, right_RT,
+                         R, P);
+    valid = false; // roi no longer that of the cached maps
+    ViewRectification *views[2] = { &left, &right };
+    for (int i = 0; i < 2; ++i) {
+        views[i]->camera = cam_matrix;
+        views[i]->distortion = dist_coeffs;
+        views[i]->R = R[i];
+        views[i]->P = P[i];
+        views[i]->size = size;
+    }
+    return true;
+}
+
+/// Read maps from the map file if it was written for calibration \a hash and
+/// image \a size, on a machine of the same byte order. Maps are read in new
+/// buffers, like ComputeMaps.
+bool StereoRectifier::LoadMaps(unsigned long long hash, const Size &size) {
+    if (mapFile.empty()) {
+        return false;
+    }
+    ifstream ifs(mapFile.c_str(), ios::binary);
+    char magic[sizeof(MAP_FILE_MAGIC)];
+    unsigned int byteOrder = 0;
+    unsigned long long fileHash = 0;
+    int header[2 + 8] = { 0 }; // size, then roi[0] and roi[1]
+    if (!ifs.read(magic, sizeof(magic)) ||
+            memcmp(magic, MAP_FILE_MAGIC, sizeof(magic)) != 0 ||
+            !ifs.read((char *)&byteOrder, sizeof(byteOrder)) ||
+            byteOrder != MAP_FILE_BYTE_ORDER ||
+            !ifs.read((char *)&fileHash, sizeof(fileHash)) ||
+            !ifs.read((char *)header, sizeof(header)) ||
+            fileHash != hash || header[0] != size.width ||
+            header[1] != size.height) {
+        return false;
+    }
+    for (int i = 0; i < 2; ++i) {
+        roi[i] = Rect(header[2 + 4 * i], header[3 + 4 * i],
+                      header[4 + 4 * i], header[5 + 4 * i]);
+        maps[i][0] = Mat(size, CV_16SC2);
+        maps[i][1] = Mat(size, CV_16UC1);
+        for (int j = 0; j < 2; ++j)
+            for (int y = 0; y < size.height; ++y)
+                if (!ifs.read((char *)maps[i][j].ptr(y),
+                              size.width * maps[i][j].elemSize())) {
+                    return false;
+                }
+    }
+    return true;
+}
+
+/// Write maps to the map file, tagged with calibration hash and image size.
+void StereoRectifier::SaveMaps() const {
+    if (mapFile.empty()) {
+        return;
+    }
+    ofstream ofs(mapFile.c_str(), ios::binary);
+    int header[2 + 8] = { mapSize.width, mapSize.height,
+                          roi[0].x, roi[0].y, roi[0].width, roi[0].height,
+                          roi[1].x, roi[1].y, roi[1].width, roi[1].height
+                        };
+    ofs.write(MAP_FILE_MAGIC, sizeof(MAP_FILE_MAGIC));
+    ofs.write((const char *)&MAP_FILE_BYTE_ORDER, sizeof(MAP_FILE_BYTE_ORDER));
+    ofs.write((const char *)&calibHash, sizeof(calibHash));
+    ofs.write((const char *)header, sizeof(header));
+    for (int i = 0; i < 2; ++i)
+        for (int j = 0; j < 2; ++j)
+            for (int y = 0; y < mapSize.height; ++y)
+                ofs.write((const char *)maps[i][j].ptr(y),
+                          mapSize.width * maps[i][j].elemSize());
+}
+
+bool StereoRectifier::MatchRegion(int dMin, int dMax,
+                                  Rect *left, Rect *right) const {
+    const Rect frame(Point(0, 0), viewSize);
+    *left = *right = frame;
+    if (!rectified) {
+        return false;
+    }
+    // Rows valid in both views; left columns having a valid candidate
+    int y0 = max(roi[0].y, roi[1].y);
+    int y1 = min(roi[0].y + roi[0].height, roi[1].y + roi[1].height);
+    int x0 = max(roi[0].x, roi[1].x - dMax);
+    int x1 = min(roi[0].x + roi[0].width, roi[1].x + roi[1].width - dMin);
+    if (y0 >= y1 || x0 >= x1) {
+        return false;
+    }
+    *left = Rect(x0, y0, x1 - x0, y1 - y0);
+    *right = Rect(x0 + dMin, y0, x1 - x0 + dMax - dMin, y1 - y0) & frame;
+    return true;
 }
 
 void StereoRectifier::StereoRectify(string calib_filename,
                                     Mat &view_l, Mat &view_r,
                                     Mat &show_two_image) {
     bool need_rectify = true;
-    FILE *calib = fopen(calib_filename.c_str(), "r");
-    if (calib == nullptr) {
-        need_rectify = false;
+    if (cacheMaps) {
+        need_rectify = UpdateMaps(calib_filename, view_l.size());
+    } else {
+        FILE *calib = fopen(calib_filename.c_str(), "r");
+        if (calib == nullptr) {
+            need_rectify = false;
+        } else {
+            fclose(calib);
+        }
     }
+    rectified = need_rectify;
+    viewSize = view_l.size();
 
     Mat left_rect, right_rect;
     int width = view_l.cols;
@@ -90,7 +335,13 @@ void StereoRectifier::StereoRectify(string calib_filename,
     left_rect = show_two_image(Rect(0, 0, width, height));
     right_rect = show_two_image(Rect(width, 0, width, height));
 
-    if (need_rectify) {
+    if (need_rectify && cacheMaps) {
+        TraceSpan span("rectify remap");
+        remap(view_l, left_rect, maps[0][0], maps[0][1], CV_INTER_LINEAR);
+        remap(view_r, right_rect, maps[1][0], maps[1][1], CV_INTER_LINEAR);
+        view_l = left_rect;
+        view_r = right_rect;
+    } else if (need_rectify) {
         Mat cam_matrix;
         Mat dist_coeffs = Mat(1, 4, CV_32FC1, Scalar(0));
         Mat left_RT, right_RT;
@@ -1,13 +1,64 @@
 #ifndef STEREO_RECTIFIER_H_
 #define STEREO_RECTIFIER_H_
 
+#include <ctime>
 #include <string>
 #include "opencv2/opencv.hpp"
+#include "RectifyTransform.h"
+
+/// Rectification of a view, from which maps are computed band of rows by
+/// band of rows instead of being kept whole.
+struct ViewRectification {
+    cv::Mat camera, distortion; ///< intrinsics of the view
+    cv::Mat R, P;               ///< rectification rotation and projection
+    cv::Size size;
+
+    /// Rows [\a y0, \a y1) of the maps of the view, CV_16SC2 and CV_16UC1.
+    void BandMaps(int y0, int y1, cv::Mat &map1, cv::Mat &map2) const;
+};
 
 class StereoRectifier {
   public:
+    /// With \a cacheMaps, rectification maps are computed once per
+    /// calibration and image size, and reused for the next pairs.
+    explicit StereoRectifier(bool cacheMaps = true);
+
     void StereoRectify(std::string calib_filename, cv::Mat &view_l, cv::Mat &view_r,
                        cv::Mat &show_two_image);
+
+    /// Rectify both views with the cached maps and apply the matcher
+    /// \a transform in the same pass, in bands of \a bandRows rows, views in
+    /// parallel. Without calibration file, views are only transformed and
+    /// false is returned.
+    bool RectifyTransform(const std::string &calib_filename,
+                          const cv::Mat &view_l, const cv::Mat &view_r,
+                          RowTransform transform, TransformedView &out_l,
+                          TransformedView &out_r, int bandRows = 32);
+
+    /// Rectification maps of views of \a size for \a calib_filename
+    /// (CV_16SC2 and CV_16UC1 for each view, shared with the cache). The
+    /// cache never writes maps in place, so they stay valid without lock.
+    /// Return false, leaving the maps empty, without calibration file.
+    bool GetMaps(const std::string &calib_filename, const cv::Size &size,
+                 cv::Mat map_l[2], cv::Mat map_r[2]);
+
+    /// Rectification of views of \a size for \a calib_filename, to compute
+    /// their maps band by band, outside the cache. Return false without
+    /// calibration file.
+    bool GetRectification(const std::string &calib_filename,
+                          const cv::Size &size, ViewRectification &left,
+                          ViewRectification &right);
+
+    /// Persist maps in binary file \a filename, read back at next start if
+    /// calibration and image size are unchanged. Empty name to disable.
+    void SetMapFile(const std::string &filename);
+
+    /// Rectangles of the last rectified views worth matching for disparities
+    /// in [\a dMin, \a dMax] (right x = left x + d): \a left is valid in
+    /// both views, \a right is the same rows expanded by the disparity range.
+    /// Return false, with full frames, if the views were not rectified or
+    /// have no valid region in common.
+    bool MatchRegion(int dMin, int dMax, cv::Rect *left, cv::Rect *right) const;
   private:
     void ReadParam(const std::string &filename, cv::Mat &intrinsics,
                    cv::Mat *RT_left, cv::Mat *RT_right);
@@ -18,7 +69,29 @@ class StereoRectifier {
                  cv::Mat *view_rect_left, cv::Mat *view_rect_right,
                  cv::Rect *roi_left = nullptr, cv::Rect *roi_right = nullptr);
 
+    void ComputeRectification(const cv::Size &size, const cv::Mat &intrinsics,
+                              const cv::Mat &dist_coeffs,
+                              const cv::Mat &RT_left, const cv::Mat &RT_right,
+                              cv::Mat R[2], cv::Mat P[2]);
+    void ComputeMaps(const cv::Size &size,
+                     const cv::Mat &intrinsics, const cv::Mat &dist_coeffs,
+                     const cv::Mat &RT_left, const cv::Mat &RT_right);
+    bool UpdateMaps(const std::string &calib_filename, const cv::Size &size);
+    bool LoadMaps(unsigned long long hash, const cv::Size &size);
+    void SaveMaps() const;
 
+    bool cacheMaps;
+    std::string mapFile;
+    bool rectified;  ///< last views were remapped, roi applies to them
+    cv::Size viewSize;
+    // Calibration and size the maps were computed for
+    bool valid;
+    std::string calibFile;
+    time_t calibTime;
+    unsigned long long calibHash;
+    cv::Size mapSize;
+    cv::Mat maps[2][2]; ///< left/right, fixed-point coordinates/interpolation
+    cv::Rect roi[2];    ///< valid rectangles of rectified views
 };
 
 #endif  // STEREO_RECTIFIER_H_
@@ -0,0 +1,334 @@
+#include "StereoStream.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include "Trace.h"
+#ifdef HAS_PNG
+#include "io_png.h"
+#endif
+#ifdef HAS_JPEG
+#include "io_jpeg.h"
+#endif
+
+using namespace std;
+using namespace cv;
+
+/// Rows above those the top and bottom rows of a band read that are kept for
+/// it, in case its maps are not monotonic
+static const int KEEP_MARGIN = 2;
+
+/// Lowercase extension of \a filename
+static string Extension(const string &filename) {
+    size_t dot = filename.rfind('.');
+    if (dot == string::npos) {
+        return string();
+    }
+    string ext = filename.substr(dot + 1);
+    transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+    return ext;
+}
+
+ViewRowReader::ViewRowReader() : png(nullptr), jpeg(nullptr), next(0) {}
+
+ViewRowReader::~ViewRowReader() {
+    Close();
+}
+
+void ViewRowReader::Close() {
+#ifdef HAS_PNG
+    io_png_close_read(png);
+#endif
+#ifdef HAS_JPEG
+    io_jpeg_close_read(jpeg);
+#endif
+    png = nullptr;
+    jpeg = nullptr;
+}
+
+bool ViewRowReader::Open(const string &filename) {
+    Close();
+    next = 0;
+    const string ext = Extension(filename);
+    size_t nx = 0, ny = 0;
+    bool whole = false; // rows only come with the whole view
+#ifdef HAS_PNG
+    if (ext == "png") {
+        png = io_png_open_read(filename.c_str(), IO_PNG_GRAY, &nx, &ny);
+        if (!png) {
+            cerr << "Error reading file " << filename << endl;
+            return false;
+        }
+        whole = io_png_read_interlaced(png) != 0;
+    }
+#endif
+#ifdef HAS_JPEG
+    if (ext == "jpg" || ext == "jpeg") {
+        jpeg = io_jpeg_open_read(filename.c_str(), 1, &nx, &ny);
+        if (!jpeg) {
+            cerr << "Error reading file " << filename << endl;
+            return false;
+        }
+        whole = io_jpeg_read_progressive(jpeg) != 0;
+    }
+#endif
+    if ((!png && !jpeg) || whole) {
+        cerr << "Error: " << filename << " cannot be read row by row, only "
+             << "non-interlaced PNG and baseline JPEG files can" << endl;
+        Close();
+        return false;
+    }
+    viewSize = Size((int)nx, (int)ny);
+    return true;
+}
+
+bool ViewRowReader::Read(Mat &dst, int row, int n) {
+    if (next + n > viewSize.height) {
+        return false;
+    }
+#ifdef HAS_PNG
+    if (png && io_png_read_rows(png, dst.ptr(row), dst.step, n) != 0) {
+        return false;
+    }
+#endif
+#ifdef HAS_JPEG
+    if (jpeg && io_jpeg_read_rows(jpeg, dst.ptr(row), dst.step, n) != 0) {
+        return false;
+    }
+#endif
+    next += n;
+    return true;
+}
+
+bool RectifiedBandStream::Open(const string &filename,
+                               const ViewRectification *rectification,
+                               int bandRows) {
+    rectify = rectification != nullptr;
+    if (rectify) {
+        this->rectification = *rectification;
+    }
+    this->bandRows = max(bandRows, 1);
+    band = 0;
+    windowY0 = windowRows = 0;
+    if (!reader.Open(filename)) {
+        return false;
+    }
+    const int height = reader.size().height;
+    bands = (height + this->bandRows - 1) / this->bandRows;
+    keep.assign(bands, 0);
+    if (!rectify) {
+        return true;
+    }
+    // Only the maps of the top and bottom rows of each band: the rows of the
+    // view a band reads are known exactly once its maps are computed in Next
+    for (int b = bands - 1; b >= 0; --b) {
+        const int y0 = b * this->bandRows;
+        const int y1 = min(y0 + this->bandRows, height);
+        int first = height, last;
+        for (int y : { y0, y1 - 1 }) {
+            int rowFirst;
+            this->rectification.BandMaps(y, y + 1, map1, map2);
+            RemapSourceRows(map1, 0, 1, height, &rowFirst, &last);
+            first = min(first, rowFirst);
+        }
+        first = max(first - KEEP_MARGIN, 0);
+        keep[b] = (b + 1 < bands) ? min(first, keep[b + 1]) : first;
+    }
+    map1.release();
+    map2.release();
+    return true;
+}
+
+bool RectifiedBandStream::Next(Mat &out) {
+    if (band >= bands) {
+        return false;
+    }
+    TraceSpan span("stream band");
+    const int width = reader.size().width, height = reader.size().height;
+    const int y0 = band * bandRows, y1 = min(y0 + bandRows, height);
+    if (!rectify) {
+        out.create(y1 - y0, width, CV_8UC1);
+        ++band;
+        return reader.Read(out, 0, y1 - y0);
+    }
+
+    rectification.BandMaps(y0, y1, map1, map2);
+    int first, last;
+    RemapSourceRows(map1, 0, y1 - y0, height, &first, &last);
+    if (first < windowY0) {
+        cerr << "Error: rectified band " << band << " reads rows of the view "
+             << "already dropped" << endl;
+        return false;
+    }
+    const int keepRow = (band + 1 < bands) ? min(first, keep[band + 1]) :
+                        first;
+
+    // Drop the rows no band reads any more, skip the rows no band reads
+    const int drop = min(max(keepRow - windowY0, 0), windowRows);
+    for (int i = drop; i < windowRows; ++i) {
+        memmove(window.ptr(i - drop), window.ptr(i), width);
+    }
+    windowY0 += drop;
+    windowRows -= drop;
+    if (windowRows == 0 && windowY0 < keepRow) {
+        Mat skip(1, width, CV_8UC1);
+        for (; windowY0 < keepRow; ++windowY0)
+            if (!reader.Read(skip, 0, 1)) {
+                return false;
+            }
+    }
+    // Read the rows of this band
+    const int rows = max(last - windowY0, windowRows);
+    if (rows > window.rows) {
+        Mat grown(rows, width, CV_8UC1);
+        if (windowRows > 0) {
+            window.rowRange(0, windowRows).copyTo(grown.rowRange(0, windowRows));
+        }
+        window = grown;
+    }
+    if (rows > windowRows) {
+        if (!reader.Read(window, windowRows, rows - windowRows)) {
+            return false;
+        }
+        windowRows = rows;
+    }
+    RemapRows(window.rowRange(0, windowRows), windowY0, map1, map2, 0,
+              y1 - y0, out);
+    if (++band == bands) {
+        map1.release();
+        map2.release();
+        window.release();
+    }
+    return true;
+}
+
+StreamingSAD::StreamingSAD(Size size, int window_size, int search_scope)
+    : width(size.width), height(size.height), N(window_size),
+      search(search_scope), count(0) {
+    for (int v = 0; v < 2; ++v) {
+        rows[v].create(N, width, CV_8UC1);
+        colSum[v].assign(width, 0);
+    }
+}
+
+bool StreamingSAD::Push(const uchar *left, const uchar *right, Mat &out,
+                        int *y) {
+    // Slide the window down one row
+    const uchar *in[2] = { left, right };
+    const int slot = count % N;
+    for (int v = 0; v < 2; ++v) {
+        uchar *row = rows[v].ptr(slot);
+        for (int x = 0; x < width; ++x) {
+            if (count >= N) {
+                colSum[v][x] -= row[x];
+            }
+            colSum[v][x] += in[v][x];
+        }
+        memcpy(row, in[v], width);
+    }
+    ++count;
+    // Same windows as LocalMatchingSAD: top row below height - N
+    const int top = count - N;
+    if (top < 0 || top >= height - N) {
+        return false;
+    }
+
+    out.create(1, width, CV_8UC3);
+    out.setTo(Scalar(0, 0, 0));
+    Vec3b *disp = out.ptr<Vec3b>(0);
+    for (int x = search; x < width - N; ++x) {
+        int min_sum = 255 * N * N;
+        int min_doff = 0;
+        int avg1 = 0;
+        for (int i = x; i < x + N; ++i) {
+            avg1 += colSum[0][i];
+        }
+        for (int doff = 0; doff < search; ++doff) {
+            int sum = 0;
+            int avg2 = 0;
+            for (int i = x; i < x + N; ++i) {
+                avg2 += colSum[1][i - doff];
+            }
+            float ad = 1.0*avg2 / avg1;
+            for (int j = 0; j < N; ++j) {
+                const uchar *row1 = rows[0].ptr(j), *row2 = rows[1].ptr(j);
+                for (int i = x; i < x + N; ++i) {
+                    int dif = ad*(int)row1[i] - (int)row2[i - doff];
+                    if (dif < 0) {
+                        dif = -dif;
+                    }
+                    sum += dif;
+                }
+            }
+            if (sum < min_sum) {
+                min_sum = sum;
+                min_doff = doff;
+            }
+        }
+        min_doff  = min_doff * 255 / search;
+        disp[x + N / 2] = Vec3b(min_doff, min_doff, min_doff);
+    }
+    *y = top + N / 2;
+    return true;
+}
+
+StreamingStereo::StreamingStereo(int bandRows) : bandRows(bandRows) {}
+
+bool StreamingStereo::Open(const StereoPairFiles &files,
+                           StereoRectifier &rectifier) {
+    ViewRowReader probe; // header only, for the size
+    if (!probe.Open(files.left)) {
+        return false;
+    }
+    ViewRectification rect[2];
+    const bool rectify = rectifier.GetRectification(files.calib, probe.size(),
+                         rect[0], rect[1]);
+    return streams[0].Open(files.left, rectify ? &rect[0] : nullptr,
+                           bandRows) &&
+           streams[1].Open(files.right, rectify ? &rect[1] : nullptr,
+                           bandRows) &&
+           streams[1].size() == streams[0].size();
+}
+
+bool StreamingStereo::MatchSAD(int window_size, int search_scope,
+                               const string &output) {
+#ifdef HAS_PNG
+    const Size size = streams[0].size();
+    io_png_writer *writer = io_png_open_write(output.c_str(), size.width,
+                            size.height, 3, NULL);
+    if (!writer) {
+        cerr << "Error writing file " << output << endl;
+        return false;
+    }
+    StreamingSAD sad(size, window_size, search_scope);
+    Mat band[2], disparity, black(1, size.width, CV_8UC3, Scalar(0, 0, 0));
+    int written = 0, y;
+    bool ok = true;
+    while (ok && streams[0].Next(band[0])) {
+        ok = streams[1].Next(band[1]);
+        for (int j = 0; ok && j < band[0].rows; ++j) {
+            if (!sad.Push(band[0].ptr(j), band[1].ptr(j), disparity, &y)) {
+                continue;
+            }
+            for (; ok && written < y; ++written) {
+                ok = io_png_write_rows(writer, black.data, black.step, 1) == 0;
+            }
+            ok = ok && io_png_write_rows(writer, disparity.data,
+                                         disparity.step, 1) == 0;
+            ++written;
+        }
+    }
+    for (; ok && written < size.height; ++written) {
+        ok = io_png_write_rows(writer, black.data, black.step, 1) == 0;
+    }
+    if (io_png_close_write(writer) != 0 || !ok) {
+        cerr << "Error writing file " << output << endl;
+        return false;
+    }
+    return true;
+#else
+    cerr << "Unable to save file " << output << " as PNG since the "
+         << "program was built without PNG support" << endl;
+    return false;
+#endif
+}
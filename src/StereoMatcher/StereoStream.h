@@ -0,0 +1,104 @@
+#ifndef STEREO_STREAM_H_
+#define STEREO_STREAM_H_
+
+#include <string>
+#include <vector>
+#include "opencv2/opencv.hpp"
+#include "StereoPipeline.h"
+#include "StereoRectifier.h"
+
+struct io_png_reader_s;
+struct io_jpeg_reader_s;
+
+/// Gray rows of a view, decoded in order as they are requested. Only
+/// non-interlaced PNG and baseline JPEG files are read row by row.
+class ViewRowReader {
+  public:
+    ViewRowReader();
+    ~ViewRowReader();
+
+    /// Read the header of \a filename. False, with a message, if the file
+    /// cannot be read or not row by row.
+    bool Open(const std::string &filename);
+    cv::Size size() const {
+        return viewSize;
+    }
+    /// Decode the next \a n rows into rows of \a dst from \a row on.
+    bool Read(cv::Mat &dst, int row, int n);
+  private:
+    ViewRowReader(const ViewRowReader &);
+    ViewRowReader &operator=(const ViewRowReader &);
+    void Close();
+
+    struct io_png_reader_s *png;
+    struct io_jpeg_reader_s *jpeg;
+    cv::Size viewSize;
+    int next; ///< next row to read
+};
+
+/// Rectified rows of a view, band after band. Only the rows of the view read
+/// by the current and next bands, and the maps of the current band, are kept.
+/// The maps of each band are computed once, when it is remapped.
+class RectifiedBandStream {
+  public:
+    /// Null \a rectification means the bands are the rows of the view.
+    bool Open(const std::string &filename,
+              const ViewRectification *rectification, int bandRows);
+    cv::Size size() const {
+        return reader.size();
+    }
+    /// Next band of rectified rows, false after the last one.
+    bool Next(cv::Mat &band);
+  private:
+    ViewRowReader reader;
+    bool rectify;
+    ViewRectification rectification;
+    cv::Mat map1, map2; ///< maps of the current band
+    int bandRows, band;
+    int bands;
+    /// Lowest row of the view read by a band or later, from the top and
+    /// bottom rows of their maps
+    std::vector<int> keep;
+    cv::Mat window; ///< rows of the view from windowY0, windowRows of them
+    int windowY0, windowRows;
+};
+
+/// LocalMatcher::LocalMatchingSAD on rows given one at a time, keeping only
+/// the last window_size rows of each view.
+class StreamingSAD {
+  public:
+    StreamingSAD(cv::Size size, int window_size, int search_scope);
+
+    /// Add the next row of both views. Return true when \a out (1 row,
+    /// CV_8UC3) gets disparity row \a y, the center row of the window.
+    bool Push(const cv::uchar *left, const cv::uchar *right, cv::Mat &out,
+              int *y);
+  private:
+    int width, height, N, search;
+    cv::Mat rows[2]; ///< last N rows of each view, circular
+    std::vector<int> colSum[2]; ///< sum of each column over the window
+    int count; ///< rows pushed
+};
+
+/// Rectification, SAD matching and output of a pair band of rows after band
+/// of rows: the views, the disparity and the rectification maps are never
+/// whole in memory. Memory is O(width * (window_size + bandRows + rows of the
+/// views read by a band)).
+class StreamingStereo {
+  public:
+    explicit StreamingStereo(int bandRows = 32);
+
+    /// Open the views of \a files, rectified if their calibration exists.
+    bool Open(const StereoPairFiles &files, StereoRectifier &rectifier);
+    cv::Size size() const {
+        return streams[0].size();
+    }
+    /// Match and write the disparity (PNG, gray as RGB like the in-memory
+    /// matcher) row by row. False if a file cannot be read or written.
+    bool MatchSAD(int window_size, int search_scope, const std::string &output);
+  private:
+    int bandRows;
+    RectifiedBandStream streams[2];
+};
+
+#endif  // STEREO_STREAM_H_
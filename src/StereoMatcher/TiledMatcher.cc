@@ -0,0 +1,240 @@
+#include "TiledMatcher.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <limits>
+#include <thread>
+#include <vector>
+#include "Trace.h"
+#ifdef HAS_TIFF
+#include "io_tiff.h"
+#endif
+
+using namespace std;
+using namespace cv;
+
+TiledMatcher::TiledMatcher(const TileMatcher &matcher, int tileSize,
+                           int overlap, size_t memoryBudget,
+                           size_t bytesPerPixel, int threads)
+    : matcher(matcher), tileSize(tileSize), overlap(overlap),
+      memoryBudget(memoryBudget), bytesPerPixel(bytesPerPixel),
+      threads(threads > 0 ? threads : max((int)thread::hardware_concurrency(), 1)),
+      dMin(0), dMax(0), rowsDone(0), failed(false), accY0(0), memoryUsed(0) {
+    CV_Assert(tileSize > 0 && tileSize % 16 == 0 && overlap >= 0 &&
+              2 * overlap < tileSize);
+}
+
+bool TiledMatcher::Run(const string &left, const string &right,
+                       int dMin, int dMax, const string &output) {
+#ifdef HAS_TIFF
+    size_t nx[2], ny[2];
+    files[0] = left;
+    files[1] = right;
+    for (int v = 0; v < 2; ++v)
+        if (io_tiff_read_size(files[v].c_str(), &nx[v], &ny[v]) != 0) {
+            return false;
+        }
+    if (nx[0] != nx[1] || ny[0] != ny[1]) {
+        cerr << "Error: views " << left << " and " << right
+             << " have different sizes" << endl;
+        return false;
+    }
+    size = Size((int)nx[0], (int)ny[0]);
+    this->dMin = dMin;
+    this->dMax = dMax;
+    rowsDone = 0;
+    failed = false;
+    accSum.release();
+    accWeight.release();
+    accY0 = 0;
+    memoryUsed = 0;
+    if (io_tiff_write_f32_tiled(output.c_str(), nx[0], ny[0], tileSize,
+                                FillTile, this) != 0) {
+        cerr << "Error writing file " << output << endl;
+        return false;
+    }
+    return !failed;
+#else
+    cerr << "Unable to match tiled views since the program was built "
+         << "without TIFF support" << endl;
+    return false;
+#endif
+}
+
+Size TiledMatcher::ViewSize(const string &filename) {
+#ifdef HAS_TIFF
+    size_t nx, ny;
+    if (io_tiff_read_size(filename.c_str(), &nx, &ny) == 0) {
+        return Size((int)nx, (int)ny);
+    }
+#endif
+    return Size();
+}
+
+/// Write the blended disparities of an output tile, matching the rows of
+/// tiles it depends on first. Output tiles come row after row.
+void TiledMatcher::FillTile(void *tiler, size_t x0, size_t y0, size_t nx,
+                            size_t ny, float *tile, size_t stride) {
+    TiledMatcher *t = (TiledMatcher *)tiler;
+    const int rows = (t->size.height + t->tileSize - 1) / t->tileSize;
+    const int row = (int)y0 / t->tileSize;
+    if (x0 == 0) {
+        // Rows above are final: written already
+        const int drop = min((int)y0 - t->accY0, t->accSum.rows);
+        if (drop > 0) {
+            t->accSum = t->accSum.rowRange(drop, t->accSum.rows).clone();
+            t->accWeight = t->accWeight.rowRange(drop, t->accWeight.rows).clone();
+            t->accY0 += drop;
+        }
+        // Tiles of the next row overlap this one
+        while (!t->failed && t->rowsDone <= min(row + 1, rows - 1)) {
+            t->failed = !t->MatchRow(t->rowsDone++);
+        }
+    }
+    const float NaN = numeric_limits<float>::quiet_NaN();
+    for (size_t y = 0; y < ny; ++y) {
+        float *out = tile + y * stride;
+        const int ay = (int)(y0 + y) - t->accY0;
+        for (size_t x = 0; x < nx; ++x) {
+            float w = t->failed ? 0 : t->accWeight.at<float>(ay, (int)(x0 + x));
+            out[x] = (w > 0) ? t->accSum.at<float>(ay, (int)(x0 + x)) / w : NaN;
+        }
+    }
+}
+
+/// Match the tiles of a row in parallel, within the memory budget.
+bool TiledMatcher::MatchRow(int row) {
+    // Accumulate down to the bottom of the overlap
+    const int y1 = min((row + 1) * tileSize + overlap, size.height);
+    if (y1 - accY0 > accSum.rows) {
+        Mat sum(y1 - accY0, size.width, CV_32FC1, Scalar(0));
+        Mat weight(y1 - accY0, size.width, CV_32FC1, Scalar(0));
+        if (accSum.rows > 0) {
+            accSum.copyTo(sum.rowRange(0, accSum.rows));
+            accWeight.copyTo(weight.rowRange(0, accWeight.rows));
+        }
+        accSum = sum;
+        accWeight = weight;
+    }
+
+    const int cols = (size.width + tileSize - 1) / tileSize;
+    atomic<int> next(0);
+    atomic<bool> ok(true);
+    vector<thread> workers;
+    for (int i = 0; i < min(threads, cols); ++i) {
+        workers.push_back(thread([&]() {
+            for (int col; ok && (col = next++) < cols;) {
+                if (!MatchTile(row, col)) {
+                    ok = false;
+                }
+            }
+        }));
+    }
+    for (size_t i = 0; i < workers.size(); ++i) {
+        workers[i].join();
+    }
+    return ok;
+}
+
+/// Read, match and accumulate a tile.
+bool TiledMatcher::MatchTile(int row, int col) {
+#ifdef HAS_TIFF
+    TraceSpan span("match tile");
+    const Rect frame(0, 0, size.width, size.height);
+    const Rect core(col * tileSize, row * tileSize, tileSize, tileSize);
+    Rect rect[2];
+    rect[0] = Rect(core.x - overlap, core.y - overlap,
+                   core.width + 2 * overlap, core.height + 2 * overlap) & frame;
+    rect[1] = Rect(rect[0].x + dMin, rect[0].y,
+                   rect[0].width + dMax - dMin, rect[0].height) & frame;
+
+    // Wait for memory: the float and 8-bit tiles, the disparity, the matcher
+    const size_t need = (size_t)rect[0].area() * (5 + 4 + bytesPerPixel) +
+                        (size_t)rect[1].area() * 5;
+    {
+        unique_lock<std::mutex> lock(mutex);
+        memoryFreed.wait(lock, [&]() {
+            return memoryUsed == 0 || memoryUsed + need <= memoryBudget;
+        });
+        memoryUsed += need;
+    }
+
+    Mat view[2], disparity;
+    bool ok = true;
+    for (int v = 0; ok && v < 2; ++v) {
+        float *data = io_tiff_read_f32_rect(files[v].c_str(), rect[v].x,
+                                            rect[v].y, rect[v].width,
+                                            rect[v].height);
+        if (!data) {
+            ok = false;
+            break;
+        }
+        Mat(rect[v].height, rect[v].width, CV_32FC1, data)
+        .convertTo(view[v], CV_8U);
+        free(data);
+    }
+    // Disparities between tiles are offset by the shift of their origins
+    const int shift = rect[1].x - rect[0].x;
+    if (ok) {
+        matcher(view[0], view[1], dMin - shift, dMax - shift, disparity);
+        ok = disparity.type() == CV_32FC1 && disparity.size() == rect[0].size();
+        if (ok) {
+            disparity += Scalar(shift);
+        }
+    }
+    view[0].release();
+    view[1].release();
+
+    if (ok) {
+        lock_guard<std::mutex> lock(mutex);
+        Accumulate(rect[0], disparity);
+    }
+    {
+        lock_guard<std::mutex> lock(mutex);
+        memoryUsed -= need;
+    }
+    memoryFreed.notify_all();
+    return ok;
+#else
+    return false;
+#endif
+}
+
+/// Weight of position \a i of [0, \a n) in a tile: ramps over 2 * overlap on
+/// sides \a before and \a after shared with other tiles.
+static float RampWeight(int i, int n, bool before, bool after, int overlap) {
+    const float ramp = 2.0f * overlap;
+    float w = 1;
+    if (before && ramp > 0) {
+        w = min(w, (i + 0.5f) / ramp);
+    }
+    if (after && ramp > 0) {
+        w = min(w, (n - i - 0.5f) / ramp);
+    }
+    return w;
+}
+
+/// Add the valid disparities of the tile at \a rect, weighted for blending.
+void TiledMatcher::Accumulate(const Rect &rect, const Mat &disparity) {
+    const bool left = rect.x > 0, right = rect.x + rect.width < size.width;
+    const bool top = rect.y > 0, bottom = rect.y + rect.height < size.height;
+    vector<float> wx(rect.width);
+    for (int x = 0; x < rect.width; ++x) {
+        wx[x] = RampWeight(x, rect.width, left, right, overlap);
+    }
+    for (int y = 0; y < rect.height; ++y) {
+        const float wy = RampWeight(y, rect.height, top, bottom, overlap);
+        const float *d = disparity.ptr<float>(y);
+        float *sum = accSum.ptr<float>(rect.y + y - accY0) + rect.x;
+        float *weight = accWeight.ptr<float>(rect.y + y - accY0) + rect.x;
+        for (int x = 0; x < rect.width; ++x) {
+            if (!std::isnan(d[x])) {
+                sum[x] += wx[x] * wy * d[x];
+                weight[x] += wx[x] * wy;
+            }
+        }
+    }
+}
@@ -0,0 +1,64 @@
+#ifndef TILED_MATCHER_H_
+#define TILED_MATCHER_H_
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include "opencv2/opencv.hpp"
+
+/// Disparity of a tile: \a disparity (CV_32FC1, size of \a left) gets d such
+/// that right x = left x + d, d in [\a dMin, \a dMax], NaN where unknown.
+typedef std::function<void(cv::Mat &left, cv::Mat &right, int dMin, int dMax,
+                           cv::Mat &disparity)> TileMatcher;
+
+/// Out-of-core matching of rectified views too large for memory. Views are
+/// split into tiles overlapping by \a overlap pixels, the right tile being
+/// extended by the disparity range. Tiles of a row are matched in parallel,
+/// as many at a time as the memory budget allows, and blended linearly
+/// across the overlaps.
+class TiledMatcher {
+  public:
+    /// \a tileSize is a multiple of 16 and larger than 2 * \a overlap.
+    /// \a bytesPerPixel is the memory the matcher needs per pixel of a left
+    /// tile, on top of the tiles. 0 threads means one per core.
+    TiledMatcher(const TileMatcher &matcher, int tileSize = 512,
+                 int overlap = 32, size_t memoryBudget = (size_t)1 << 30,
+                 size_t bytesPerPixel = 256, int threads = 0);
+
+    /// Match views of gray tiled TIFF files (8-bit or float samples), reading
+    /// only the tiles needed by a row of tiles, and write the disparity as a
+    /// float tiled TIFF (NaN where unknown) as soon as its rows are final.
+    bool Run(const std::string &left, const std::string &right,
+             int dMin, int dMax, const std::string &output);
+
+    /// Size of a view readable by Run, empty if it cannot be read.
+    static cv::Size ViewSize(const std::string &filename);
+  private:
+    static void FillTile(void *tiler, size_t x0, size_t y0, size_t nx,
+                         size_t ny, float *tile, size_t stride);
+    bool MatchRow(int row);
+    bool MatchTile(int row, int col);
+    void Accumulate(const cv::Rect &rect, const cv::Mat &disparity);
+
+    TileMatcher matcher;
+    int tileSize, overlap;
+    size_t memoryBudget, bytesPerPixel;
+    int threads;
+
+    // State of a run
+    std::string files[2];
+    cv::Size size;
+    int dMin, dMax;
+    int rowsDone; ///< rows of tiles matched
+    bool failed;
+    /// Weighted sum of disparities and sum of weights of image rows from
+    /// accY0 on
+    cv::Mat accSum, accWeight;
+    int accY0;
+    std::mutex mutex;
+    std::condition_variable memoryFreed;
+    size_t memoryUsed;
+};
+
+#endif  // TILED_MATCHER_H_
@@ -0,0 +1,350 @@
+// Benchmark of the matchers on the scenes of data/, at fixed parameters and
+// seed: wall and CPU time of each match, disparity throughput and peak
+// memory, as CSV and JSON to compare builds against a baseline. All pairs are
+// loaded before the first match is timed.
+#include <sys/resource.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "BatchMatcher.h"
+#include "StereoMatcher.h"
+#include "StereoPipeline.h"
+#include "Trace.h"
+#include "opencv2/opencv.hpp"
+
+using namespace cv;
+using namespace std;
+
+static const char *const SCENES[] = { "tsukuba", "venus", "teddy", "cones",
+                                      "chair", "wood", "1", "2"
+                                    };
+static const char *const METHODS[] = { "sad", "ncc", "gc" };
+
+/// Measures of a matcher on a scene. Times in milliseconds, over repetitions.
+struct BenchResult {
+    string method, scene;
+    int width, height, dMin, dMax, windowSize;
+    double wallMedian, wallMin, wallMean, cpuMedian;
+    double mpds;   ///< million pixel-disparities per second, median wall time
+    /// Peak resident memory of the process during the runs of the matcher,
+    /// KiB, or since the start of the process if \a peakRssCumulative
+    long peakRss;
+    bool peakRssCumulative;
+    double matched;
+    /// With --solver-stats, GC expansion moves of an extra instrumented run
+    /// and their max-flow statistics summed (zero otherwise)
+    size_t expansions;
+    double buildMs;
+    GraphStats solver;
+};
+
+/// Mean arcs of the augmenting paths of \a s
+static double MeanPath(const GraphStats &s) {
+    return (double)s.pathArcs / max(s.augmentations, 1LL);
+}
+
+/// CPU time of the process, all threads, in milliseconds.
+static double CpuMs() {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1e3 +
+           (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) * 1e-3;
+}
+
+/// Restart the peak resident memory of the process from the current one
+/// (Linux 4.0 and later). False if it cannot be reset.
+static bool ResetPeakRss() {
+    ofstream ofs("/proc/self/clear_refs");
+    ofs << "5";
+    ofs.close();
+    return (bool)ofs;
+}
+
+/// Peak resident memory of the process since the last reset, KiB. Without
+/// /proc, since the start of the process.
+static long PeakRssKb() {
+    ifstream ifs("/proc/self/status");
+    for (string line; getline(ifs, line);)
+        if (line.compare(0, 6, "VmHWM:") == 0) {
+            return atol(line.c_str() + 6);
+        }
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_maxrss;
+}
+
+static double Median(vector<double> v) {
+    sort(v.begin(), v.end());
+    const size_t n = v.size();
+    return n == 0 ? 0 : (n % 2 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2);
+}
+
+static vector<string> Split(const string &list) {
+    vector<string> items;
+    istringstream ss(list);
+    for (string item; getline(ss, item, ',');)
+        if (!item.empty()) {
+            items.push_back(item);
+        }
+    return items;
+}
+
+static void usage(const char *name) {
+    cerr << "Usage: " << name << " [options]" << endl
+         << "  --data DIR       scenes directory (default data)" << endl
+         << "  --scenes a,b     scenes (default tsukuba,venus,teddy,cones,"
+         << "chair,wood,1,2)" << endl
+         << "  --methods a,b    matchers (default sad,ncc,gc)" << endl
+         << "  --warmup N       untimed runs before measures (default 1)"
+         << endl
+         << "  --repeat N       timed runs (default 5)" << endl
+         << "  --seed N         GC: seed of each run (default 1)" << endl
+         << "  --csv FILE       write results as CSV" << endl
+         << "  --json FILE      write results as JSON" << endl
+         << "  --trace FILE     write spans of the runs as Chrome trace JSON"
+         << endl
+         << "  --solver-stats   GC: max-flow counters of one more, untimed run"
+         << endl
+         << "Disparities in [-width/8, 0], window (width/8/12)*2+1, as the"
+         << " interactive program." << endl;
+}
+
+static bool WriteCsv(const string &filename,
+                     const vector<BenchResult> &results) {
+    ofstream ofs(filename.c_str());
+    ofs << "method,scene,width,height,dmin,dmax,window,wall_ms_median,"
+        << "wall_ms_min,wall_ms_mean,cpu_ms_median,mpds,peak_rss_kb,"
+        << "peak_rss_cumulative,matched,"
+        << "expansions,nodes,arcs,augmentations,mean_path,longest_path,orphans,"
+        << "root_searches,root_steps,build_ms,grow_ms,augment_ms,adopt_ms"
+        << endl;
+    for (size_t i = 0; i < results.size(); ++i) {
+        const BenchResult &r = results[i];
+        const GraphStats &s = r.solver;
+        ofs << r.method << ',' << r.scene << ',' << r.width << ',' << r.height
+            << ',' << r.dMin << ',' << r.dMax << ',' << r.windowSize << ','
+            << r.wallMedian << ',' << r.wallMin << ',' << r.wallMean << ','
+            << r.cpuMedian << ',' << r.mpds << ',' << r.peakRss << ','
+            << (r.peakRssCumulative ? 1 : 0) << ',' << r.matched << ','
+            << r.expansions << ',' << s.nodes << ',' << s.arcs << ','
+            << s.augmentations << ',' << MeanPath(s) << ','
+            << s.longestPath << ',' << s.orphans << ',' << s.walks << ','
+            << s.walkSteps << ',' << r.buildMs << ','
+            << s.seconds[GRAPH_GROW] * 1e3 << ','
+            << s.seconds[GRAPH_AUGMENT] * 1e3 << ','
+            << s.seconds[GRAPH_ADOPT] * 1e3 << endl;
+    }
+    if (!ofs) {
+        cerr << "Error writing file " << filename << endl;
+    }
+    return (bool)ofs;
+}
+
+static bool WriteJson(const string &filename, int warmup, int repeat,
+                      unsigned int seed, const vector<BenchResult> &results) {
+    ofstream ofs(filename.c_str());
+    ofs << "{\n  \"warmup\": " << warmup << ",\n  \"repeat\": " << repeat
+        << ",\n  \"seed\": " << seed << ",\n  \"results\": [";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const BenchResult &r = results[i];
+        const GraphStats &s = r.solver;
+        ofs << (i ? "," : "") << "\n    {\"method\": \"" << r.method
+            << "\", \"scene\": \"" << r.scene << "\", \"width\": " << r.width
+            << ", \"height\": " << r.height << ", \"dmin\": " << r.dMin
+            << ", \"dmax\": " << r.dMax << ", \"window\": " << r.windowSize
+            << ", \"wall_ms_median\": " << r.wallMedian
+            << ", \"wall_ms_min\": " << r.wallMin
+            << ", \"wall_ms_mean\": " << r.wallMean
+            << ", \"cpu_ms_median\": " << r.cpuMedian
+            << ", \"mpds\": " << r.mpds << ", \"peak_rss_kb\": " << r.peakRss
+            << ", \"peak_rss_cumulative\": "
+            << (r.peakRssCumulative ? "true" : "false")
+            << ", \"matched\": " << r.matched;
+        if (r.expansions) {
+            ofs << ", \"solver\": {\"expansions\": " << r.expansions
+                << ", \"nodes\": " << s.nodes << ", \"arcs\": " << s.arcs
+                << ", \"augmentations\": " << s.augmentations
+                << ", \"mean_path\": " << MeanPath(s)
+                << ", \"longest_path\": " << s.longestPath
+                << ", \"orphans\": " << s.orphans
+                << ", \"root_searches\": " << s.walks
+                << ", \"root_steps\": " << s.walkSteps
+                << ", \"build_ms\": " << r.buildMs
+                << ", \"grow_ms\": " << s.seconds[GRAPH_GROW] * 1e3
+                << ", \"augment_ms\": " << s.seconds[GRAPH_AUGMENT] * 1e3
+                << ", \"adopt_ms\": " << s.seconds[GRAPH_ADOPT] * 1e3 << "}";
+        }
+        ofs << "}";
+    }
+    ofs << "\n  ]\n}\n";
+    if (!ofs) {
+        cerr << "Error writing file " << filename << endl;
+    }
+    return (bool)ofs;
+}
+
+int main(int argc, char *argv[]) {
+    string data = "data", csv, json, trace;
+    vector<string> scenes(SCENES, SCENES + sizeof(SCENES) / sizeof(SCENES[0]));
+    vector<string> methods(METHODS,
+                           METHODS + sizeof(METHODS) / sizeof(METHODS[0]));
+    int warmup = 1, repeat = 5;
+    unsigned int seed = 1;
+    bool solverStats = false;
+    for (int i = 1; i < argc; ++i) {
+        const string arg = argv[i];
+        const bool hasValue = i + 1 < argc;
+        if (arg == "--data" && hasValue) {
+            data = argv[++i];
+        } else if (arg == "--scenes" && hasValue) {
+            scenes = Split(argv[++i]);
+        } else if (arg == "--methods" && hasValue) {
+            methods = Split(argv[++i]);
+        } else if (arg == "--warmup" && hasValue) {
+            warmup = max(atoi(argv[++i]), 0);
+        } else if (arg == "--repeat" && hasValue) {
+            repeat = max(atoi(argv[++i]), 1);
+        } else if (arg == "--seed" && hasValue) {
+            seed = (unsigned int)strtoul(argv[++i], NULL, 10);
+        } else if (arg == "--csv" && hasValue) {
+            csv = argv[++i];
+        } else if (arg == "--json" && hasValue) {
+            json = argv[++i];
+        } else if (arg == "--trace" && hasValue) {
+            trace = argv[++i];
+        } else if (arg == "--solver-stats") {
+            solverStats = true;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    for (size_t m = 0; m < methods.size(); ++m)
+        if (!StereoMatcher::Create(methods[m])) {
+            usage(argv[0]);
+            return 1;
+        }
+
+    // Views of the scenes, rectified if they come with a calibration
+    vector<StereoPairFiles> pairs;
+    vector<string> names;
+    for (size_t s = 0; s < scenes.size(); ++s) {
+        vector<BatchJob> jobs = BatchMatcher::Discover(data + "/" + scenes[s],
+                                "", "");
+        if (jobs.empty()) {
+            cerr << "Error: no stereo pair in " << data << "/" << scenes[s]
+                 << endl;
+            return 1;
+        }
+        pairs.push_back(jobs[0].files);
+        names.push_back(scenes[s]);
+    }
+
+    vector<BenchResult> results;
+    bool ok = true;
+    TraceSession session(trace);
+    // Loading and rectification of the pairs done before any timed run, so
+    // that they do not compete with the matches
+    vector<StereoFrame> frames;
+    StereoPipeline pipeline(pairs);
+    pipeline.Run([&](StereoFrame &frame) {
+        if (frame.left.empty() || frame.right.empty()) {
+            cerr << "Error reading views " << frame.files.left << " and "
+                 << frame.files.right << endl;
+            ok = false;
+        }
+        frames.push_back(frame);
+    });
+    for (size_t f = 0; ok && f < frames.size(); ++f) {
+        const StereoFrame &frame = frames[f];
+        MatcherConfig config;
+        config.dMin = -frame.left.cols / 8;
+        config.dMax = 0;
+        config.windowSize = (frame.left.cols / 8 / 12) * 2 + 1;
+        config.seed = seed;
+        Mat disparity(frame.left.size(), CV_32FC1);
+        for (size_t m = 0; ok && m < methods.size(); ++m) {
+            unique_ptr<StereoMatcher> matcher =
+                StereoMatcher::Create(methods[m]);
+            const bool peakRssCumulative = !ResetPeakRss();
+            vector<double> wall, cpu;
+            for (int i = 0; ok && i < warmup + repeat; ++i) {
+                // Same seed, so same expansion moves, at each run
+                matcher->Configure(config);
+                const double cpu0 = CpuMs();
+                const chrono::steady_clock::time_point start =
+                    chrono::steady_clock::now();
+                ok = matcher->Match(frame.left, frame.right, disparity);
+                const chrono::steady_clock::duration elapsed =
+                    chrono::steady_clock::now() - start;
+                const double ms =
+                    chrono::duration<double, milli>(elapsed).count();
+                if (i >= warmup) {
+                    wall.push_back(ms);
+                    cpu.push_back(CpuMs() - cpu0);
+                }
+            }
+            if (ok && solverStats) { // Instrumented, so apart from timed runs
+                MatcherConfig instrumented = config;
+                instrumented.solverStats = true;
+                matcher->Configure(instrumented);
+                ok = matcher->Match(frame.left, frame.right, disparity);
+            }
+            if (!ok) {
+                break;
+            }
+            BenchResult r;
+            r.method = methods[m];
+            r.scene = names[frame.index];
+            r.width = frame.left.cols;
+            r.height = frame.left.rows;
+            r.dMin = config.dMin;
+            r.dMax = config.dMax;
+            r.windowSize = config.windowSize;
+            r.wallMedian = Median(wall);
+            r.wallMin = *min_element(wall.begin(), wall.end());
+            r.wallMean = 0;
+            for (size_t i = 0; i < wall.size(); ++i) {
+                r.wallMean += wall[i] / wall.size();
+            }
+            r.cpuMedian = Median(cpu);
+            r.mpds = (double)r.width * r.height * (r.dMax - r.dMin + 1) /
+                     (r.wallMedian * 1e3);
+            r.peakRss = PeakRssKb();
+            r.peakRssCumulative = peakRssCumulative;
+            const MatcherStats &stats = matcher->Stats();
+            r.matched = (double)stats.matched / max(stats.pixels, (size_t)1);
+            r.expansions = stats.expansions;
+            r.buildMs = stats.buildSeconds * 1e3;
+            r.solver = stats.solver;
+            results.push_back(r);
+            cout << r.method << " " << r.scene << ": " << r.wallMedian
+                 << " ms wall, " << r.cpuMedian << " ms CPU, " << r.mpds
+                 << " Mpd/s, " << (r.peakRssCumulative ? "process " : "")
+                 << "peak RSS " << r.peakRss / 1024 << " MiB" << endl;
+            if (r.expansions) {
+                const GraphStats &s = r.solver;
+                cout << "  " << r.expansions << " expansions, "
+                     << s.augmentations << " augmentations (mean path "
+                     << MeanPath(s) << "), " << s.orphans << " orphans, "
+                     << s.walks << " root searches; build " << r.buildMs
+                     << " ms, grow " << s.seconds[GRAPH_GROW] * 1e3
+                     << " ms, augment " << s.seconds[GRAPH_AUGMENT] * 1e3
+                     << " ms, adopt " << s.seconds[GRAPH_ADOPT] * 1e3 << " ms"
+                     << endl;
+            }
+        }
+    }
+    if (!csv.empty()) {
+        ok = WriteCsv(csv, results) && ok;
+    }
+    if (!json.empty()) {
+        ok = WriteJson(json, warmup, repeat, seed, results) && ok;
+    }
+    return ok ? 0 : 1;
+}
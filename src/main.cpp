@@ -1,9 +1,15 @@
+#include <chrono>
 #include <iostream>
+#include <limits>
 #include <string>
 #include <sstream>
 #include "StereoRectifier.h"
 #include "LocalMatcher.h"
 #include "GlobalMatcher.h"
+#include "StereoPipeline.h"
+#include "StereoStream.h"
+#include "TiledMatcher.h"
+#include "Trace.h"
 #include "opencv2/opencv.hpp"
 
 using namespace cv;
@@ -18,6 +24,24 @@ int main(int argc, char *argv[]) {
 
     //input
     match_method m_method;
+    // --crop: match only the valid region of rectified views
+    // --stream: SAD by bands of rows, the disparity written as it comes
+    // --tiled: GC by tiles of rectified views in tiled TIFF files
+    // --trace FILE: write the spans of the run as Chrome trace JSON
+    // --preview N: match views decoded at 1/N of their size, not rectified
+    bool crop = false, stream = false, tiled = false;
+    int preview = 1;
+    string trace_filename;
+    for (int i = 1; i < argc; ++i) {
+        crop = crop || string(argv[i]) == "--crop";
+        stream = stream || string(argv[i]) == "--stream";
+        tiled = tiled || string(argv[i]) == "--tiled";
+        if (string(argv[i]) == "--trace" && i + 1 < argc)
+            trace_filename = argv[++i];
+        else if (string(argv[i]) == "--preview" && i + 1 < argc)
+            preview = atoi(argv[++i]);
+    }
+    TraceSession trace(trace_filename);
     string calib_filename, output_filename;
     string filename_left_view, filename_right_view;
 
@@ -41,45 +65,115 @@ int main(int argc, char *argv[]) {
         int t_method;
         cin >> t_method, m_method = match_method(t_method);
     }
-    // Read image
-    Mat left_view, right_view;
-    left_view = imread(filename_left_view, CV_LOAD_IMAGE_GRAYSCALE);
-    right_view = imread(filename_right_view, CV_LOAD_IMAGE_GRAYSCALE);
+    // Read images (both views decoded in parallel) and stereo rectify
+    vector<StereoPairFiles> pairs(1);
+    pairs[0].left = filename_left_view;
+    pairs[0].right = filename_right_view;
+    pairs[0].calib = calib_filename;
+    if (tiled) {
+        Size size = TiledMatcher::ViewSize(filename_left_view);
+        if (size.area() == 0) {
+            cout << "fail to open" << endl;
+            return -1;
+        }
+        TileMatcher gc = [](Mat &left, Mat &right, int dMin, int dMax,
+                            Mat &disparity) {
+            GlobalMatcher gm;
+            gm.SetThreads(1); // Tiles already run a thread each
+            Mat output, disp, occl;
+            gm.run(left, right, dMin, dMax, output, &disp, &occl);
+            disp.convertTo(disparity, CV_32F);
+            disparity.setTo(Scalar(numeric_limits<float>::quiet_NaN()), occl);
+        };
+        TiledMatcher tiler(gc);
+        cout << "Running GC Match (tiled)" << endl;
+        chrono::steady_clock::time_point start_time = chrono::steady_clock::now();
+        if (!tiler.Run(filename_left_view, filename_right_view,
+                       -size.width / 8, 0, output_filename)) {
+            return -1;
+        }
+        double total_time = chrono::duration<double, milli>(
+                                chrono::steady_clock::now() - start_time).count();
+        cout << "processing time: " << total_time << "ms" << endl;
+        return 0;
+    }
+    if (stream && m_method == SAD) {
+        StereoRectifier rectifier;
+        StreamingStereo streaming;
+        if (!streaming.Open(pairs[0], rectifier)) {
+            cout << "fail to open" << endl;
+            return -1;
+        }
+        int max_disparity = streaming.size().width / 8;
+        int window_size = (max_disparity / 12) * 2 + 1;
+        cout << "Running SAD Match (streaming)" << endl;
+        chrono::steady_clock::time_point start_time = chrono::steady_clock::now();
+        if (!streaming.MatchSAD(window_size, max_disparity, output_filename)) {
+            return -1;
+        }
+        double total_time = chrono::duration<double, milli>(
+                                chrono::steady_clock::now() - start_time).count();
+        cout << "processing time: " << total_time << "ms" << endl;
+        return 0;
+    }
+    Mat left_view, right_view, stereo_image;
+    Rect left_roi, right_roi;
+    if (preview != 2 && preview != 4 && preview != 8)
+        preview = 1;
+    // GC reads Birchfield-Tomasi ranges, computed along with rectification
+    TransformedView views[2];
+    StereoPipeline pipeline(pairs, 2, IMREAD_GRAYSCALE, preview,
+                            m_method == GRAPH_CUT ? TRANSFORM_BT : TRANSFORM_NONE);
+    pipeline.Run([&](StereoFrame &frame) {
+        left_view = frame.left;
+        right_view = frame.right;
+        views[0] = frame.transformed[0];
+        views[1] = frame.transformed[1];
+        stereo_image = frame.stereo;
+        if (crop && !left_view.empty()) {
+            int d = left_view.cols / 8;
+            pipeline.Rectifier().MatchRegion(-d, 0, &left_roi, &right_roi);
+        }
+    });
     if (left_view.empty() || right_view.empty()) {
         cout << "fail to open" << endl;
         return -1;
     }
     int width = left_view.size().width;
     int height = left_view.size().height;
-
-    // Stereo rectify
-    Mat stereo_image;
-    StereoRectifier sr;
-    sr.StereoRectify(calib_filename, left_view, right_view, stereo_image);
     // Stereo match
     int max_disparity = width / 8;
     int window_size = (max_disparity / 12) * 2 + 1;
     Mat disparity(left_view.rows, left_view.cols, CV_8UC3, Scalar(0, 0, 0));
+    if (!crop) {
+        left_roi = right_roi = Rect(0, 0, width, height);
+    }
+    // Local matchers compare same columns: both views on the expanded region
+    Mat left_local = left_view(right_roi), right_local = right_view(right_roi);
+    Mat disparity_local = disparity(right_roi);
 
-    time_t start_time, end_time;
-    start_time = clock();
+    // Wall time: matchers may run threads
+    chrono::steady_clock::time_point start_time, end_time;
+    start_time = chrono::steady_clock::now();
     if (m_method == SAD) {
         LocalMatcher lm;
         cout << "Running SAD Match" << endl;
-        lm.LocalMatchingSAD(left_view, right_view, window_size,
-                            max_disparity, disparity);
+        lm.LocalMatchingSAD(left_local, right_local, window_size,
+                            max_disparity, disparity_local);
     } else  if (m_method == NCC) {
         LocalMatcher lm;
         cout << "Running NCC Match" << endl;
-        lm.LocalMatchingNCC(left_view, right_view, window_size,
-                            max_disparity, disparity);
+        lm.LocalMatchingNCC(left_local, right_local, window_size,
+                            max_disparity, disparity_local);
     } else if (m_method == GRAPH_CUT) {
         GlobalMatcher gm;
-        gm.run(left_view, right_view, -max_disparity, 0, disparity);
+        gm.run(views[0], views[1], left_roi, right_roi,
+               -max_disparity, 0, disparity);
     }
-    end_time = clock();
+    end_time = chrono::steady_clock::now();
 
-    double total_time = double(end_time - start_time) / CLOCKS_PER_SEC * 1000;
+    double total_time = chrono::duration<double, milli>(end_time -
+                        start_time).count();
     cout << "processing time: " << total_time << "ms" << endl;
     cout << "Image size: [" << disparity.cols << ", " << disparity.rows << "]";
 
@@ -97,8 +191,10 @@ int main(int argc, char *argv[]) {
     waitKey(0);
 
     destroyAllWindows();
-    if (!output_filename.empty())
+    if (!output_filename.empty()) {
+        TraceSpan span("save output");
         imwrite(output_filename, disparity);
+    }
 
     return 0;
 }
\ No newline at end of file
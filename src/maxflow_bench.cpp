@@ -0,0 +1,335 @@
+// Microbenchmark of the Boykov-Kolmogorov max-flow of Graph, on synthetic
+// 4-connected grids or on expansion graphs recorded from the matcher, to
+// tune the solver independently of the matcher.
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+#include "Graph.h"
+#include "GlobalMatcher.h"
+#include "opencv2/opencv.hpp"
+
+using namespace std;
+
+/// Graph of the energy of the matcher with values of type \a Value, plain
+/// and instrumented: short for the default layout (EnergyS32), int for wide
+/// values (EnergyI32).
+template <typename Value>
+struct BenchGraphs {
+    typedef Graph<Value, Value, long long, int> Plain;
+    typedef Graph<Value, Value, long long, int, GraphStats> Stats;
+};
+
+/// Capacities of a synthetic grid
+struct GridParams {
+    int width, height;
+    enum { UNIFORM, EXPONENTIAL, CONSTANT } distribution;
+    int capMax;        ///< largest capacity (mean * 4 for exponential)
+    bool wide;         ///< 32-bit capacities instead of the matcher's 16-bit
+    double terminals;  ///< fraction of nodes linked to a terminal
+    unsigned seed;
+};
+
+/// Measures of max-flow on a graph
+struct FlowResult {
+    long long nodes, arcs, flow;
+    GraphStats stats;  ///< counters and phases of an instrumented run
+    double maxflowMs;  ///< median time of uninstrumented runs
+};
+
+template <class GraphT>
+static void BuildGrid(const GridParams &p, GraphT &g) {
+    mt19937 rng(p.seed);
+    uniform_int_distribution<int> uniform(0, p.capMax);
+    exponential_distribution<double> exponential(4.0 / max(p.capMax, 1));
+    bernoulli_distribution terminal(p.terminals), source(0.5);
+    auto cap = [&]() {
+        switch (p.distribution) {
+        case GridParams::UNIFORM:
+            return uniform(rng);
+        case GridParams::EXPONENTIAL:
+            return (int)min(exponential(rng), (double)p.capMax);
+        default:
+            return p.capMax;
+        }
+    };
+    for (int i = 0; i < p.width * p.height; i++) {
+        g.add_node();
+        if (terminal(rng)) {
+            const int c = cap();
+            const bool s = source(rng);
+            g.add_tweights(i, s ? c : 0, s ? 0 : c);
+        }
+    }
+    for (int y = 0; y < p.height; y++)
+        for (int x = 0; x < p.width; x++) {
+            const int i = y * p.width + x;
+            if (x + 1 < p.width) {
+                const int c = cap();
+                g.add_edge(i, i + 1, c, cap());
+            }
+            if (y + 1 < p.height) {
+                const int c = cap();
+                g.add_edge(i, i + p.width, c, cap());
+            }
+        }
+}
+
+/// Run max-flow on a graph of \a nodes nodes and \a arcs arcs built by
+/// \a build, once instrumented and \a repeat times not. The graph is rebuilt
+/// for each run, maxflow() consuming it, with room for the arcs maxflow()
+/// adds as in the matcher.
+template <typename Value>
+static FlowResult Measure(
+    long long nodes, long long arcs,
+    const function<void(typename BenchGraphs<Value>::Stats &)> &buildStats,
+    const function<void(typename BenchGraphs<Value>::Plain &)> &build,
+    int repeat) {
+    typedef typename BenchGraphs<Value>::Plain BenchGraph;
+    typedef typename BenchGraphs<Value>::Stats StatsGraph;
+    FlowResult r;
+    r.nodes = nodes;
+    r.arcs = arcs;
+    StatsGraph instrumented((int)nodes, (int)arcs + 2);
+    buildStats(instrumented);
+    r.flow = instrumented.maxflow();
+    r.stats = instrumented.get_stats();
+
+    vector<double> ms;
+    for (int i = 0; i < repeat; i++) {
+        BenchGraph g((int)nodes, (int)arcs + 2);
+        build(g);
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        if (g.maxflow() != r.flow) {
+            cerr << "Error: max-flow differs between runs" << endl;
+            exit(1);
+        }
+        ms.push_back(chrono::duration<double, milli>(
+                         chrono::steady_clock::now() - start).count());
+    }
+    sort(ms.begin(), ms.end());
+    r.maxflowMs = ms[ms.size() / 2];
+    return r;
+}
+
+/// Max-flow of a grid with capacities of type \a Value
+template <typename Value>
+static FlowResult MeasureGrid(const GridParams &grid, int repeat) {
+    const long long nodes = (long long)grid.width * grid.height;
+    const long long arcs = 2 * ((grid.width - 1LL) * grid.height +
+                                grid.width * (grid.height - 1LL));
+    return Measure<Value>(nodes, arcs,
+    [&](typename BenchGraphs<Value>::Stats & g) {
+        BuildGrid(grid, g);
+    }, [&](typename BenchGraphs<Value>::Plain & g) {
+        BuildGrid(grid, g);
+    }, repeat);
+}
+
+/// Max-flow of the graph recorded at the position of \a f, with capacities of
+/// type \a Value, leaving \a f after it. Return false if there is none.
+template <typename Value>
+static bool MeasureRecorded(FILE *f, int repeat, FlowResult &r) {
+    const long pos = ftell(f);
+    typename BenchGraphs<Value>::Plain first;
+    if (!first.read(f)) {
+        return false;
+    }
+    const long next = ftell(f);
+    r = Measure<Value>(first.get_node_num(), first.get_arc_num(),
+    [&](typename BenchGraphs<Value>::Stats & g) {
+        fseek(f, pos, SEEK_SET);
+        g.read(f);
+    }, [&](typename BenchGraphs<Value>::Plain & g) {
+        fseek(f, pos, SEEK_SET);
+        g.read(f);
+    }, repeat);
+    fseek(f, next, SEEK_SET);
+    return true;
+}
+
+static void Print(const string &name, const FlowResult &r, ofstream &csv) {
+    const GraphStats &s = r.stats;
+    const double init = s.seconds[GRAPH_INIT] * 1e3;
+    const double grow = s.seconds[GRAPH_GROW] * 1e3;
+    const double augment = s.seconds[GRAPH_AUGMENT] * 1e3;
+    const double adopt = s.seconds[GRAPH_ADOPT] * 1e3;
+    const double meanPath = (double)s.pathArcs / max(s.augmentations, 1LL);
+    cout << name << ": " << r.nodes << " nodes, " << r.arcs
+         << " arcs, flow " << r.flow << endl
+         << "  " << s.growths << " growths, " << s.augmentations
+         << " augmentations (mean path " << meanPath << ", longest "
+         << s.longestPath << "), " << s.orphans << " orphans, " << s.walks
+         << " root searches (" << s.walkSteps << " steps)" << endl
+         << "  instrumented: init " << init << " ms, grow " << grow
+         << " ms, augment " << augment << " ms, adopt " << adopt << " ms"
+         << endl
+         << "  maxflow " << r.maxflowMs << " ms, "
+         << r.nodes / (r.maxflowMs * 1e3) << " Mnodes/s, "
+         << r.arcs / (r.maxflowMs * 1e3) << " Marcs/s" << endl;
+    if (csv.is_open()) {
+        csv << name << ',' << r.nodes << ',' << r.arcs << ',' << r.flow << ','
+            << s.growths << ',' << s.augmentations << ',' << meanPath << ','
+            << s.longestPath << ',' << s.orphans << ',' << s.walks << ','
+            << s.walkSteps << ',' << init << ',' << grow << ',' << augment
+            << ',' << adopt << ','
+            << r.maxflowMs << ',' << r.nodes / (r.maxflowMs * 1e3) << ','
+            << r.arcs / (r.maxflowMs * 1e3) << endl;
+    }
+}
+
+static void usage(const char *name) {
+    cerr << "Usage: " << name << " grid WIDTH HEIGHT [options]" << endl
+         << "       " << name << " record LEFT RIGHT FILE [options]" << endl
+         << "       " << name << " replay FILE [options]" << endl
+         << "grid: 4-connected grid" << endl
+         << "  --cap uniform|exp|const  capacity distribution (default"
+         << " uniform)" << endl
+         << "  --cap-max N         largest capacity (default 100)" << endl
+         << "  --terminals F       fraction of nodes with terminal arcs"
+         << " (default 0.5)" << endl
+         << "  --seed N            random seed (default 1)" << endl
+         << "  --wide              32-bit capacities (default 16-bit as"
+         << " the matcher)" << endl
+         << "record: append the expansion graphs of a graph cuts match of a"
+         << " pair" << endl
+         << "  --max-graphs N      graphs to record (default all)" << endl
+         << "replay: max-flow of recorded graphs, with the capacity type"
+         << " they were recorded with" << endl
+         << "  --limit N           graphs to replay (default all)" << endl
+         << "all:" << endl
+         << "  --repeat N          timed runs per graph (default 5)" << endl
+         << "  --csv FILE          write measures as CSV" << endl;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        usage(argv[0]);
+        return 1;
+    }
+    const string mode = argv[1];
+    vector<string> args;
+    GridParams grid = { 0, 0, GridParams::UNIFORM, 100, false, 0.5, 1 };
+    int repeat = 5, maxGraphs = -1, limit = -1;
+    string csvFile;
+    for (int i = 2; i < argc; i++) {
+        const string arg = argv[i];
+        const bool hasValue = i + 1 < argc;
+        if (arg == "--cap" && hasValue) {
+            const string d = argv[++i];
+            grid.distribution = d == "exp" ? GridParams::EXPONENTIAL :
+                                d == "const" ? GridParams::CONSTANT :
+                                GridParams::UNIFORM;
+        } else if (arg == "--cap-max" && hasValue) {
+            grid.capMax = max(atoi(argv[++i]), 0);
+        } else if (arg == "--wide") {
+            grid.wide = true;
+        } else if (arg == "--terminals" && hasValue) {
+            grid.terminals = min(max(atof(argv[++i]), 0.0), 1.0);
+        } else if (arg == "--seed" && hasValue) {
+            grid.seed = (unsigned)atoi(argv[++i]);
+        } else if (arg == "--max-graphs" && hasValue) {
+            maxGraphs = atoi(argv[++i]);
+        } else if (arg == "--limit" && hasValue) {
+            limit = atoi(argv[++i]);
+        } else if (arg == "--repeat" && hasValue) {
+            repeat = max(atoi(argv[++i]), 1);
+        } else if (arg == "--csv" && hasValue) {
+            csvFile = argv[++i];
+        } else if (arg.size() > 1 && arg[0] == '-') {
+            usage(argv[0]);
+            return 1;
+        } else {
+            args.push_back(arg);
+        }
+    }
+
+    if (mode == "record" && args.size() == 3) {
+        cv::Mat left = cv::imread(args[0], cv::IMREAD_GRAYSCALE);
+        cv::Mat right = cv::imread(args[1], cv::IMREAD_GRAYSCALE);
+        if (left.empty() || right.empty()) {
+            cerr << "Error reading views " << args[0] << " and " << args[1]
+                 << endl;
+            return 1;
+        }
+        GlobalMatcher gm;
+        gm.RecordGraphs(args[2], maxGraphs);
+        cv::Mat output;
+        gm.run(left, right, -left.cols / 8, 0, output);
+        return 0;
+    }
+
+    ofstream csv;
+    if (!csvFile.empty()) {
+        csv.open(csvFile.c_str());
+        csv << "graph,nodes,arcs,flow,growths,augmentations,mean_path,"
+            << "longest_path,orphans,root_searches,root_steps,init_ms,"
+            << "grow_ms,augment_ms,adopt_ms,maxflow_ms,mnodes_per_s,"
+            << "marcs_per_s" << endl;
+    }
+    if (mode == "grid" && args.size() == 2) {
+        grid.width = atoi(args[0].c_str());
+        grid.height = atoi(args[1].c_str());
+        if (grid.width <= 0 || grid.height <= 0) {
+            usage(argv[0]);
+            return 1;
+        }
+        if (!grid.wide && grid.capMax > numeric_limits<short>::max()) {
+            cerr << "Error: capacities up to " << grid.capMax
+                 << " need --wide" << endl;
+            return 1;
+        }
+        FlowResult r = grid.wide ? MeasureGrid<int>(grid, repeat) :
+                       MeasureGrid<short>(grid, repeat);
+        Print("grid", r, csv);
+        return 0;
+    }
+    if (mode == "replay" && args.size() == 1) {
+        FILE *f = fopen(args[0].c_str(), "rb");
+        if (!f) {
+            cerr << "Error reading file " << args[0] << endl;
+            return 1;
+        }
+        FlowResult total = FlowResult();
+        int n = 0;
+        for (; limit < 0 || n < limit; n++) {
+            const int capSize = BenchGraphs<int>::Plain::read_cap_size(f);
+            if (capSize == 0) {
+                break;
+            }
+            FlowResult r;
+            const bool ok = capSize == (int)sizeof(short) ?
+                            MeasureRecorded<short>(f, repeat, r) :
+                            capSize == (int)sizeof(int) &&
+                            MeasureRecorded<int>(f, repeat, r);
+            if (!ok) {
+                cerr << "Error reading graph " << n << " of " << args[0]
+                     << endl;
+                fclose(f);
+                return 1;
+            }
+            Print("graph " + to_string(n), r, csv);
+            total.nodes += r.nodes;
+            total.arcs += r.arcs;
+            total.flow += r.flow;
+            total.maxflowMs += r.maxflowMs;
+            total.stats.add(r.stats);
+        }
+        fclose(f);
+        if (n == 0) {
+            cerr << "Error: no graph in " << args[0] << endl;
+            return 1;
+        }
+        Print("total of " + to_string(n) + " graphs", total, csv);
+        return 0;
+    }
+    usage(argv[0]);
+    return 1;
+}
@@ -0,0 +1,216 @@
+// Headless stereo matching: no window, no prompt, everything on the command
+// line.
+#include <sys/stat.h>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "BatchMatcher.h"
+#include "StereoMatcher.h"
+#include "StereoPipeline.h"
+#include "Trace.h"
+#include "opencv2/opencv.hpp"
+
+using namespace cv;
+using namespace std;
+
+static void usage(const char *name) {
+    cerr << "Usage: " << name << " [options] left right output" << endl
+         << "       " << name << " [options] --batch DIR|MANIFEST" << endl
+         << "  --method sad|ncc|census|gc  matcher (default gc)" << endl
+         << "  --dmin N --dmax N    disparity range, right x = left x + d"
+         << " (default -width/8 to 0)" << endl
+         << "  --window N           window of sad, ncc and census (odd)"
+         << endl
+         << "  --calib FILE         calibration to rectify the views" << endl
+         << "  --reuse-cost         gc: keep the occlusion cost of the first"
+         << " run" << endl
+         << "  --repeat N           match N times, for timing" << endl
+         << "  --preview N          match views decoded at 1/N of their size"
+         << " (2, 4 or 8)," << endl
+         << "                       not rectified, disparities in full size"
+         << " pixels" << endl
+         << "  --trace FILE         write spans of the run as Chrome trace"
+         << " JSON" << endl
+         << "Batch: pairs of a directory tree (imL/imR, im0/im1 or left/right,"
+         << " para.txt)" << endl
+         << "or of a manifest (lines \"left right [calib|- [name]]\")" << endl
+         << "  --out DIR            disparities and report (default .)" << endl
+         << "  --format png|tif|pfm disparity files (default png)" << endl
+         << "  --threads N          threads of the pool (default one per core)"
+         << endl
+         << "  --pixels-per-thread N  pixels matched by a thread of a pair"
+         << " (default 262144)" << endl
+         << "  --report FILE        timing per pair, CSV (default"
+         << " DIR/report.csv)" << endl
+         << "Output by extension: .tif/.tiff float TIFF and .pfm (NaN where"
+         << " unknown)," << endl
+         << "others KITTI 16-bit PNG of 256 * d (0 where unknown), d"
+         << " negated if" << endl
+         << "no disparity is positive." << endl;
+}
+
+/// Match the pairs of directory tree or manifest \a batch.
+static int RunBatch(const string &method, const MatcherConfig &config,
+                    const string &batch, const string &outDir,
+                    const string &ext, const string &report, int threads,
+                    size_t pixelsPerThread) {
+    vector<BatchJob> jobs;
+    struct stat st;
+    if (stat(batch.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) {
+        jobs = BatchMatcher::Discover(batch, outDir, ext);
+    } else if (!BatchMatcher::ReadManifest(batch, outDir, ext, jobs)) {
+        return 1;
+    }
+    if (jobs.empty()) {
+        cerr << "Error: no stereo pair in " << batch << endl;
+        return 1;
+    }
+    mkdir(outDir.c_str(), 0755);
+
+    BatchMatcher matcher(method, config, threads, pixelsPerThread);
+    vector<BatchTiming> timings;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    const bool ok = matcher.Run(jobs, timings);
+    const double seconds = chrono::duration<double>(
+                               chrono::steady_clock::now() - start).count();
+    for (size_t i = 0; i < timings.size(); ++i) {
+        const BatchTiming &t = timings[i];
+        cout << t.name << ": " << (t.ok ? "" : "FAILED ") << t.size.width
+             << "x" << t.size.height << ", " << t.threads << " thread(s), "
+             << "match " << t.match * 1000 << " ms" << endl;
+    }
+    cout << jobs.size() << " pairs in " << seconds << " s" << endl;
+    return (BatchMatcher::WriteReport(report, timings) && ok) ? 0 : 1;
+}
+
+int main(int argc, char *argv[]) {
+    string method = "gc";
+    vector<string> files;
+    StereoPairFiles pair;
+    MatcherConfig config;
+    bool dMinSet = false, dMaxSet = false, windowSet = false;
+    int repeat = 1, preview = 1;
+    string batch, outDir = ".", format = "png", report, traceFile;
+    int threads = 0;
+    size_t pixelsPerThread = (size_t)1 << 18;
+    for (int i = 1; i < argc; ++i) {
+        const string arg = argv[i];
+        const bool hasValue = i + 1 < argc;
+        if (arg == "--method" && hasValue) {
+            method = argv[++i];
+        } else if (arg == "--dmin" && hasValue) {
+            config.dMin = atoi(argv[++i]);
+            dMinSet = true;
+        } else if (arg == "--dmax" && hasValue) {
+            config.dMax = atoi(argv[++i]);
+            dMaxSet = true;
+        } else if (arg == "--window" && hasValue) {
+            config.windowSize = atoi(argv[++i]);
+            windowSet = true;
+        } else if (arg == "--calib" && hasValue) {
+            pair.calib = argv[++i];
+        } else if (arg == "--reuse-cost") {
+            config.reuseCost = true;
+        } else if (arg == "--repeat" && hasValue) {
+            repeat = max(atoi(argv[++i]), 1);
+        } else if (arg == "--preview" && hasValue) {
+            preview = atoi(argv[++i]);
+        } else if (arg == "--batch" && hasValue) {
+            batch = argv[++i];
+        } else if (arg == "--out" && hasValue) {
+            outDir = argv[++i];
+        } else if (arg == "--format" && hasValue) {
+            format = argv[++i];
+        } else if (arg == "--threads" && hasValue) {
+            threads = atoi(argv[++i]);
+        } else if (arg == "--pixels-per-thread" && hasValue) {
+            pixelsPerThread = (size_t)max(atol(argv[++i]), 1L);
+        } else if (arg == "--report" && hasValue) {
+            report = argv[++i];
+        } else if (arg == "--trace" && hasValue) {
+            traceFile = argv[++i];
+        } else if (arg.size() > 1 && arg[0] == '-') {
+            usage(argv[0]);
+            return 1;
+        } else {
+            files.push_back(arg);
+        }
+    }
+    unique_ptr<StereoMatcher> matcher = StereoMatcher::Create(method);
+    if (!matcher || files.size() != (batch.empty() ? 3u : 0u) ||
+            (preview != 1 && preview != 2 && preview != 4 && preview != 8) ||
+            (preview != 1 && !batch.empty())) {
+        usage(argv[0]);
+        return 1;
+    }
+    TraceSession trace(traceFile);
+    if (!batch.empty()) {
+        if (!dMinSet && !dMaxSet) {
+            config.dMin = 1; // Empty range: default of each pair
+            config.dMax = 0;
+        }
+        if (!windowSet) {
+            config.windowSize = 0;
+        }
+        return RunBatch(method, config, batch, outDir, "." + format,
+                        report.empty() ? outDir + "/report.csv" : report,
+                        threads, pixelsPerThread);
+    }
+    pair.left = files[0];
+    pair.right = files[1];
+
+    // Views rectified along with the transform the matcher reads
+    Mat left_view, right_view;
+    TransformedView views[2];
+    StereoPipeline pipeline(vector<StereoPairFiles>(1, pair), 2,
+                            IMREAD_GRAYSCALE, preview, matcher->Transform());
+    pipeline.Run([&](StereoFrame &frame) {
+        left_view = frame.left;
+        right_view = frame.right;
+        views[0] = frame.transformed[0];
+        views[1] = frame.transformed[1];
+    });
+    if (left_view.empty() || right_view.empty()) {
+        cerr << "Error reading views " << pair.left << " and " << pair.right
+             << endl;
+        return 1;
+    }
+    // Same defaults as the interactive program
+    const int max_disparity = left_view.cols / 8;
+    if (!dMinSet) {
+        config.dMin = -max_disparity;
+    } else { // Range of full size views
+        config.dMin = (int)floor((double)config.dMin / preview);
+    }
+    if (!dMaxSet) {
+        config.dMax = 0;
+    } else {
+        config.dMax = (int)ceil((double)config.dMax / preview);
+    }
+    if (!windowSet) {
+        config.windowSize = (max_disparity / 12) * 2 + 1;
+    }
+    matcher->Configure(config);
+
+    Mat disparity(left_view.size(), CV_32FC1);
+    double seconds = 0;
+    for (int i = 0; i < repeat; ++i) {
+        if (!matcher->Match(views[0], views[1], disparity)) {
+            return 1;
+        }
+        seconds += matcher->Stats().seconds;
+    }
+    const MatcherStats &stats = matcher->Stats();
+    cout << matcher->Name() << ": " << left_view.cols << "x" << left_view.rows
+         << ", d in [" << config.dMin << ", " << config.dMax << "], "
+         << seconds / repeat * 1000 << " ms per match, "
+         << 100.0 * stats.matched / max(stats.pixels, (size_t)1)
+         << "% matched" << endl;
+    if (preview > 1) {
+        disparity *= preview;
+    }
+    return SaveDisparity(files[2], disparity) ? 0 : 1;
+}